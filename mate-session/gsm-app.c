@@ -48,6 +48,12 @@ enum {
 
 static guint32 app_serial = 1;
 
+/* Lists the apps, as children of /org/gnome/SessionManager, on the
+ * connection they are exported on */
+#define GSM_APP_MANAGER_DBUS_PATH "/org/gnome/SessionManager"
+
+static GDBusObjectManagerServer *app_manager = NULL;
+
 static guint signals[LAST_SIGNAL] = { 0 };
 
 enum {
@@ -118,6 +124,120 @@ gsm_app_get_phase (GsmExportedApp        *skeleton,
         return TRUE;
 }
 
+/* Same encoding as sd_bus_path_encode() */
+static char *
+unit_object_path (const char *unit)
+{
+        GString    *path;
+        const char *p;
+
+        path = g_string_new ("/org/freedesktop/systemd1/unit/");
+
+        for (p = unit; *p != '\0'; p++) {
+                if (g_ascii_isalnum (*p) && !(p == unit && g_ascii_isdigit (*p))) {
+                        g_string_append_c (path, *p);
+                } else {
+                        g_string_append_printf (path, "_%02x", (guchar) *p);
+                }
+        }
+
+        return g_string_free (path, FALSE);
+}
+
+static void
+on_scope_properties (GDBusConnection       *connection,
+                     GAsyncResult          *result,
+                     GDBusMethodInvocation *invocation)
+{
+        GVariant *reply;
+        GVariant *properties;
+        GError   *error;
+        guint64   cpu_usage;
+        guint64   memory;
+
+        error = NULL;
+        reply = g_dbus_connection_call_finish (connection, result, &error);
+        if (reply == NULL) {
+                g_dbus_method_invocation_take_error (invocation, error);
+                return;
+        }
+
+        /* systemd also uses (guint64) -1 for "not known" */
+        cpu_usage = G_MAXUINT64;
+        memory = G_MAXUINT64;
+
+        g_variant_get (reply, "(@a{sv})", &properties);
+        g_variant_lookup (properties, "CPUUsageNSec", "t", &cpu_usage);
+        g_variant_lookup (properties, "MemoryCurrent", "t", &memory);
+        g_variant_unref (properties);
+        g_variant_unref (reply);
+
+        g_dbus_method_invocation_return_value (invocation,
+                                               g_variant_new ("(tt)", cpu_usage, memory));
+}
+
+static gboolean
+gsm_app_get_resource_usage (GsmExportedApp        *skeleton,
+                            GDBusMethodInvocation *invocation,
+                            GsmApp                *app)
+{
+        GsmAppPrivate *priv;
+        const char    *unit;
+        char          *path;
+
+        priv = gsm_app_get_instance_private (app);
+
+        unit = NULL;
+        if (GSM_APP_GET_CLASS (app)->impl_get_scope_unit != NULL) {
+                unit = GSM_APP_GET_CLASS (app)->impl_get_scope_unit (app);
+        }
+
+        if (unit == NULL) {
+                g_dbus_method_invocation_return_error (invocation,
+                                                       GSM_APP_ERROR, GSM_APP_ERROR_GENERAL,
+                                                       "Application is not running in its own scope");
+                return TRUE;
+        }
+
+        path = unit_object_path (unit);
+        g_dbus_connection_call (priv->connection,
+                                "org.freedesktop.systemd1",
+                                path,
+                                "org.freedesktop.DBus.Properties",
+                                "GetAll",
+                                g_variant_new ("(s)", "org.freedesktop.systemd1.Scope"),
+                                G_VARIANT_TYPE ("(a{sv})"),
+                                G_DBUS_CALL_FLAGS_NONE,
+                                -1,
+                                NULL,
+                                (GAsyncReadyCallback) on_scope_properties,
+                                invocation);
+        g_free (path);
+
+        return TRUE;
+}
+
+static gboolean
+gsm_app_handle_get_last_exit (GsmExportedApp        *skeleton,
+                              GDBusMethodInvocation *invocation,
+                              GsmApp                *app)
+{
+        int    status;
+        gint64 run_time;
+
+        if (!gsm_app_get_last_exit (app, &status, &run_time)) {
+                g_dbus_method_invocation_return_error (invocation,
+                                                       GSM_APP_ERROR, GSM_APP_ERROR_GENERAL,
+                                                       "Application has not exited yet");
+                return TRUE;
+        }
+
+        gsm_exported_app_complete_get_last_exit (skeleton, invocation,
+                                                 status, (guint64) run_time);
+
+        return TRUE;
+}
+
 static guint32
 get_next_app_serial (void)
 {
@@ -132,12 +252,24 @@ get_next_app_serial (void)
         return serial;
 }
 
+static GDBusObjectManagerServer *
+get_app_manager (GDBusConnection *connection)
+{
+        if (app_manager == NULL) {
+                app_manager = g_dbus_object_manager_server_new (GSM_APP_MANAGER_DBUS_PATH);
+                g_dbus_object_manager_server_set_connection (app_manager, connection);
+        }
+
+        return app_manager;
+}
+
 static gboolean
 register_app (GsmApp *app)
 {
         GError *error;
         GsmAppPrivate *priv;
         GsmExportedApp *skeleton;
+        GDBusObjectSkeleton *object;
 
         error = NULL;
         priv = gsm_app_get_instance_private (app);
@@ -151,17 +283,13 @@ register_app (GsmApp *app)
 
         skeleton = gsm_exported_app_skeleton_new ();
         priv->skeleton = skeleton;
-        g_dbus_interface_skeleton_export (G_DBUS_INTERFACE_SKELETON (skeleton),
-                                          priv->connection, priv->id,
-                                          &error);
 
-        if (error != NULL) {
-                g_critical ("error registering app on session bus: %s", error->message);
-                g_error_free (error);
-                g_clear_object (&priv->skeleton);
-                g_clear_object (&priv->connection);
-                return FALSE;
-        }
+        /* the object manager exports the object on its connection, and
+         * announces it with InterfacesAdded */
+        object = g_dbus_object_skeleton_new (priv->id);
+        g_dbus_object_skeleton_add_interface (object, G_DBUS_INTERFACE_SKELETON (skeleton));
+        g_dbus_object_manager_server_export (get_app_manager (priv->connection), object);
+        g_object_unref (object);
 
         g_signal_connect (skeleton, "handle-get-app-id",
                           G_CALLBACK (gsm_app_get_app_id), app);
@@ -169,6 +297,10 @@ register_app (GsmApp *app)
                           G_CALLBACK (gsm_app_get_phase), app);
         g_signal_connect (skeleton, "handle-get-startup-id",
                           G_CALLBACK (gsm_app_get_startup_id), app);
+        g_signal_connect (skeleton, "handle-get-resource-usage",
+                          G_CALLBACK (gsm_app_get_resource_usage), app);
+        g_signal_connect (skeleton, "handle-get-last-exit",
+                          G_CALLBACK (gsm_app_handle_get_last_exit), app);
 
         return TRUE;
 }
@@ -310,8 +442,8 @@ gsm_app_dispose (GObject *object)
         priv->id = NULL;
 
         if (priv->skeleton != NULL) {
-                g_dbus_interface_skeleton_unexport_from_connection (G_DBUS_INTERFACE_SKELETON (priv->skeleton),
-                                                                    priv->connection);
+                g_dbus_object_manager_server_unexport (app_manager,
+                                                       g_dbus_interface_skeleton_get_object_path (G_DBUS_INTERFACE_SKELETON (priv->skeleton)));
                 g_clear_object (&priv->skeleton);
         }
 
@@ -336,6 +468,8 @@ gsm_app_class_init (GsmAppClass *klass)
         klass->impl_provides = NULL;
         klass->impl_is_running = NULL;
         klass->impl_peek_autostart_delay = NULL;
+        klass->impl_peek_is_on_demand = NULL;
+        klass->impl_peek_on_demand_bus_name = NULL;
 
         g_object_class_install_property (object_class,
                                          PROP_PHASE,
@@ -470,6 +604,29 @@ gsm_app_is_running (GsmApp *app)
         }
 }
 
+/**
+ * gsm_app_get_last_exit:
+ * @app: a #GsmApp
+ * @status: return location for the wait status of the process, or
+ *   %GSM_APP_EXIT_STATUS_UNKNOWN
+ * @run_time: return location for how long it ran, in microseconds
+ *
+ * Returns: %FALSE if the app has not exited since it was added
+ **/
+gboolean
+gsm_app_get_last_exit (GsmApp *app,
+                       int    *status,
+                       gint64 *run_time)
+{
+        g_return_val_if_fail (GSM_IS_APP (app), FALSE);
+
+        if (GSM_APP_GET_CLASS (app)->impl_get_last_exit) {
+                return GSM_APP_GET_CLASS (app)->impl_get_last_exit (app, status, run_time);
+        } else {
+                return FALSE;
+        }
+}
+
 gboolean
 gsm_app_peek_autorestart (GsmApp *app)
 {
@@ -537,6 +694,30 @@ gsm_app_stop (GsmApp  *app,
         return GSM_APP_GET_CLASS (app)->impl_stop (app, error);
 }
 
+void
+gsm_app_set_priority (GsmApp        *app,
+                      GsmAppPriority priority)
+{
+        g_return_if_fail (GSM_IS_APP (app));
+
+        if (GSM_APP_GET_CLASS (app)->impl_set_priority) {
+                GSM_APP_GET_CLASS (app)->impl_set_priority (app, priority);
+        }
+}
+
+gboolean
+gsm_app_kill (GsmApp  *app,
+              GError **error)
+{
+        g_return_val_if_fail (GSM_IS_APP (app), FALSE);
+
+        if (GSM_APP_GET_CLASS (app)->impl_kill) {
+                return GSM_APP_GET_CLASS (app)->impl_kill (app, error);
+        } else {
+                return gsm_app_stop (app, error);
+        }
+}
+
 void
 gsm_app_registered (GsmApp *app)
 {
@@ -557,6 +738,30 @@ gsm_app_peek_autostart_delay (GsmApp *app)
         }
 }
 
+gboolean
+gsm_app_peek_is_on_demand (GsmApp *app)
+{
+        g_return_val_if_fail (GSM_IS_APP (app), FALSE);
+
+        if (GSM_APP_GET_CLASS (app)->impl_peek_is_on_demand) {
+                return GSM_APP_GET_CLASS (app)->impl_peek_is_on_demand (app);
+        } else {
+                return FALSE;
+        }
+}
+
+const char *
+gsm_app_peek_on_demand_bus_name (GsmApp *app)
+{
+        g_return_val_if_fail (GSM_IS_APP (app), NULL);
+
+        if (GSM_APP_GET_CLASS (app)->impl_peek_on_demand_bus_name) {
+                return GSM_APP_GET_CLASS (app)->impl_peek_on_demand_bus_name (app);
+        } else {
+                return NULL;
+        }
+}
+
 void
 gsm_app_exited (GsmApp *app)
 {
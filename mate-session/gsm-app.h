@@ -36,6 +36,17 @@ G_BEGIN_DECLS
 #define GSM_TYPE_APP            (gsm_app_get_type ())
 G_DECLARE_DERIVABLE_TYPE (GsmApp, gsm_app, GSM, APP, GObject)
 
+typedef enum
+{
+        GSM_APP_PRIORITY_NORMAL = 0,
+        GSM_APP_PRIORITY_HIGH,
+        GSM_APP_PRIORITY_LOW
+} GsmAppPriority;
+
+/* The exit status reported when the process ended but how it ended
+ * could not be found out; never a valid waitpid() status */
+#define GSM_APP_EXIT_STATUS_UNKNOWN (-1)
+
 struct _GsmAppClass
 {
         GObjectClass parent_class;
@@ -52,7 +63,11 @@ struct _GsmAppClass
                                                        GError    **error);
         gboolean    (*impl_stop)                      (GsmApp     *app,
                                                        GError    **error);
+        gboolean    (*impl_kill)                      (GsmApp     *app,
+                                                       GError    **error);
         int         (*impl_peek_autostart_delay)      (GsmApp     *app);
+        gboolean    (*impl_peek_is_on_demand)         (GsmApp     *app);
+        const char *(*impl_peek_on_demand_bus_name)   (GsmApp     *app);
         gboolean    (*impl_provides)                  (GsmApp     *app,
                                                        const char *service);
         gboolean    (*impl_has_autostart_condition)   (GsmApp     *app,
@@ -63,6 +78,12 @@ struct _GsmAppClass
         const char *(*impl_get_app_id)                (GsmApp     *app);
         gboolean    (*impl_is_disabled)               (GsmApp     *app);
         gboolean    (*impl_is_conditionally_disabled) (GsmApp     *app);
+        const char *(*impl_get_scope_unit)            (GsmApp     *app);
+        gboolean    (*impl_get_last_exit)             (GsmApp     *app,
+                                                       int        *status,
+                                                       gint64     *run_time);
+        void        (*impl_set_priority)              (GsmApp     *app,
+                                                       GsmAppPriority priority);
 };
 
 typedef enum
@@ -92,7 +113,14 @@ gboolean         gsm_app_restart                        (GsmApp     *app,
                                                          GError    **error);
 gboolean         gsm_app_stop                           (GsmApp     *app,
                                                          GError    **error);
+gboolean         gsm_app_kill                           (GsmApp     *app,
+                                                         GError    **error);
 gboolean         gsm_app_is_running                     (GsmApp     *app);
+gboolean         gsm_app_get_last_exit                  (GsmApp     *app,
+                                                         int        *status,
+                                                         gint64     *run_time);
+void             gsm_app_set_priority                   (GsmApp     *app,
+                                                         GsmAppPriority priority);
 
 void             gsm_app_exited                         (GsmApp     *app);
 void             gsm_app_died                           (GsmApp     *app);
@@ -103,6 +131,8 @@ gboolean         gsm_app_has_autostart_condition        (GsmApp     *app,
                                                          const char *condition);
 void             gsm_app_registered                     (GsmApp     *app);
 int              gsm_app_peek_autostart_delay           (GsmApp     *app);
+gboolean         gsm_app_peek_is_on_demand              (GsmApp     *app);
+const char      *gsm_app_peek_on_demand_bus_name        (GsmApp     *app);
 
 G_END_DECLS
 
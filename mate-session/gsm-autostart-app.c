@@ -26,14 +26,22 @@
 #include <string.h>
 #include <sys/wait.h>
 #include <errno.h>
+#include <unistd.h>
+#include <sched.h>
+#include <sys/resource.h>
+#ifdef __linux__
+#include <sys/syscall.h>
+#endif
 /* Needed for FreeBSD */
 #include <signal.h>
 
 #include <glib.h>
+#include <glib-unix.h>
 #include <gio/gio.h>
 
 #include "gsm-autostart-app.h"
 #include "gsm-util.h"
+#include "mdm-log.h"
 
 #ifdef __GNUC__
 #define UNUSED_VARIABLE __attribute__ ((unused))
@@ -57,6 +65,21 @@ enum {
 
 #define GSM_SESSION_CLIENT_DBUS_INTERFACE "org.mate.SessionClient"
 
+#define SESSION_SCHEMA                    "org.mate.session"
+#define KEY_SYSTEMD_SCOPES                "systemd-scopes"
+
+/* ioprio_set(2) has no glibc wrapper, see linux/ioprio.h */
+#define GSM_IOPRIO_CLASS_SHIFT            13
+#define GSM_IOPRIO_VALUE(class, data)     (((class) << GSM_IOPRIO_CLASS_SHIFT) | (data))
+#define GSM_IOPRIO_CLASS_NONE             0
+#define GSM_IOPRIO_CLASS_BE               2
+#define GSM_IOPRIO_CLASS_IDLE             3
+#define GSM_IOPRIO_WHO_PROCESS            1
+
+/* Niceness relative to our own used for high and low priority apps */
+#define GSM_PRIORITY_HIGH_NICE            -5
+#define GSM_PRIORITY_LOW_NICE             10
+
 typedef struct {
         char                 *desktop_filename;
         char                 *desktop_id;
@@ -69,6 +92,10 @@ typedef struct {
         gboolean              condition;
         gboolean              autorestart;
         int                   autostart_delay;
+        gboolean              on_demand;
+        char                 *on_demand_bus_name;
+        guint64               cpu_weight;
+        guint64               memory_high;
 
         GFileMonitor         *condition_monitor;
         GSettings            *condition_settings;
@@ -76,6 +103,20 @@ typedef struct {
         int                   launch_type;
         GPid                  pid;
         guint                 child_watch_id;
+        GsmAppPriority        priority;
+        GsmAppPriority        process_priority;
+
+        /* process supervision */
+        int                   pidfd;
+        guint                 pidfd_watch_id;
+        gint64                start_time;
+        /* of the last process that exited, if any */
+        gboolean              has_exited;
+        gint64                run_time;
+        int                   exit_status;
+
+        /* transient systemd scope the process was moved to */
+        char                 *scope_unit;
 
         GDBusConnection      *connection;
         GDBusProxy           *proxy;
@@ -93,6 +134,8 @@ enum {
 
 static guint signals[LAST_SIGNAL] = { 0 };
 
+static void stop_supervising (GsmAutostartApp *app);
+
 G_DEFINE_TYPE_WITH_PRIVATE (GsmAutostartApp, gsm_autostart_app, GSM_TYPE_APP)
 
 static void
@@ -103,6 +146,7 @@ gsm_autostart_app_init (GsmAutostartApp *app)
         priv = gsm_autostart_app_get_instance_private (app);
 
         priv->pid = -1;
+        priv->pidfd = -1;
         priv->condition_monitor = NULL;
         priv->condition = FALSE;
         priv->autostart_delay = -1;
@@ -401,6 +445,56 @@ setup_condition_monitor (GsmAutostartApp *app)
         /* FIXME: cache the disabled value? */
 }
 
+/* Accepts a number of bytes with an optional K, M, G or T suffix,
+ * like systemd does. Returns 0 if the string can't be parsed.
+ */
+static guint64
+parse_memory_size (const char *str)
+{
+        guint64  value;
+        char    *end;
+        guint    shift;
+
+        if (str == NULL) {
+                return 0;
+        }
+
+        value = g_ascii_strtoull (str, &end, 10);
+        if (end == str) {
+                return 0;
+        }
+
+        switch (g_ascii_toupper (*end)) {
+        case '\0':
+                shift = 0;
+                break;
+        case 'K':
+                shift = 10;
+                break;
+        case 'M':
+                shift = 20;
+                break;
+        case 'G':
+                shift = 30;
+                break;
+        case 'T':
+                shift = 40;
+                break;
+        default:
+                return 0;
+        }
+
+        if (shift > 0 && *(end + 1) != '\0') {
+                return 0;
+        }
+
+        if (value > (G_MAXUINT64 >> shift)) {
+                return 0;
+        }
+
+        return value << shift;
+}
+
 static gboolean
 load_desktop_file (GsmAutostartApp *app)
 {
@@ -493,6 +587,58 @@ load_desktop_file (GsmAutostartApp *app)
                                    gsm_app_peek_id (GSM_APP (app)));
                         priv->autostart_delay = -1;
                 }
+
+                priv->on_demand = egg_desktop_file_get_boolean (priv->desktop_file,
+                                                                GSM_AUTOSTART_APP_ON_DEMAND_KEY,
+                                                                NULL);
+                g_free (priv->on_demand_bus_name);
+                priv->on_demand_bus_name = NULL;
+                if (priv->on_demand) {
+                        priv->on_demand_bus_name = egg_desktop_file_get_string (priv->desktop_file,
+                                                                                GSM_AUTOSTART_APP_ON_DEMAND_BUS_NAME_KEY,
+                                                                                NULL);
+                        if (priv->on_demand_bus_name != NULL
+                            && !g_dbus_is_name (priv->on_demand_bus_name)) {
+                                g_warning ("Invalid bus name '%s' for %s", priv->on_demand_bus_name,
+                                           gsm_app_peek_id (GSM_APP (app)));
+                                g_free (priv->on_demand_bus_name);
+                                priv->on_demand_bus_name = NULL;
+                        }
+                }
+        }
+
+        priv->cpu_weight = 0;
+        if (egg_desktop_file_has_key (priv->desktop_file,
+                                      GSM_AUTOSTART_APP_CPU_WEIGHT_KEY,
+                                      NULL)) {
+                int weight;
+
+                weight = egg_desktop_file_get_integer (priv->desktop_file,
+                                                       GSM_AUTOSTART_APP_CPU_WEIGHT_KEY,
+                                                       NULL);
+                if (weight < 1 || weight > 10000) {
+                        g_warning ("Invalid CPU weight of %d for %s", weight,
+                                   gsm_app_peek_id (GSM_APP (app)));
+                } else {
+                        priv->cpu_weight = weight;
+                }
+        }
+
+        priv->memory_high = 0;
+        if (egg_desktop_file_has_key (priv->desktop_file,
+                                      GSM_AUTOSTART_APP_MEMORY_HIGH_KEY,
+                                      NULL)) {
+                char *memory_high;
+
+                memory_high = egg_desktop_file_get_string (priv->desktop_file,
+                                                           GSM_AUTOSTART_APP_MEMORY_HIGH_KEY,
+                                                           NULL);
+                priv->memory_high = parse_memory_size (memory_high);
+                if (priv->memory_high == 0) {
+                        g_warning ("Invalid memory limit '%s' for %s", memory_high,
+                                   gsm_app_peek_id (GSM_APP (app)));
+                }
+                g_free (memory_high);
         }
 
         g_object_set (app,
@@ -616,10 +762,13 @@ gsm_autostart_app_dispose (GObject *object)
                 priv->desktop_id = NULL;
         }
 
-        if (priv->child_watch_id > 0) {
-                g_source_remove (priv->child_watch_id);
-                priv->child_watch_id = 0;
-        }
+        g_free (priv->scope_unit);
+        priv->scope_unit = NULL;
+
+        g_free (priv->on_demand_bus_name);
+        priv->on_demand_bus_name = NULL;
+
+        stop_supervising (GSM_AUTOSTART_APP (object));
 
         if (priv->proxy != NULL) {
                 g_object_unref (priv->proxy);
@@ -716,6 +865,69 @@ is_conditionally_disabled (GsmApp *app)
         return disabled;
 }
 
+/* pidfds give us a handle on the process itself rather than on a pid
+ * number that may be recycled, see pidfd_open(2).
+ */
+static int
+_pidfd_open (GPid pid)
+{
+#ifdef __NR_pidfd_open
+        return syscall (__NR_pidfd_open, pid, 0);
+#else
+        errno = ENOSYS;
+        return -1;
+#endif
+}
+
+static int
+_pidfd_send_signal (int pidfd,
+                    int signal)
+{
+#ifdef __NR_pidfd_send_signal
+        return syscall (__NR_pidfd_send_signal, pidfd, signal, NULL, 0);
+#else
+        errno = ENOSYS;
+        return -1;
+#endif
+}
+
+static void
+reap_orphan (GPid     pid,
+             int      status,
+             gpointer data)
+{
+        g_debug ("GsmAutostartApp: reaped orphaned process %d", (int) pid);
+        g_spawn_close_pid (pid);
+}
+
+static void
+stop_supervising (GsmAutostartApp *app)
+{
+        GsmAutostartAppPrivate *priv;
+
+        priv = gsm_autostart_app_get_instance_private (app);
+
+        /* If a watch is still around we are replacing a process that is
+         * still running; make sure it does not stay around as a zombie.
+         */
+        if (priv->pidfd_watch_id > 0) {
+                g_source_remove (priv->pidfd_watch_id);
+                priv->pidfd_watch_id = 0;
+                g_child_watch_add (priv->pid, reap_orphan, NULL);
+        }
+
+        if (priv->child_watch_id > 0) {
+                g_source_remove (priv->child_watch_id);
+                priv->child_watch_id = 0;
+                g_child_watch_add (priv->pid, reap_orphan, NULL);
+        }
+
+        if (priv->pidfd >= 0) {
+                close (priv->pidfd);
+                priv->pidfd = -1;
+        }
+}
+
 static void
 app_exited (GPid             pid,
             int              status,
@@ -724,26 +936,113 @@ app_exited (GPid             pid,
         GsmAutostartAppPrivate *priv;
 
         priv = gsm_autostart_app_get_instance_private (app);
-        g_debug ("GsmAutostartApp: (pid:%d) done (%s:%d)",
-                 (int) pid,
-                 WIFEXITED (status) ? "status"
-                 : WIFSIGNALED (status) ? "signal"
-                 : "unknown",
-                 WIFEXITED (status) ? WEXITSTATUS (status)
-                 : WIFSIGNALED (status) ? WTERMSIG (status)
-                 : -1);
+
+        priv->has_exited = TRUE;
+        priv->run_time = g_get_monotonic_time () - priv->start_time;
+        priv->exit_status = status;
+
+        if (status == GSM_APP_EXIT_STATUS_UNKNOWN) {
+                g_debug ("GsmAutostartApp: %s (pid:%d) done after %.3f seconds (unknown)",
+                         priv->desktop_id,
+                         (int) pid,
+                         (double) priv->run_time / G_USEC_PER_SEC);
+        } else {
+                g_debug ("GsmAutostartApp: %s (pid:%d) done after %.3f seconds (%s:%d)",
+                         priv->desktop_id,
+                         (int) pid,
+                         (double) priv->run_time / G_USEC_PER_SEC,
+                         WIFEXITED (status) ? "status"
+                         : WIFSIGNALED (status) ? "signal"
+                         : "unknown",
+                         WIFEXITED (status) ? WEXITSTATUS (status)
+                         : WIFSIGNALED (status) ? WTERMSIG (status)
+                         : -1);
+        }
+
+        /* the watch that called us is destroyed when we return */
+        priv->child_watch_id = 0;
+        stop_supervising (app);
 
         g_spawn_close_pid (priv->pid);
         priv->pid = -1;
-        priv->child_watch_id = 0;
 
-        if (WIFEXITED (status)) {
+        /* systemd garbage collects the scope once it is empty */
+        g_free (priv->scope_unit);
+        priv->scope_unit = NULL;
+
+        /* without a status, a clean exit can't be assumed */
+        if (status == GSM_APP_EXIT_STATUS_UNKNOWN) {
+                gsm_app_died (GSM_APP (app));
+        } else if (WIFEXITED (status)) {
                 gsm_app_exited (GSM_APP (app));
         } else if (WIFSIGNALED (status)) {
                 gsm_app_died (GSM_APP (app));
         }
 }
 
+static gboolean
+pidfd_watch_cb (int              fd,
+                GIOCondition     condition,
+                GsmAutostartApp *app)
+{
+        GsmAutostartAppPrivate *priv;
+        pid_t                   res;
+        int                     status;
+
+        priv = gsm_autostart_app_get_instance_private (app);
+
+        do {
+                res = waitpid (priv->pid, &status, WNOHANG);
+        } while (res < 0 && errno == EINTR);
+
+        if (res == 0) {
+                /* not exited yet */
+                return G_SOURCE_CONTINUE;
+        }
+
+        if (res < 0) {
+                /* someone else reaped it, so we can't know how it ended */
+                g_warning ("Unable to get exit status of child process %d: %s",
+                           (int) priv->pid,
+                           g_strerror (errno));
+                status = GSM_APP_EXIT_STATUS_UNKNOWN;
+        }
+
+        /* the source is destroyed when we return */
+        priv->pidfd_watch_id = 0;
+
+        app_exited (priv->pid, status, app);
+
+        return G_SOURCE_REMOVE;
+}
+
+static void
+supervise_child (GsmAutostartApp *app)
+{
+        GsmAutostartAppPrivate *priv;
+
+        priv = gsm_autostart_app_get_instance_private (app);
+
+        priv->start_time = g_get_monotonic_time ();
+
+        /* The child can't have been reaped yet, since we asked for
+         * G_SPAWN_DO_NOT_REAP_CHILD, so the pidfd always refers to it.
+         */
+        priv->pidfd = _pidfd_open (priv->pid);
+        if (priv->pidfd >= 0) {
+                priv->pidfd_watch_id = g_unix_fd_add (priv->pidfd,
+                                                      G_IO_IN,
+                                                      (GUnixFDSourceFunc)pidfd_watch_cb,
+                                                      app);
+        } else {
+                g_debug ("GsmAutostartApp: pidfd_open failed (%s), using a child watch",
+                         g_strerror (errno));
+                priv->child_watch_id = g_child_watch_add (priv->pid,
+                                                          (GChildWatchFunc)app_exited,
+                                                          app);
+        }
+}
+
 static int
 _signal_pid (int pid,
              int signal)
@@ -771,6 +1070,40 @@ _signal_pid (int pid,
         return status;
 }
 
+static int
+_signal_app (GsmAutostartApp *app,
+             int              signal)
+{
+        GsmAutostartAppPrivate *priv;
+        int                     status;
+
+        priv = gsm_autostart_app_get_instance_private (app);
+
+        if (priv->pidfd < 0) {
+                return _signal_pid (priv->pid, signal);
+        }
+
+        g_debug ("GsmAutostartApp: sending signal %d to process %d through its pidfd",
+                 signal, (int) priv->pid);
+
+        errno = 0;
+        status = _pidfd_send_signal (priv->pidfd, signal);
+        if (status < 0) {
+                if (errno == ENOSYS) {
+                        return _signal_pid (priv->pid, signal);
+                } else if (errno == ESRCH) {
+                        g_warning ("Child process %d was already dead.",
+                                   (int) priv->pid);
+                } else {
+                        g_warning ("Couldn't kill child process %d: %s",
+                                   (int) priv->pid,
+                                   g_strerror (errno));
+                }
+        }
+
+        return status;
+}
+
 static gboolean
 autostart_app_stop_spawn (GsmAutostartApp *app,
                           GError         **error)
@@ -788,7 +1121,7 @@ autostart_app_stop_spawn (GsmAutostartApp *app,
                 return FALSE;
         }
 
-        res = _signal_pid (priv->pid, SIGTERM);
+        res = _signal_app (app, SIGTERM);
         if (res != 0) {
                 g_set_error (error,
                              GSM_APP_ERROR,
@@ -836,6 +1169,286 @@ gsm_autostart_app_stop (GsmApp  *app,
         return ret;
 }
 
+static gboolean
+gsm_autostart_app_kill (GsmApp  *app,
+                        GError **error)
+{
+        GsmAutostartAppPrivate *priv;
+
+        priv = gsm_autostart_app_get_instance_private (GSM_AUTOSTART_APP (app));
+
+        /* we can only kill what we spawned ourselves */
+        if (priv->launch_type != AUTOSTART_LAUNCH_SPAWN || priv->pid < 1) {
+                g_set_error (error,
+                             GSM_APP_ERROR,
+                             GSM_APP_ERROR_STOP,
+                             "Not running");
+                return FALSE;
+        }
+
+        if (_signal_app (GSM_AUTOSTART_APP (app), SIGKILL) != 0) {
+                g_set_error (error,
+                             GSM_APP_ERROR,
+                             GSM_APP_ERROR_STOP,
+                             "Unable to kill: %s",
+                             g_strerror (errno));
+                return FALSE;
+        }
+
+        return TRUE;
+}
+
+#ifdef HAVE_SYSTEMD
+static gboolean
+use_systemd_scope (void)
+{
+        GSettings *settings;
+        gboolean   ret;
+
+        settings = g_settings_new (SESSION_SCHEMA);
+        ret = g_settings_get_boolean (settings, KEY_SYSTEMD_SCOPES);
+        g_object_unref (settings);
+
+        return ret;
+}
+
+static void
+on_start_scope_finished (GDBusConnection *connection,
+                         GAsyncResult    *result,
+                         GsmAutostartApp *app)
+{
+        GsmAutostartAppPrivate *priv;
+        GVariant               *reply;
+        GError                 *error;
+
+        priv = gsm_autostart_app_get_instance_private (app);
+
+        error = NULL;
+        reply = g_dbus_connection_call_finish (connection, result, &error);
+        if (reply == NULL) {
+                g_debug ("GsmAutostartApp: unable to start scope for %s: %s",
+                         priv->desktop_id, error->message);
+                g_error_free (error);
+
+                g_free (priv->scope_unit);
+                priv->scope_unit = NULL;
+        } else {
+                g_variant_unref (reply);
+        }
+
+        g_object_unref (app);
+}
+
+/* Moves the process we just spawned into a transient scope of the
+ * systemd user manager, so its resource usage can be accounted and
+ * limited separately from the rest of the session.
+ */
+static void
+start_systemd_scope (GsmAutostartApp *app)
+{
+        GsmAutostartAppPrivate *priv;
+        GDBusConnection        *connection;
+        GVariantBuilder         properties;
+        GError                 *error;
+        char                   *name;
+        char                   *p;
+        guint32                 pid;
+
+        priv = gsm_autostart_app_get_instance_private (app);
+
+        error = NULL;
+        connection = g_bus_get_sync (G_BUS_TYPE_SESSION, NULL, &error);
+        if (connection == NULL) {
+                g_warning ("error getting session bus: %s", error->message);
+                g_error_free (error);
+                return;
+        }
+
+        /* unit names only allow a limited set of characters */
+        name = g_strdup (priv->desktop_id);
+        if (g_str_has_suffix (name, ".desktop")) {
+                name[strlen (name) - strlen (".desktop")] = '\0';
+        }
+        for (p = name; *p != '\0'; p++) {
+                if (!g_ascii_isalnum (*p) && strchr (":_.", *p) == NULL) {
+                        *p = '_';
+                }
+        }
+
+        g_free (priv->scope_unit);
+        priv->scope_unit = g_strdup_printf ("app-mate-%s-%d.scope", name, (int) priv->pid);
+        g_free (name);
+
+        pid = priv->pid;
+
+        g_variant_builder_init (&properties, G_VARIANT_TYPE ("a(sv)"));
+        g_variant_builder_add (&properties, "(sv)", "Description",
+                               g_variant_new_string (priv->desktop_id));
+        g_variant_builder_add (&properties, "(sv)", "PIDs",
+                               g_variant_new_fixed_array (G_VARIANT_TYPE_UINT32,
+                                                          &pid, 1, sizeof (guint32)));
+        g_variant_builder_add (&properties, "(sv)", "CollectMode",
+                               g_variant_new_string ("inactive-or-failed"));
+        g_variant_builder_add (&properties, "(sv)", "CPUAccounting",
+                               g_variant_new_boolean (TRUE));
+        g_variant_builder_add (&properties, "(sv)", "MemoryAccounting",
+                               g_variant_new_boolean (TRUE));
+        if (priv->cpu_weight > 0) {
+                g_variant_builder_add (&properties, "(sv)", "CPUWeight",
+                                       g_variant_new_uint64 (priv->cpu_weight));
+        }
+        if (priv->memory_high > 0) {
+                g_variant_builder_add (&properties, "(sv)", "MemoryHigh",
+                                       g_variant_new_uint64 (priv->memory_high));
+        }
+
+        g_debug ("GsmAutostartApp: moving pid %d to %s", (int) priv->pid, priv->scope_unit);
+
+        g_dbus_connection_call (connection,
+                                "org.freedesktop.systemd1",
+                                "/org/freedesktop/systemd1",
+                                "org.freedesktop.systemd1.Manager",
+                                "StartTransientUnit",
+                                g_variant_new ("(ssa(sv)@a(sa(sv)))",
+                                               priv->scope_unit,
+                                               "fail",
+                                               &properties,
+                                               g_variant_new_array (G_VARIANT_TYPE ("(sa(sv))"), NULL, 0)),
+                                G_VARIANT_TYPE ("(o)"),
+                                G_DBUS_CALL_FLAGS_NONE,
+                                -1,
+                                NULL,
+                                (GAsyncReadyCallback) on_start_scope_finished,
+                                g_object_ref (app));
+
+        g_object_unref (connection);
+}
+#endif /* HAVE_SYSTEMD */
+
+static int
+_ioprio_set (int pid,
+             int ioprio)
+{
+#ifdef __NR_ioprio_set
+        return syscall (__NR_ioprio_set, GSM_IOPRIO_WHO_PROCESS, pid, ioprio);
+#else
+        errno = ENOSYS;
+        return -1;
+#endif
+}
+
+/* An unprivileged process can only lower its niceness back again if
+ * RLIMIT_NICE allows it, see setrlimit(2).
+ */
+static gboolean
+can_restore_nice (int nice)
+{
+        struct rlimit rlim;
+
+        if (getrlimit (RLIMIT_NICE, &rlim) != 0) {
+                return FALSE;
+        }
+
+        return rlim.rlim_cur == RLIM_INFINITY || (rlim_t) (20 - nice) <= rlim.rlim_cur;
+}
+
+/* Applies the priority to a single thread; 0 means the calling one.
+ * This is also called from the child between fork and exec, so it
+ * must only make plain system calls.
+ */
+static void
+apply_priority (pid_t          tid,
+                GsmAppPriority priority,
+                int            base_nice)
+{
+        struct sched_param param = { 0 };
+
+        switch (priority) {
+        case GSM_APP_PRIORITY_HIGH:
+                _ioprio_set (tid, GSM_IOPRIO_VALUE (GSM_IOPRIO_CLASS_BE, 0));
+                /* only works with CAP_SYS_NICE or a generous RLIMIT_NICE */
+                setpriority (PRIO_PROCESS, tid, base_nice + GSM_PRIORITY_HIGH_NICE);
+                break;
+        case GSM_APP_PRIORITY_LOW:
+                _ioprio_set (tid, GSM_IOPRIO_VALUE (GSM_IOPRIO_CLASS_IDLE, 0));
+                /* don't renice if we could not undo it later; SCHED_BATCH
+                 * can always be switched back to SCHED_OTHER */
+                if (can_restore_nice (base_nice)) {
+                        setpriority (PRIO_PROCESS, tid, base_nice + GSM_PRIORITY_LOW_NICE);
+                } else {
+                        sched_setscheduler (tid, SCHED_BATCH, &param);
+                }
+                break;
+        case GSM_APP_PRIORITY_NORMAL:
+                _ioprio_set (tid, GSM_IOPRIO_VALUE (GSM_IOPRIO_CLASS_NONE, 0));
+                sched_setscheduler (tid, SCHED_OTHER, &param);
+                setpriority (PRIO_PROCESS, tid, base_nice);
+                break;
+        default:
+                break;
+        }
+}
+
+static void
+child_setup_priority (gpointer user_data)
+{
+        GsmAppPriority priority = GPOINTER_TO_INT (user_data);
+
+        /* the child still has our niceness at this point */
+        apply_priority (0, priority, getpriority (PRIO_PROCESS, 0));
+}
+
+/* Scheduling and I/O priorities are per thread on Linux, so the
+ * threads the app has created since it was started need to be
+ * changed one by one.
+ */
+static void
+set_process_priority (GsmAutostartApp *app,
+                      GsmAppPriority   priority)
+{
+        GsmAutostartAppPrivate *priv;
+        GDir                   *dir;
+        char                   *path;
+        const char             *name;
+        int                     base_nice;
+
+        priv = gsm_autostart_app_get_instance_private (app);
+
+        base_nice = getpriority (PRIO_PROCESS, 0);
+
+        path = g_strdup_printf ("/proc/%d/task", (int) priv->pid);
+        dir = g_dir_open (path, 0, NULL);
+        g_free (path);
+
+        if (dir == NULL) {
+                apply_priority (priv->pid, priority, base_nice);
+        } else {
+                while ((name = g_dir_read_name (dir)) != NULL) {
+                        apply_priority ((pid_t) g_ascii_strtoll (name, NULL, 10), priority, base_nice);
+                }
+                g_dir_close (dir);
+        }
+
+        priv->process_priority = priority;
+}
+
+static void
+gsm_autostart_app_set_priority (GsmApp        *app,
+                                GsmAppPriority priority)
+{
+        GsmAutostartAppPrivate *priv;
+
+        priv = gsm_autostart_app_get_instance_private (GSM_AUTOSTART_APP (app));
+
+        priv->priority = priority;
+
+        if (priv->pid > 0 && priv->process_priority != priority) {
+                g_debug ("GsmAutostartApp: changing priority of %s (pid:%d) to %d",
+                         priv->desktop_id, (int) priv->pid, priority);
+                set_process_priority (GSM_AUTOSTART_APP (app), priority);
+        }
+}
+
 static gboolean
 autostart_app_start_spawn (GsmAutostartApp *app,
                            GError         **error)
@@ -864,16 +1477,23 @@ autostart_app_start_spawn (GsmAutostartApp *app,
                 g_error_free (local_error);
         }
 
-        g_debug ("GsmAutostartApp: starting %s: command=%s startup-id=%s", priv->desktop_id, command, startup_id);
+        mdm_log_field (G_LOG_LEVEL_DEBUG,
+                       "MATE_SESSION_STARTUP_ID", startup_id,
+                       "GsmAutostartApp: starting %s: command=%s startup-id=%s", priv->desktop_id, command, startup_id);
         g_free (command);
 
+        /* we only keep track of the most recently started process */
+        stop_supervising (app);
+
         g_free (priv->startup_id);
+        priv->startup_id = NULL;
         local_error = NULL;
         success = egg_desktop_file_launch (priv->desktop_file,
                                            NULL,
                                            &local_error,
                                            EGG_DESKTOP_FILE_LAUNCH_PUTENV, env,
                                            EGG_DESKTOP_FILE_LAUNCH_FLAGS, G_SPAWN_DO_NOT_REAP_CHILD,
+                                           EGG_DESKTOP_FILE_LAUNCH_SETUP_FUNC, child_setup_priority, GINT_TO_POINTER (priv->priority),
                                            EGG_DESKTOP_FILE_LAUNCH_RETURN_PID, &priv->pid,
                                            EGG_DESKTOP_FILE_LAUNCH_RETURN_STARTUP_ID, &priv->startup_id,
                                            NULL);
@@ -881,9 +1501,13 @@ autostart_app_start_spawn (GsmAutostartApp *app,
 
         if (success) {
                 g_debug ("GsmAutostartApp: started pid:%d", priv->pid);
-                priv->child_watch_id = g_child_watch_add (priv->pid,
-                                                          (GChildWatchFunc)app_exited,
-                                                          app);
+                priv->process_priority = priv->priority;
+                supervise_child (app);
+#ifdef HAVE_SYSTEMD
+                if (use_systemd_scope ()) {
+                        start_systemd_scope (app);
+                }
+#endif
         } else {
                 g_set_error (error,
                              GSM_APP_ERROR,
@@ -1166,6 +1790,55 @@ gsm_autostart_app_peek_autostart_delay (GsmApp *app)
         return priv->autostart_delay;
 }
 
+static gboolean
+gsm_autostart_app_peek_is_on_demand (GsmApp *app)
+{
+        GsmAutostartAppPrivate *priv;
+
+        priv = gsm_autostart_app_get_instance_private (GSM_AUTOSTART_APP (app));
+
+        return priv->on_demand;
+}
+
+static const char *
+gsm_autostart_app_peek_on_demand_bus_name (GsmApp *app)
+{
+        GsmAutostartAppPrivate *priv;
+
+        priv = gsm_autostart_app_get_instance_private (GSM_AUTOSTART_APP (app));
+
+        return priv->on_demand_bus_name;
+}
+
+static const char *
+gsm_autostart_app_get_scope_unit (GsmApp *app)
+{
+        GsmAutostartAppPrivate *priv;
+
+        priv = gsm_autostart_app_get_instance_private (GSM_AUTOSTART_APP (app));
+
+        return priv->scope_unit;
+}
+
+static gboolean
+gsm_autostart_app_get_last_exit (GsmApp *app,
+                                 int    *status,
+                                 gint64 *run_time)
+{
+        GsmAutostartAppPrivate *priv;
+
+        priv = gsm_autostart_app_get_instance_private (GSM_AUTOSTART_APP (app));
+
+        if (!priv->has_exited) {
+                return FALSE;
+        }
+
+        *status = priv->exit_status;
+        *run_time = priv->run_time;
+
+        return TRUE;
+}
+
 static GObject *
 gsm_autostart_app_constructor (GType                  type,
                                guint                  n_construct_properties,
@@ -1202,11 +1875,17 @@ gsm_autostart_app_class_init (GsmAutostartAppClass *klass)
         app_class->impl_start = gsm_autostart_app_start;
         app_class->impl_restart = gsm_autostart_app_restart;
         app_class->impl_stop = gsm_autostart_app_stop;
+        app_class->impl_kill = gsm_autostart_app_kill;
         app_class->impl_provides = gsm_autostart_app_provides;
         app_class->impl_has_autostart_condition = gsm_autostart_app_has_autostart_condition;
         app_class->impl_get_app_id = gsm_autostart_app_get_app_id;
+        app_class->impl_get_scope_unit = gsm_autostart_app_get_scope_unit;
+        app_class->impl_get_last_exit = gsm_autostart_app_get_last_exit;
+        app_class->impl_set_priority = gsm_autostart_app_set_priority;
         app_class->impl_get_autorestart = gsm_autostart_app_get_autorestart;
         app_class->impl_peek_autostart_delay = gsm_autostart_app_peek_autostart_delay;
+        app_class->impl_peek_is_on_demand = gsm_autostart_app_peek_is_on_demand;
+        app_class->impl_peek_on_demand_bus_name = gsm_autostart_app_peek_on_demand_bus_name;
 
         g_object_class_install_property (object_class,
                                          PROP_DESKTOP_FILENAME,
@@ -1238,3 +1917,29 @@ gsm_autostart_app_new (const char *desktop_file)
 
         return GSM_APP (app);
 }
+
+GPid
+gsm_autostart_app_peek_pid (GsmAutostartApp *app)
+{
+        GsmAutostartAppPrivate *priv;
+
+        g_return_val_if_fail (GSM_IS_AUTOSTART_APP (app), -1);
+
+        priv = gsm_autostart_app_get_instance_private (app);
+
+        return priv->pid;
+}
+
+/* The startup notification id of the last launch, if the desktop file
+ * asked for startup notification. */
+const char *
+gsm_autostart_app_peek_startup_notify_id (GsmAutostartApp *app)
+{
+        GsmAutostartAppPrivate *priv;
+
+        g_return_val_if_fail (GSM_IS_AUTOSTART_APP (app), NULL);
+
+        priv = gsm_autostart_app_get_instance_private (app);
+
+        return priv->startup_id;
+}
@@ -42,6 +42,8 @@ struct _GsmAutostartAppClass
 };
 
 GsmApp *gsm_autostart_app_new                (const char *desktop_file);
+GPid    gsm_autostart_app_peek_pid           (GsmAutostartApp *app);
+const char *gsm_autostart_app_peek_startup_notify_id (GsmAutostartApp *app);
 
 #define GSM_AUTOSTART_APP_PHASE_KEY       "X-MATE-Autostart-Phase"
 #define GSM_AUTOSTART_APP_PROVIDES_KEY    "X-MATE-Provides"
@@ -52,6 +54,10 @@ GsmApp *gsm_autostart_app_new                (const char *desktop_file);
 #define GSM_AUTOSTART_APP_DBUS_ARGS_KEY   "X-MATE-DBus-Start-Arguments"
 #define GSM_AUTOSTART_APP_DISCARD_KEY     "X-MATE-Autostart-discard-exec"
 #define GSM_AUTOSTART_APP_DELAY_KEY       "X-MATE-Autostart-Delay"
+#define GSM_AUTOSTART_APP_CPU_WEIGHT_KEY  "X-MATE-Autostart-CPUWeight"
+#define GSM_AUTOSTART_APP_MEMORY_HIGH_KEY "X-MATE-Autostart-MemoryHigh"
+#define GSM_AUTOSTART_APP_ON_DEMAND_KEY   "X-MATE-Autostart-OnDemand"
+#define GSM_AUTOSTART_APP_ON_DEMAND_BUS_NAME_KEY "X-MATE-Autostart-OnDemand-BusName"
 
 G_END_DECLS
 
@@ -29,6 +29,7 @@
 #include "gsm-marshal.h"
 #include "gsm-client.h"
 #include "gsm-client-glue.h"
+#include "gsm-dbus-stats.h"
 
 static guint32 client_serial = 1;
 
@@ -368,7 +369,7 @@ gsm_client_class_init (GsmClientClass *klass)
                                                             GSM_CLIENT_UNREGISTERED,
                                                             G_PARAM_READWRITE | G_PARAM_CONSTRUCT));
 
-        dbus_g_object_type_install_info (GSM_TYPE_CLIENT, &dbus_glib_gsm_client_object_info);
+        gsm_dbus_stats_install_info (GSM_TYPE_CLIENT, &dbus_glib_gsm_client_object_info);
 }
 
 const char *
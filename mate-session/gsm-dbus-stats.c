@@ -0,0 +1,279 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 8 -*-
+ *
+ * Copyright (C) 2012-2021 MATE Developers
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA.
+ *
+ */
+
+#include "config.h"
+
+#include <string.h>
+
+#include <glib.h>
+#include <glib-object.h>
+#include <dbus/dbus.h>
+#include <dbus/dbus-glib.h>
+
+#include "gsm-dbus-stats.h"
+
+/* Callers that come and go would grow the table without bounds; past
+ * this many entries, new callers are counted as "other" */
+#define GSM_DBUS_STATS_MAX_ENTRIES 1024
+
+static const guint64 bucket_bounds[] = {
+        10, 100, 1000, 10000, 100000, 1000000, G_MAXUINT64
+};
+
+typedef struct {
+        GClosureMarshal  marshaller;
+        const char      *interface;
+        const char      *name;
+        gboolean         async;
+} MethodInfo;
+
+typedef struct {
+        const MethodInfo *method;
+        char             *sender;
+        guint64           counts[G_N_ELEMENTS (bucket_bounds)];
+        guint64           total;
+        guint64           max;
+} CallStats;
+
+/* GCallback -> MethodInfo, never freed */
+static GHashTable *methods = NULL;
+/* "interface.method sender" -> CallStats */
+static GHashTable *stats = NULL;
+
+static gboolean    enabled = FALSE;
+static char        current_sender[256];
+
+static void
+call_stats_free (CallStats *call_stats)
+{
+        g_free (call_stats->sender);
+        g_free (call_stats);
+}
+
+static void
+record_call (const MethodInfo *method,
+             guint64           elapsed)
+{
+        CallStats  *call_stats;
+        const char *sender;
+        char       *key;
+        guint       i;
+
+        sender = current_sender[0] != '\0' ? current_sender : "unknown";
+
+        key = g_strdup_printf ("%s.%s %s", method->interface, method->name, sender);
+        call_stats = g_hash_table_lookup (stats, key);
+
+        if (call_stats == NULL
+            && g_hash_table_size (stats) >= GSM_DBUS_STATS_MAX_ENTRIES) {
+                sender = "other";
+                g_free (key);
+                key = g_strdup_printf ("%s.%s %s", method->interface, method->name, sender);
+                call_stats = g_hash_table_lookup (stats, key);
+        }
+
+        if (call_stats == NULL) {
+                call_stats = g_new0 (CallStats, 1);
+                call_stats->method = method;
+                call_stats->sender = g_strdup (sender);
+                g_hash_table_insert (stats, key, call_stats);
+        } else {
+                g_free (key);
+        }
+
+        for (i = 0; elapsed > bucket_bounds[i]; i++);
+        call_stats->counts[i]++;
+        call_stats->total += elapsed;
+        call_stats->max = MAX (call_stats->max, elapsed);
+}
+
+/* dbus-glib calls the marshaller with the method function as
+ * marshal_data, which is how the wrapper finds the method back.
+ *
+ * An async method returns before it replies, through a
+ * DBusGMethodInvocation that dbus-glib does not let us follow, so only
+ * the time to dispatch it is measured. */
+static void
+instrumented_marshal (GClosure     *closure,
+                      GValue       *return_value,
+                      guint         n_param_values,
+                      const GValue *param_values,
+                      gpointer      invocation_hint,
+                      gpointer      marshal_data)
+{
+        const MethodInfo *method;
+        gint64            start;
+
+        method = g_hash_table_lookup (methods, marshal_data);
+        g_assert (method != NULL);
+
+        if (!enabled) {
+                method->marshaller (closure, return_value,
+                                    n_param_values, param_values,
+                                    invocation_hint, marshal_data);
+                return;
+        }
+
+        start = g_get_monotonic_time ();
+
+        method->marshaller (closure, return_value,
+                            n_param_values, param_values,
+                            invocation_hint, marshal_data);
+
+        record_call (method, g_get_monotonic_time () - start);
+}
+
+void
+gsm_dbus_stats_install_info (GType                  object_type,
+                             const DBusGObjectInfo *info)
+{
+        DBusGObjectInfo *instrumented;
+        DBusGMethodInfo *method_infos;
+        int              i;
+
+        if (methods == NULL) {
+                methods = g_hash_table_new (NULL, NULL);
+        }
+
+        method_infos = g_new (DBusGMethodInfo, info->n_method_infos);
+
+        for (i = 0; i < info->n_method_infos; i++) {
+                MethodInfo *method;
+
+                method = g_new0 (MethodInfo, 1);
+                method->marshaller = info->method_infos[i].marshaller;
+                /* the method data starts with the interface and method
+                 * names, then "A" for async methods or "S" */
+                method->interface = info->data + info->method_infos[i].data_offset;
+                method->name = method->interface + strlen (method->interface) + 1;
+                method->async = *(method->name + strlen (method->name) + 1) == 'A';
+                g_hash_table_insert (methods, info->method_infos[i].function, method);
+
+                method_infos[i] = info->method_infos[i];
+                method_infos[i].marshaller = instrumented_marshal;
+        }
+
+        instrumented = g_new (DBusGObjectInfo, 1);
+        *instrumented = *info;
+        instrumented->method_infos = method_infos;
+
+        dbus_g_object_type_install_info (object_type, instrumented);
+}
+
+/* Turning the statistics on starts them over */
+void
+gsm_dbus_stats_set_enabled (gboolean new_enabled)
+{
+        if (enabled == new_enabled) {
+                return;
+        }
+
+        g_debug ("GsmDBusStats: %s call statistics", new_enabled ? "enabling" : "disabling");
+
+        enabled = new_enabled;
+
+        if (enabled) {
+                if (stats == NULL) {
+                        stats = g_hash_table_new_full (g_str_hash,
+                                                       g_str_equal,
+                                                       g_free,
+                                                       (GDestroyNotify) call_stats_free);
+                } else {
+                        g_hash_table_remove_all (stats);
+                }
+        }
+}
+
+/* Called for every incoming message before dbus-glib dispatches it, so
+ * that the handler knows who the caller is */
+void
+gsm_dbus_stats_message_received (DBusMessage *message)
+{
+        const char *sender;
+
+        if (!enabled || dbus_message_get_type (message) != DBUS_MESSAGE_TYPE_METHOD_CALL) {
+                return;
+        }
+
+        sender = dbus_message_get_sender (message);
+        g_strlcpy (current_sender, sender != NULL ? sender : "", sizeof (current_sender));
+}
+
+static void
+append_call_stats (const char      *key,
+                   CallStats       *call_stats,
+                   DBusMessageIter *array)
+{
+        DBusMessageIter  entry;
+        DBusMessageIter  counts;
+        const guint64   *values;
+        dbus_bool_t      async;
+        dbus_uint64_t    total;
+        dbus_uint64_t    max;
+
+        values = call_stats->counts;
+        async = call_stats->method->async;
+        total = call_stats->total;
+        max = call_stats->max;
+
+        dbus_message_iter_open_container (array, DBUS_TYPE_STRUCT, NULL, &entry);
+        dbus_message_iter_append_basic (&entry, DBUS_TYPE_STRING, &call_stats->method->interface);
+        dbus_message_iter_append_basic (&entry, DBUS_TYPE_STRING, &call_stats->method->name);
+        dbus_message_iter_append_basic (&entry, DBUS_TYPE_STRING, &call_stats->sender);
+        dbus_message_iter_append_basic (&entry, DBUS_TYPE_BOOLEAN, &async);
+        dbus_message_iter_open_container (&entry, DBUS_TYPE_ARRAY, DBUS_TYPE_UINT64_AS_STRING, &counts);
+        dbus_message_iter_append_fixed_array (&counts, DBUS_TYPE_UINT64, &values,
+                                              G_N_ELEMENTS (bucket_bounds));
+        dbus_message_iter_close_container (&entry, &counts);
+        dbus_message_iter_append_basic (&entry, DBUS_TYPE_UINT64, &total);
+        dbus_message_iter_append_basic (&entry, DBUS_TYPE_UINT64, &max);
+        dbus_message_iter_close_container (array, &entry);
+}
+
+DBusMessage *
+gsm_dbus_stats_get_stats_reply (DBusMessage *message)
+{
+        DBusMessage     *reply;
+        DBusMessageIter  iter;
+        DBusMessageIter  array;
+        const guint64   *bounds;
+
+        reply = dbus_message_new_method_return (message);
+        if (reply == NULL) {
+                return NULL;
+        }
+
+        bounds = bucket_bounds;
+
+        dbus_message_iter_init_append (reply, &iter);
+
+        dbus_message_iter_open_container (&iter, DBUS_TYPE_ARRAY, DBUS_TYPE_UINT64_AS_STRING, &array);
+        dbus_message_iter_append_fixed_array (&array, DBUS_TYPE_UINT64, &bounds,
+                                              G_N_ELEMENTS (bucket_bounds));
+        dbus_message_iter_close_container (&iter, &array);
+
+        dbus_message_iter_open_container (&iter, DBUS_TYPE_ARRAY, "(sssbatt)", &array);
+        if (stats != NULL) {
+                g_hash_table_foreach (stats, (GHFunc) append_call_stats, &array);
+        }
+        dbus_message_iter_close_container (&iter, &array);
+
+        return reply;
+}
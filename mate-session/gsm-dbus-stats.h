@@ -0,0 +1,56 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 8 -*-
+ *
+ * Copyright (C) 2012-2021 MATE Developers
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA.
+ *
+ */
+
+#ifndef __GSM_DBUS_STATS_H
+#define __GSM_DBUS_STATS_H
+
+#include <glib-object.h>
+#include <dbus/dbus.h>
+#include <dbus/dbus-glib.h>
+
+G_BEGIN_DECLS
+
+/* Call counts and latency histograms of the methods exported with
+ * dbus-glib, per method and caller bus name.  The method table of each
+ * exported type is installed through gsm_dbus_stats_install_info(),
+ * which wraps the marshallers; the timing is off until
+ * gsm_dbus_stats_set_enabled() turns it on, and only costs a flag check
+ * then.
+ *
+ * GetCallStats() of the org.mate.SessionManager.CallStats interface on
+ * /org/gnome/SessionManager returns the histogram bucket upper bounds
+ * and, for each (interface, method, sender), whether the method is
+ * async, the bucket counts, the total and the maximum time spent in the
+ * method, all in microseconds.  For async methods that is the time to
+ * dispatch the call, not the time until it was replied to.
+ */
+#define GSM_DBUS_STATS_DBUS_INTERFACE "org.mate.SessionManager.CallStats"
+
+void         gsm_dbus_stats_install_info      (GType                   object_type,
+                                               const DBusGObjectInfo  *info);
+
+void         gsm_dbus_stats_set_enabled       (gboolean                enabled);
+void         gsm_dbus_stats_message_received  (DBusMessage            *message);
+
+DBusMessage *gsm_dbus_stats_get_stats_reply   (DBusMessage            *message);
+
+G_END_DECLS
+
+#endif /* __GSM_DBUS_STATS_H */
@@ -68,6 +68,7 @@ struct _GsmInhibitDialog
         gboolean           have_xrender;
         int                xrender_event_base;
         int                xrender_error_base;
+        GHashTable        *resolving;
 };
 
 enum {
@@ -82,6 +83,8 @@ enum {
         INHIBIT_NAME_COLUMN,
         INHIBIT_REASON_COLUMN,
         INHIBIT_ID_COLUMN,
+        INHIBIT_APP_ID_COLUMN,
+        INHIBIT_HAS_SNAPSHOT_COLUMN,
         NUMBER_OF_COLUMNS
 };
 
@@ -451,100 +454,148 @@ get_pixbuf_for_window (GdkDisplay *gdkdisplay,
         return pixbuf;
 }
 
+/* Name and icon of an app id, as found in its desktop file.  Both are
+ * NULL when nothing was found.  The cache lives as long as the process
+ * so that the next logout attempt doesn't look them up again. */
+typedef struct {
+        char      *name;
+        GdkPixbuf *icon;
+} AppInfo;
+
+typedef struct {
+        GWeakRef   dialog;
+        char      *app_id;
+        char     **search_dirs;
+        char      *name;
+        char      *icon_spec;
+} ResolveData;
+
+typedef struct {
+        GWeakRef   dialog;
+        char      *inhibitor_id;
+        guint      xid;
+} SnapshotData;
+
+static GHashTable *app_info_cache = NULL;
+static GdkPixbuf  *default_icon = NULL;
+
 static void
-add_inhibitor (GsmInhibitDialog *dialog,
-               GsmInhibitor     *inhibitor)
+app_info_free (AppInfo *info)
 {
-        GdkDisplay     *gdkdisplay;
-        const char     *name;
-        const char     *icon_name;
-        const char     *app_id;
-        char           *desktop_filename;
-        GdkPixbuf      *pixbuf;
-        EggDesktopFile *desktop_file;
-        GError         *error;
-        char          **search_dirs;
-        guint           xid;
-        char           *freeme;
-
-        gdkdisplay = gtk_widget_get_display (GTK_WIDGET (dialog));
+        g_free (info->name);
+        if (info->icon != NULL) {
+                g_object_unref (info->icon);
+        }
+        g_free (info);
+}
 
-        /* FIXME: get info from xid */
+static void
+on_icon_theme_changed (GtkIconTheme *icon_theme,
+                       gpointer      data)
+{
+        g_debug ("GsmInhibitDialog: icon theme changed, dropping cached app info");
 
-        desktop_file = NULL;
-        name = NULL;
-        pixbuf = NULL;
-        freeme = NULL;
+        g_hash_table_remove_all (app_info_cache);
+        g_clear_object (&default_icon);
+}
 
-        app_id = gsm_inhibitor_peek_app_id (inhibitor);
+static AppInfo *
+lookup_app_info (const char *app_id)
+{
+        if (app_info_cache == NULL) {
+                app_info_cache = g_hash_table_new_full (g_str_hash,
+                                                        g_str_equal,
+                                                        g_free,
+                                                        (GDestroyNotify) app_info_free);
+                g_signal_connect (gtk_icon_theme_get_default (),
+                                  "changed",
+                                  G_CALLBACK (on_icon_theme_changed),
+                                  NULL);
+        }
 
         if (IS_STRING_EMPTY (app_id)) {
-                desktop_filename = NULL;
-        } else if (! g_str_has_suffix (app_id, ".desktop")) {
-                desktop_filename = g_strdup_printf ("%s.desktop", app_id);
-        } else {
-                desktop_filename = g_strdup (app_id);
+                return NULL;
         }
 
-        xid = gsm_inhibitor_peek_toplevel_xid (inhibitor);
-        g_debug ("GsmInhibitDialog: inhibitor has XID %u", xid);
-        if (xid > 0 && dialog->have_xrender) {
-                pixbuf = get_pixbuf_for_window (gdkdisplay, xid, DEFAULT_SNAPSHOT_SIZE, DEFAULT_SNAPSHOT_SIZE);
-                if (pixbuf == NULL) {
-                        g_debug ("GsmInhibitDialog: unable to read pixbuf from %u", xid);
-                }
+        return g_hash_table_lookup (app_info_cache, app_id);
+}
+
+static GdkPixbuf *
+get_default_icon (void)
+{
+        if (default_icon == NULL) {
+                default_icon = _load_icon (gtk_icon_theme_get_default (),
+                                           "mate-windows",
+                                           DEFAULT_ICON_SIZE,
+                                           DEFAULT_ICON_SIZE,
+                                           DEFAULT_ICON_SIZE,
+                                           NULL);
         }
 
-        if (desktop_filename != NULL) {
-                search_dirs = gsm_util_get_desktop_dirs ();
+        return default_icon;
+}
 
-                if (g_path_is_absolute (desktop_filename)) {
-                        char *basename;
+static EggDesktopFile *
+find_desktop_file (const char  *app_id,
+                   const char **search_dirs)
+{
+        EggDesktopFile *desktop_file;
+        char           *desktop_filename;
+        GError         *error;
 
-                        error = NULL;
-                        desktop_file = egg_desktop_file_new (desktop_filename,
-                                                             &error);
-                        if (desktop_file == NULL) {
-                                if (error) {
-                                        g_warning ("Unable to load desktop file '%s': %s",
-                                                   desktop_filename, error->message);
-                                        g_error_free (error);
-                                } else {
-                                        g_warning ("Unable to load desktop file '%s'",
-                                                   desktop_filename);
-                                }
-
-                                basename = g_path_get_basename (desktop_filename);
-                                g_free (desktop_filename);
-                                desktop_filename = basename;
-                        }
-                }
+        desktop_file = NULL;
 
-                if (desktop_file == NULL) {
-                        error = NULL;
-                        desktop_file = egg_desktop_file_new_from_dirs (desktop_filename,
-                                                                       (const char **)search_dirs,
-                                                                       &error);
-                }
+        if (! g_str_has_suffix (app_id, ".desktop")) {
+                desktop_filename = g_strdup_printf ("%s.desktop", app_id);
+        } else {
+                desktop_filename = g_strdup (app_id);
+        }
 
-                /* look for a file with a vendor prefix */
+        if (g_path_is_absolute (desktop_filename)) {
+                char *basename;
+
+                error = NULL;
+                desktop_file = egg_desktop_file_new (desktop_filename,
+                                                     &error);
                 if (desktop_file == NULL) {
                         if (error) {
-                                g_warning ("Unable to find desktop file '%s': %s",
+                                g_warning ("Unable to load desktop file '%s': %s",
                                            desktop_filename, error->message);
                                 g_error_free (error);
                         } else {
-                                g_warning ("Unable to find desktop file '%s'",
+                                g_warning ("Unable to load desktop file '%s'",
                                            desktop_filename);
                         }
+
+                        basename = g_path_get_basename (desktop_filename);
                         g_free (desktop_filename);
-                        desktop_filename = g_strdup_printf ("mate-%s.desktop", app_id);
-                        error = NULL;
-                        desktop_file = egg_desktop_file_new_from_dirs (desktop_filename,
-                                                                       (const char **)search_dirs,
-                                                                       &error);
+                        desktop_filename = basename;
+                }
+        }
+
+        error = NULL;
+        if (desktop_file == NULL) {
+                desktop_file = egg_desktop_file_new_from_dirs (desktop_filename,
+                                                               search_dirs,
+                                                               &error);
+        }
+
+        /* look for a file with a vendor prefix */
+        if (desktop_file == NULL) {
+                if (error) {
+                        g_warning ("Unable to find desktop file '%s': %s",
+                                   desktop_filename, error->message);
+                        g_error_free (error);
+                } else {
+                        g_warning ("Unable to find desktop file '%s'",
+                                   desktop_filename);
                 }
-                g_strfreev (search_dirs);
+                g_free (desktop_filename);
+                desktop_filename = g_strdup_printf ("mate-%s.desktop", app_id);
+                error = NULL;
+                desktop_file = egg_desktop_file_new_from_dirs (desktop_filename,
+                                                               search_dirs,
+                                                               &error);
 
                 if (desktop_file == NULL) {
                         if (error) {
@@ -555,19 +606,304 @@ add_inhibitor (GsmInhibitDialog *dialog,
                                 g_warning ("Unable to find desktop file '%s'",
                                            desktop_filename);
                         }
-                } else {
-                        name = egg_desktop_file_get_name (desktop_file);
-                        icon_name = egg_desktop_file_get_icon (desktop_file);
-
-                        if (pixbuf == NULL) {
-                                pixbuf = _load_icon (gtk_icon_theme_get_default (),
-                                                     icon_name,
-                                                     DEFAULT_ICON_SIZE,
-                                                     DEFAULT_ICON_SIZE,
-                                                     DEFAULT_ICON_SIZE,
-                                                     NULL);
+                }
+        }
+
+        g_free (desktop_filename);
+
+        return desktop_file;
+}
+
+/* Turns the Icon key of a desktop file into something that
+ * g_icon_new_for_string() understands, like _find_icon() does. */
+static char *
+get_icon_spec (const char *icon_name)
+{
+        char *basename;
+        char *spec;
+
+        if (IS_STRING_EMPTY (icon_name)) {
+                return NULL;
+        }
+
+        if (g_path_is_absolute (icon_name)) {
+                if (g_file_test (icon_name, G_FILE_TEST_EXISTS)) {
+                        return g_strdup (icon_name);
+                }
+
+                basename = g_path_get_basename (icon_name);
+                spec = _util_icon_remove_extension (basename);
+                g_free (basename);
+
+                return spec;
+        }
+
+        return _util_icon_remove_extension (icon_name);
+}
+
+static void
+resolve_data_free (ResolveData *data)
+{
+        g_weak_ref_clear (&data->dialog);
+        g_free (data->app_id);
+        g_strfreev (data->search_dirs);
+        g_free (data->name);
+        g_free (data->icon_spec);
+        g_free (data);
+}
+
+/* runs in a worker thread: only file system access, no GTK+ */
+static void
+resolve_app_info_thread (GTask        *task,
+                         gpointer      source_object,
+                         ResolveData  *data,
+                         GCancellable *cancellable)
+{
+        EggDesktopFile *desktop_file;
+
+        desktop_file = find_desktop_file (data->app_id,
+                                          (const char **) data->search_dirs);
+        if (desktop_file != NULL) {
+                data->name = g_strdup (egg_desktop_file_get_name (desktop_file));
+                data->icon_spec = get_icon_spec (egg_desktop_file_get_icon (desktop_file));
+                egg_desktop_file_free (desktop_file);
+        }
+
+        g_task_return_boolean (task, TRUE);
+}
+
+static void
+update_rows_for_app (GsmInhibitDialog *dialog,
+                     const char       *app_id,
+                     AppInfo          *info)
+{
+        GtkTreeModel *model;
+        GtkTreeIter   iter;
+
+        if (dialog->list_store == NULL) {
+                return;
+        }
+
+        model = GTK_TREE_MODEL (dialog->list_store);
+        if (!gtk_tree_model_get_iter_first (model, &iter)) {
+                return;
+        }
+
+        do {
+                char     *item_app_id;
+                gboolean  has_snapshot;
+
+                gtk_tree_model_get (model,
+                                    &iter,
+                                    INHIBIT_APP_ID_COLUMN, &item_app_id,
+                                    INHIBIT_HAS_SNAPSHOT_COLUMN, &has_snapshot,
+                                    -1);
+
+                if (g_strcmp0 (item_app_id, app_id) == 0) {
+                        if (info->name != NULL) {
+                                gtk_list_store_set (dialog->list_store, &iter,
+                                                    INHIBIT_NAME_COLUMN, info->name,
+                                                    -1);
+                        }
+                        if (info->icon != NULL && ! has_snapshot) {
+                                gtk_list_store_set (dialog->list_store, &iter,
+                                                    INHIBIT_IMAGE_COLUMN, info->icon,
+                                                    -1);
                         }
                 }
+
+                g_free (item_app_id);
+        } while (gtk_tree_model_iter_next (model, &iter));
+}
+
+static void
+finish_resolve (ResolveData *data,
+                GdkPixbuf   *icon)
+{
+        GsmInhibitDialog *dialog;
+        AppInfo          *info;
+
+        info = g_new0 (AppInfo, 1);
+        info->name = g_steal_pointer (&data->name);
+        info->icon = icon;
+
+        lookup_app_info (NULL);
+        g_hash_table_replace (app_info_cache, g_strdup (data->app_id), info);
+
+        dialog = g_weak_ref_get (&data->dialog);
+        if (dialog != NULL) {
+                g_hash_table_remove (dialog->resolving, data->app_id);
+                update_rows_for_app (dialog, data->app_id, info);
+                g_object_unref (dialog);
+        }
+
+        resolve_data_free (data);
+}
+
+static void
+on_icon_loaded (GtkIconInfo  *icon_info,
+                GAsyncResult *result,
+                ResolveData  *data)
+{
+        GdkPixbuf *icon;
+        GError    *error;
+
+        error = NULL;
+        icon = gtk_icon_info_load_icon_finish (icon_info, result, &error);
+        if (icon == NULL) {
+                g_debug ("GsmInhibitDialog: unable to load icon '%s': %s",
+                         data->icon_spec, error->message);
+                g_error_free (error);
+        }
+
+        finish_resolve (data, icon);
+}
+
+static void
+on_app_info_resolved (GObject      *source_object,
+                      GAsyncResult *result,
+                      gpointer      user_data)
+{
+        ResolveData *data;
+        GIcon       *gicon;
+        GtkIconInfo *icon_info;
+
+        data = user_data;
+
+        icon_info = NULL;
+        if (data->icon_spec != NULL) {
+                gicon = g_icon_new_for_string (data->icon_spec, NULL);
+                if (gicon != NULL) {
+                        icon_info = gtk_icon_theme_lookup_by_gicon (gtk_icon_theme_get_default (),
+                                                                    gicon,
+                                                                    DEFAULT_ICON_SIZE,
+                                                                    GTK_ICON_LOOKUP_FORCE_SIZE);
+                        g_object_unref (gicon);
+                }
+        }
+
+        if (icon_info == NULL) {
+                finish_resolve (data, NULL);
+                return;
+        }
+
+        gtk_icon_info_load_icon_async (icon_info,
+                                       NULL,
+                                       (GAsyncReadyCallback) on_icon_loaded,
+                                       data);
+        g_object_unref (icon_info);
+}
+
+static void
+resolve_app_info (GsmInhibitDialog *dialog,
+                  const char       *app_id)
+{
+        ResolveData *data;
+        GTask       *task;
+
+        if (g_hash_table_contains (dialog->resolving, app_id)) {
+                return;
+        }
+        g_hash_table_add (dialog->resolving, g_strdup (app_id));
+
+        g_debug ("GsmInhibitDialog: looking up desktop file for %s", app_id);
+
+        data = g_new0 (ResolveData, 1);
+        g_weak_ref_init (&data->dialog, dialog);
+        data->app_id = g_strdup (app_id);
+        data->search_dirs = gsm_util_get_desktop_dirs ();
+
+        /* the data outlives the task, it is freed once the icon is loaded */
+        task = g_task_new (NULL, NULL, on_app_info_resolved, data);
+        g_task_set_task_data (task, data, NULL);
+        g_task_run_in_thread (task, (GTaskThreadFunc) resolve_app_info_thread);
+        g_object_unref (task);
+}
+
+static void
+snapshot_data_free (SnapshotData *data)
+{
+        g_weak_ref_clear (&data->dialog);
+        g_free (data->inhibitor_id);
+        g_free (data);
+}
+
+static gboolean
+take_window_snapshot (SnapshotData *data)
+{
+        GsmInhibitDialog *dialog;
+        GdkPixbuf        *pixbuf;
+        GtkTreeIter       iter;
+
+        dialog = g_weak_ref_get (&data->dialog);
+        if (dialog == NULL) {
+                return FALSE;
+        }
+
+        if (dialog->list_store != NULL
+            && find_inhibitor (dialog, data->inhibitor_id, &iter)) {
+                pixbuf = get_pixbuf_for_window (gtk_widget_get_display (GTK_WIDGET (dialog)),
+                                                data->xid,
+                                                DEFAULT_SNAPSHOT_SIZE,
+                                                DEFAULT_SNAPSHOT_SIZE);
+                if (pixbuf == NULL) {
+                        g_debug ("GsmInhibitDialog: unable to read pixbuf from %u", data->xid);
+                } else {
+                        gtk_list_store_set (dialog->list_store, &iter,
+                                            INHIBIT_IMAGE_COLUMN, pixbuf,
+                                            INHIBIT_HAS_SNAPSHOT_COLUMN, TRUE,
+                                            -1);
+                        g_object_unref (pixbuf);
+                }
+        }
+
+        g_object_unref (dialog);
+
+        return FALSE;
+}
+
+static void
+queue_window_snapshot (GsmInhibitDialog *dialog,
+                       GsmInhibitor     *inhibitor,
+                       guint             xid)
+{
+        SnapshotData *data;
+
+        data = g_new0 (SnapshotData, 1);
+        g_weak_ref_init (&data->dialog, dialog);
+        data->inhibitor_id = g_strdup (gsm_inhibitor_peek_id (inhibitor));
+        data->xid = xid;
+
+        g_idle_add_full (G_PRIORITY_DEFAULT_IDLE,
+                         (GSourceFunc) take_window_snapshot,
+                         data,
+                         (GDestroyNotify) snapshot_data_free);
+}
+
+/* Rows are added right away with whatever is known without blocking:
+ * cached app info, or the client name and a generic icon.  The desktop
+ * file lookup and the window snapshot fill them in later. */
+static void
+add_inhibitor (GsmInhibitDialog *dialog,
+               GsmInhibitor     *inhibitor)
+{
+        const char *name;
+        const char *app_id;
+        GdkPixbuf  *pixbuf;
+        AppInfo    *info;
+        guint       xid;
+        char       *freeme;
+
+        name = NULL;
+        pixbuf = NULL;
+        freeme = NULL;
+
+        app_id = gsm_inhibitor_peek_app_id (inhibitor);
+
+        info = lookup_app_info (app_id);
+        if (info != NULL) {
+                name = info->name;
+                pixbuf = info->icon;
         }
 
         /* try client info */
@@ -593,12 +929,7 @@ add_inhibitor (GsmInhibitDialog *dialog,
         }
 
         if (pixbuf == NULL) {
-                pixbuf = _load_icon (gtk_icon_theme_get_default (),
-                                     "mate-windows",
-                                     DEFAULT_ICON_SIZE,
-                                     DEFAULT_ICON_SIZE,
-                                     DEFAULT_ICON_SIZE,
-                                     NULL);
+                pixbuf = get_default_icon ();
         }
 
         gtk_list_store_insert_with_values (dialog->list_store,
@@ -607,15 +938,20 @@ add_inhibitor (GsmInhibitDialog *dialog,
                                            INHIBIT_NAME_COLUMN, name,
                                            INHIBIT_REASON_COLUMN, gsm_inhibitor_peek_reason (inhibitor),
                                            INHIBIT_ID_COLUMN, gsm_inhibitor_peek_id (inhibitor),
+                                           INHIBIT_APP_ID_COLUMN, app_id,
+                                           INHIBIT_HAS_SNAPSHOT_COLUMN, FALSE,
                                            -1);
-
-        g_free (desktop_filename);
         g_free (freeme);
-        if (pixbuf != NULL) {
-                g_object_unref (pixbuf);
+
+        if (info == NULL && ! IS_STRING_EMPTY (app_id)) {
+                resolve_app_info (dialog, app_id);
         }
-        if (desktop_file != NULL) {
-                egg_desktop_file_free (desktop_file);
+
+        /* FIXME: get info from xid */
+        xid = gsm_inhibitor_peek_toplevel_xid (inhibitor);
+        g_debug ("GsmInhibitDialog: inhibitor has XID %u", xid);
+        if (xid > 0 && dialog->have_xrender) {
+                queue_window_snapshot (dialog, inhibitor, xid);
         }
 }
 
@@ -913,7 +1249,9 @@ setup_dialog (GsmInhibitDialog *dialog)
                                                  GDK_TYPE_PIXBUF,
                                                  G_TYPE_STRING,
                                                  G_TYPE_STRING,
-                                                 G_TYPE_STRING);
+                                                 G_TYPE_STRING,
+                                                 G_TYPE_STRING,
+                                                 G_TYPE_BOOLEAN);
 
         treeview = GTK_WIDGET (gtk_builder_get_object (dialog->xml,
                                                        "inhibitors-treeview"));
@@ -1068,6 +1406,8 @@ gsm_inhibit_dialog_init (GsmInhibitDialog *dialog)
         GtkWidget *widget;
         GError    *error;
 
+        dialog->resolving = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+
         dialog->xml = gtk_builder_new ();
         gtk_builder_set_translation_domain (dialog->xml, GETTEXT_PACKAGE);
 
@@ -1111,6 +1451,8 @@ gsm_inhibit_dialog_finalize (GObject *object)
 
         g_debug ("GsmInhibitDialog: finalizing");
 
+        g_hash_table_destroy (dialog->resolving);
+
         G_OBJECT_CLASS (gsm_inhibit_dialog_parent_class)->finalize (object);
 }
 
@@ -1121,6 +1463,11 @@ gsm_inhibit_dialog_new (GsmStore *inhibitors,
 {
         GObject *object;
 
+        if (!gsm_util_ensure_gtk ()) {
+                g_warning ("Unable to initialize GTK+, cannot show the inhibit dialog");
+                return NULL;
+        }
+
         object = g_object_new (GSM_TYPE_INHIBIT_DIALOG,
                                "action", action,
                                "inhibitor-store", inhibitors,
@@ -31,6 +31,7 @@
 
 #include "gsm-inhibitor.h"
 #include "gsm-inhibitor-glue.h"
+#include "gsm-dbus-stats.h"
 #include "gsm-util.h"
 
 static guint32 inhibitor_serial = 1;
@@ -553,7 +554,7 @@ gsm_inhibitor_class_init (GsmInhibitorClass *klass)
                                                             0,
                                                             G_PARAM_READWRITE | G_PARAM_CONSTRUCT));
 
-        dbus_g_object_type_install_info (GSM_TYPE_INHIBITOR, &dbus_glib_gsm_inhibitor_object_info);
+        gsm_dbus_stats_install_info (GSM_TYPE_INHIBITOR, &dbus_glib_gsm_inhibitor_object_info);
         dbus_g_error_domain_register (GSM_INHIBITOR_ERROR, NULL, GSM_INHIBITOR_TYPE_ERROR);
 }
 
@@ -25,6 +25,8 @@
 
 #include <config.h>
 
+#include <string.h>
+
 #include <glib/gi18n.h>
 #include <gtk/gtk.h>
 
@@ -54,10 +56,6 @@ struct _GsmLogoutDialog
 {
         GtkMessageDialog     parent;
         GsmDialogLogoutType  type;
-#ifdef HAVE_SYSTEMD
-        GsmSystemd          *systemd;
-#endif
-        GsmConsolekit       *consolekit;
 
         GtkWidget           *progressbar;
 
@@ -69,6 +67,19 @@ struct _GsmLogoutDialog
 
 static GsmLogoutDialog *current_dialog = NULL;
 
+/* Hidden dialogs built ahead of time, indexed by GsmDialogLogoutType */
+static GsmLogoutDialog *prewarmed_dialogs[2] = { NULL, NULL };
+static gboolean         prewarm_enabled = FALSE;
+static guint            prewarm_id = 0;
+static GSettings       *lockdown_settings = NULL;
+static gboolean         refresh_pending = FALSE;
+#ifdef HAVE_SYSTEMD
+static GsmSystemd      *prewarm_systemd = NULL;
+#endif
+
+static void schedule_prewarm (void);
+static void queue_refresh    (void);
+
 static void gsm_logout_dialog_set_timeout  (GsmLogoutDialog *logout_dialog);
 
 static void gsm_logout_dialog_destroy  (GsmLogoutDialog *logout_dialog,
@@ -149,12 +160,6 @@ gsm_logout_dialog_init (GsmLogoutDialog *logout_dialog)
         gtk_window_set_skip_taskbar_hint (GTK_WINDOW (logout_dialog), TRUE);
         gtk_window_set_keep_above (GTK_WINDOW (logout_dialog), TRUE);
         gtk_window_stick (GTK_WINDOW (logout_dialog));
-#ifdef HAVE_SYSTEMD
-        if (LOGIND_RUNNING())
-            logout_dialog->systemd = gsm_get_systemd ();
-        else
-#endif
-        logout_dialog->consolekit = gsm_get_consolekit ();
 
         g_signal_connect (logout_dialog,
                           "destroy",
@@ -175,108 +180,97 @@ gsm_logout_dialog_destroy (GsmLogoutDialog *logout_dialog,
                 g_source_remove (logout_dialog->timeout_id);
                 logout_dialog->timeout_id = 0;
         }
-#ifdef HAVE_SYSTEMD
-        if (logout_dialog->systemd) {
-                g_object_unref (logout_dialog->systemd);
-                logout_dialog->systemd = NULL;
-        }
-#endif
 
-        if (logout_dialog->consolekit) {
-                g_object_unref (logout_dialog->consolekit);
-                logout_dialog->consolekit = NULL;
+        if (current_dialog == logout_dialog) {
+                current_dialog = NULL;
+
+                /* build a replacement for the next time */
+                if (prewarm_enabled) {
+                        queue_refresh ();
+                }
         }
 
-        current_dialog = NULL;
+        if (prewarmed_dialogs[logout_dialog->type] == logout_dialog) {
+                prewarmed_dialogs[logout_dialog->type] = NULL;
+        }
 }
 
-static gboolean
-gsm_logout_supports_system_suspend (GsmLogoutDialog *logout_dialog)
-{
-        gboolean ret;
-        ret = FALSE;
-#ifdef HAVE_SYSTEMD
-        if (LOGIND_RUNNING())
-            ret = gsm_systemd_can_suspend (logout_dialog->systemd);
-        else
-#endif
-        ret = gsm_consolekit_can_suspend (logout_dialog->consolekit);
-        return ret;
-}
+/* What the dialogs offer. Finding out takes blocking calls to logind
+ * or ConsoleKit, so it is done ahead of time, without GTK+, and kept
+ * until something it depends on may have changed. */
+typedef struct {
+        gboolean valid;
+        gboolean can_switch_user;
+        gboolean can_suspend;
+        gboolean can_hibernate;
+        gboolean can_reboot;
+        gboolean can_shutdown;
+        gboolean is_login_window;
+} GsmLogoutCapabilities;
+
+static GsmLogoutCapabilities capabilities;
 
-static gboolean
-gsm_logout_supports_system_hibernate (GsmLogoutDialog *logout_dialog)
-{
-        gboolean ret;
-        ret = FALSE;
-#ifdef HAVE_SYSTEMD
-        if (LOGIND_RUNNING())
-            ret = gsm_systemd_can_hibernate (logout_dialog->systemd);
-        else
-#endif
-        ret = gsm_consolekit_can_hibernate (logout_dialog->consolekit);
-        return ret;
-}
-
-static gboolean
-gsm_logout_supports_switch_user (GsmLogoutDialog *logout_dialog)
+static void
+query_capabilities (GsmLogoutCapabilities *caps)
 {
         GSettings *settings;
-        gboolean   ret = FALSE;
         gboolean   locked;
+        char      *session_type;
 
         settings = g_settings_new (LOCKDOWN_SCHEMA);
-
         locked = g_settings_get_boolean (settings, KEY_USER_SWITCHING_DISABLE);
         g_object_unref (settings);
 
-        if (!locked) {
 #ifdef HAVE_SYSTEMD
-            if (LOGIND_RUNNING())
-                ret = gsm_systemd_can_switch_user (logout_dialog->systemd);
-            else
-#endif
-            ret = gsm_consolekit_can_switch_user (logout_dialog->consolekit);
+        if (LOGIND_RUNNING()) {
+                GsmSystemd *systemd;
+
+                systemd = gsm_get_systemd ();
+                caps->can_switch_user = !locked && gsm_systemd_can_switch_user (systemd);
+                caps->can_suspend = gsm_systemd_can_suspend (systemd);
+                caps->can_hibernate = gsm_systemd_can_hibernate (systemd);
+                caps->can_reboot = gsm_systemd_can_restart (systemd);
+                caps->can_shutdown = gsm_systemd_can_stop (systemd);
+                session_type = gsm_systemd_get_current_session_type (systemd);
+                caps->is_login_window = g_strcmp0 (session_type, GSM_SYSTEMD_SESSION_TYPE_LOGIN_WINDOW) == 0;
+                g_object_unref (systemd);
         }
-
-        return ret;
-}
-
-static gboolean
-gsm_logout_supports_reboot (GsmLogoutDialog *logout_dialog)
-{
-        gboolean ret;
-
+        else {
+#endif
+        GsmConsolekit *consolekit;
+
+        consolekit = gsm_get_consolekit ();
+        caps->can_switch_user = !locked && gsm_consolekit_can_switch_user (consolekit);
+        caps->can_suspend = gsm_consolekit_can_suspend (consolekit);
+        caps->can_hibernate = gsm_consolekit_can_hibernate (consolekit);
+        caps->can_reboot = gsm_consolekit_can_restart (consolekit);
+        caps->can_shutdown = gsm_consolekit_can_stop (consolekit);
+        session_type = gsm_consolekit_get_current_session_type (consolekit);
+        caps->is_login_window = g_strcmp0 (session_type, GSM_CONSOLEKIT_SESSION_TYPE_LOGIN_WINDOW) == 0;
+        g_object_unref (consolekit);
 #ifdef HAVE_SYSTEMD
-        if (LOGIND_RUNNING())
-            ret = gsm_systemd_can_restart (logout_dialog->systemd);
-        else
+        }
 #endif
-        ret = gsm_consolekit_can_restart (logout_dialog->consolekit);
-        if (!ret) {
-                ret = mdm_supports_logout_action (MDM_LOGOUT_ACTION_REBOOT);
+        g_free (session_type);
+
+        if (!caps->can_reboot) {
+                caps->can_reboot = mdm_supports_logout_action (MDM_LOGOUT_ACTION_REBOOT);
+        }
+        if (!caps->can_shutdown) {
+                caps->can_shutdown = mdm_supports_logout_action (MDM_LOGOUT_ACTION_SHUTDOWN);
         }
 
-        return ret;
+        caps->valid = TRUE;
 }
 
-static gboolean
-gsm_logout_supports_shutdown (GsmLogoutDialog *logout_dialog)
+static const GsmLogoutCapabilities *
+get_capabilities (void)
 {
-        gboolean ret;
-
-#ifdef HAVE_SYSTEMD
-        if (LOGIND_RUNNING())
-            ret = gsm_systemd_can_stop (logout_dialog->systemd);
-        else
-#endif
-        ret = gsm_consolekit_can_stop (logout_dialog->consolekit);
-
-        if (!ret) {
-                ret = mdm_supports_logout_action (MDM_LOGOUT_ACTION_SHUTDOWN);
+        if (!capabilities.valid) {
+                query_capabilities (&capabilities);
         }
 
-        return ret;
+        return &capabilities;
 }
 
 static void
@@ -291,8 +285,6 @@ gsm_logout_dialog_timeout (gpointer data)
         GsmLogoutDialog *logout_dialog;
         char            *seconds_warning;
         char            *secondary_text;
-        static char     *session_type = NULL;
-        static gboolean  is_not_login;
 
         logout_dialog = (GsmLogoutDialog *) data;
 
@@ -325,28 +317,7 @@ gsm_logout_dialog_timeout (gpointer data)
         }
         seconds_warning = g_strdup_printf (seconds_warning, logout_dialog->timeout);
 
-        if (session_type == NULL) {
-#ifdef HAVE_SYSTEMD
-                if (LOGIND_RUNNING()) {
-                    GsmSystemd *systemd;
-                    systemd = gsm_get_systemd ();
-                    session_type = gsm_systemd_get_current_session_type (systemd);
-                    g_object_unref (systemd);
-                    is_not_login = (g_strcmp0 (session_type, GSM_SYSTEMD_SESSION_TYPE_LOGIN_WINDOW) != 0);
-                }
-                else {
-#endif
-                GsmConsolekit *consolekit;
-                consolekit = gsm_get_consolekit ();
-                session_type = gsm_consolekit_get_current_session_type (consolekit);
-                g_object_unref (consolekit);
-                is_not_login = (g_strcmp0 (session_type, GSM_CONSOLEKIT_SESSION_TYPE_LOGIN_WINDOW) != 0);
-#ifdef HAVE_SYSTEMD
-                }
-#endif
-        }
-
-        if (is_not_login) {
+        if (!get_capabilities ()->is_login_window) {
                 char *name;
 
                 name = g_locale_to_utf8 (g_get_real_name (), -1, NULL, NULL, NULL);
@@ -411,24 +382,19 @@ gsm_logout_dialog_set_timeout (GsmLogoutDialog *logout_dialog)
         g_object_unref (settings);
 }
 
-static GtkWidget *
-gsm_get_dialog (GsmDialogLogoutType type,
-                GdkScreen          *screen,
-                guint32             activate_time)
+static GsmLogoutDialog *
+gsm_logout_dialog_build (GsmDialogLogoutType type)
 {
+        const GsmLogoutCapabilities *caps;
         GsmLogoutDialog *logout_dialog;
         GtkWidget       *hbox;
         const char      *primary_text;
         const char      *icon_name;
 
-        if (current_dialog != NULL) {
-                gtk_widget_destroy (GTK_WIDGET (current_dialog));
-        }
+        caps = get_capabilities ();
 
         logout_dialog = g_object_new (GSM_TYPE_LOGOUT_DIALOG, NULL);
 
-        current_dialog = logout_dialog;
-
         gtk_window_set_title (GTK_WINDOW (logout_dialog), "");
 
         logout_dialog->type = type;
@@ -443,7 +409,7 @@ gsm_get_dialog (GsmDialogLogoutType type,
 
                 logout_dialog->default_response = GSM_LOGOUT_RESPONSE_LOGOUT;
 
-                if (gsm_logout_supports_switch_user (logout_dialog)) {
+                if (caps->can_switch_user) {
                         gsm_util_dialog_add_button (GTK_DIALOG (logout_dialog),
                                                     _("_Switch User"), "system-users",
                                                     GSM_LOGOUT_RESPONSE_SWITCH_USER);
@@ -464,19 +430,19 @@ gsm_get_dialog (GsmDialogLogoutType type,
 
                 logout_dialog->default_response = GSM_LOGOUT_RESPONSE_SHUTDOWN;
 
-                if (gsm_logout_supports_system_suspend (logout_dialog)) {
+                if (caps->can_suspend) {
                         gsm_util_dialog_add_button (GTK_DIALOG (logout_dialog),
                                                     _("S_uspend"), "battery",
                                                     GSM_LOGOUT_RESPONSE_SLEEP);
                 }
 
-                if (gsm_logout_supports_system_hibernate (logout_dialog)) {
+                if (caps->can_hibernate) {
                         gsm_util_dialog_add_button (GTK_DIALOG (logout_dialog),
                                                     _("_Hibernate"), "drive-harddisk",
                                                     GSM_LOGOUT_RESPONSE_HIBERNATE);
                 }
 
-                if (gsm_logout_supports_reboot (logout_dialog)) {
+                if (caps->can_reboot) {
                         gsm_util_dialog_add_button (GTK_DIALOG (logout_dialog),
                                                     _("_Restart"), "view-refresh",
                                                     GSM_LOGOUT_RESPONSE_REBOOT);
@@ -486,7 +452,7 @@ gsm_get_dialog (GsmDialogLogoutType type,
                                             _("_Cancel"), "process-stop",
                                             GTK_RESPONSE_CANCEL);
 
-                if (gsm_logout_supports_shutdown (logout_dialog)) {
+                if (caps->can_shutdown) {
                         gsm_util_dialog_add_button (GTK_DIALOG (logout_dialog),
                                                     _("_Shut Down"), "system-shutdown",
                                                     GSM_LOGOUT_RESPONSE_SHUTDOWN);
@@ -513,6 +479,222 @@ gsm_get_dialog (GsmDialogLogoutType type,
         gtk_dialog_set_default_response (GTK_DIALOG (logout_dialog),
                                          logout_dialog->default_response);
 
+        return logout_dialog;
+}
+
+static void
+drop_prewarmed_dialog (GsmDialogLogoutType type)
+{
+        if (prewarmed_dialogs[type] != NULL) {
+                /* the destroy handler clears the slot */
+                gtk_widget_destroy (GTK_WIDGET (prewarmed_dialogs[type]));
+        }
+}
+
+static void
+refresh_capabilities (void)
+{
+        GsmLogoutCapabilities caps = { 0 };
+
+        query_capabilities (&caps);
+
+        if (memcmp (&caps, &capabilities, sizeof (caps)) == 0) {
+                return;
+        }
+
+        g_debug ("GsmLogoutDialog: capabilities changed, rebuilding the dialogs");
+
+        capabilities = caps;
+
+        drop_prewarmed_dialog (GSM_DIALOG_LOGOUT_TYPE_LOGOUT);
+        drop_prewarmed_dialog (GSM_DIALOG_LOGOUT_TYPE_SHUTDOWN);
+}
+
+static gboolean
+prewarm_idle (gpointer data)
+{
+        GsmDialogLogoutType type;
+
+        /* the capabilities do not need GTK+, so they are known before
+         * the first dialog is asked for */
+        if (!capabilities.valid) {
+                query_capabilities (&capabilities);
+                refresh_pending = FALSE;
+                return TRUE;
+        }
+
+        if (refresh_pending) {
+                refresh_pending = FALSE;
+                refresh_capabilities ();
+                return TRUE;
+        }
+
+        /* prewarming must not be what brings GTK+ up; the widgets of
+         * the first dialog of the session are built on demand */
+        if (!gsm_util_has_gtk ()) {
+                prewarm_id = 0;
+                return FALSE;
+        }
+
+        /* one dialog per idle run, to keep the main loop responsive */
+        for (type = GSM_DIALOG_LOGOUT_TYPE_LOGOUT; type <= GSM_DIALOG_LOGOUT_TYPE_SHUTDOWN; type++) {
+                if (prewarmed_dialogs[type] == NULL) {
+                        g_debug ("GsmLogoutDialog: prewarming dialog %d", type);
+
+                        prewarmed_dialogs[type] = gsm_logout_dialog_build (type);
+                        gtk_widget_realize (GTK_WIDGET (prewarmed_dialogs[type]));
+
+                        return TRUE;
+                }
+        }
+
+        prewarm_id = 0;
+
+        return FALSE;
+}
+
+static void
+schedule_prewarm (void)
+{
+        if (prewarm_id == 0) {
+                prewarm_id = g_idle_add_full (G_PRIORITY_LOW,
+                                              prewarm_idle,
+                                              NULL,
+                                              NULL);
+        }
+}
+
+static void
+queue_refresh (void)
+{
+        refresh_pending = TRUE;
+        schedule_prewarm ();
+}
+
+static void
+on_lockdown_settings_changed (GSettings  *settings,
+                              const char *key,
+                              gpointer    data)
+{
+        g_debug ("GsmLogoutDialog: user switching setting changed");
+
+        queue_refresh ();
+}
+
+#ifdef HAVE_SYSTEMD
+static void
+on_prepare_for_sleep (GsmSystemd *systemd,
+                      gboolean    start,
+                      gpointer    data)
+{
+        /* logind does not signal changes of what it can do; a resume
+         * is the usual moment for them (a different dock, battery or
+         * swap), so check again then */
+        if (!start) {
+                queue_refresh ();
+        }
+}
+#endif
+
+/**
+ * gsm_logout_dialog_start_prewarm:
+ *
+ * Runs the capability checks of the logout and shutdown dialogs when
+ * the main loop is idle, and builds the dialogs and keeps them hidden
+ * so that they can be shown without delay. The checks are run again
+ * after a dialog has been used, after a resume and when the user
+ * switching setting changes; the dialogs are rebuilt if the result
+ * differs.
+ *
+ * The checks do not need GTK+, but the widgets are not built until
+ * GTK+ has been initialized for another reason, usually the first
+ * dialog of the session.
+ **/
+void
+gsm_logout_dialog_start_prewarm (void)
+{
+        if (prewarm_enabled) {
+                return;
+        }
+
+        prewarm_enabled = TRUE;
+
+        lockdown_settings = g_settings_new (LOCKDOWN_SCHEMA);
+        g_signal_connect (lockdown_settings,
+                          "changed::" KEY_USER_SWITCHING_DISABLE,
+                          G_CALLBACK (on_lockdown_settings_changed),
+                          NULL);
+
+#ifdef HAVE_SYSTEMD
+        if (LOGIND_RUNNING()) {
+                prewarm_systemd = gsm_get_systemd ();
+                g_signal_connect (prewarm_systemd,
+                                  "prepare-for-sleep",
+                                  G_CALLBACK (on_prepare_for_sleep),
+                                  NULL);
+        }
+#endif
+
+        schedule_prewarm ();
+}
+
+void
+gsm_logout_dialog_stop_prewarm (void)
+{
+        if (!prewarm_enabled) {
+                return;
+        }
+
+        prewarm_enabled = FALSE;
+
+        if (prewarm_id != 0) {
+                g_source_remove (prewarm_id);
+                prewarm_id = 0;
+        }
+
+        g_clear_object (&lockdown_settings);
+
+#ifdef HAVE_SYSTEMD
+        if (prewarm_systemd != NULL) {
+                g_signal_handlers_disconnect_matched (prewarm_systemd,
+                                                      G_SIGNAL_MATCH_FUNC,
+                                                      0, 0, NULL,
+                                                      on_prepare_for_sleep,
+                                                      NULL);
+                g_clear_object (&prewarm_systemd);
+        }
+#endif
+
+        drop_prewarmed_dialog (GSM_DIALOG_LOGOUT_TYPE_LOGOUT);
+        drop_prewarmed_dialog (GSM_DIALOG_LOGOUT_TYPE_SHUTDOWN);
+}
+
+static GtkWidget *
+gsm_get_dialog (GsmDialogLogoutType type,
+                GdkScreen          *screen,
+                guint32             activate_time)
+{
+        GsmLogoutDialog *logout_dialog;
+
+        if (!gsm_util_ensure_gtk ()) {
+                g_warning ("Unable to initialize GTK+, cannot show the logout dialog");
+                return NULL;
+        }
+
+        if (current_dialog != NULL) {
+                gtk_widget_destroy (GTK_WIDGET (current_dialog));
+        }
+
+        logout_dialog = prewarmed_dialogs[type];
+        if (logout_dialog != NULL) {
+                g_debug ("GsmLogoutDialog: using prewarmed dialog %d", type);
+                prewarmed_dialogs[type] = NULL;
+        } else {
+                logout_dialog = gsm_logout_dialog_build (type);
+        }
+
+        current_dialog = logout_dialog;
+
         gtk_window_set_screen (GTK_WINDOW (logout_dialog), screen);
 
         return GTK_WIDGET (logout_dialog);
@@ -47,6 +47,9 @@ GtkWidget   *gsm_get_logout_dialog        (GdkScreen           *screen,
 GtkWidget   *gsm_get_shutdown_dialog      (GdkScreen           *screen,
                                            guint32              activate_time);
 
+void         gsm_logout_dialog_start_prewarm (void);
+void         gsm_logout_dialog_stop_prewarm  (void);
+
 G_END_DECLS
 
 #endif /* __GSM_LOGOUT_DIALOG_H__ */
@@ -35,6 +35,7 @@
 #include <glib.h>
 #include <glib/gi18n.h>
 #include <glib/gstdio.h>
+#include <glib-unix.h>
 #include <glib-object.h>
 #include <dbus/dbus-glib.h>
 #include <dbus/dbus-glib-lowlevel.h>
@@ -57,6 +58,7 @@
 
 #include "gsm-util.h"
 #include "mdm.h"
+#include "mdm-log.h"
 #include "gsm-logout-dialog.h"
 #include "gsm-inhibit-dialog.h"
 #include "gsm-consolekit.h"
@@ -64,6 +66,15 @@
 #include "gsm-systemd.h"
 #endif
 #include "gsm-session-save.h"
+#include "gsm-pressure.h"
+#include "gsm-readahead.h"
+#include "gsm-window-watcher.h"
+#include "gsm-startup-stats.h"
+#include "gsm-state-page.h"
+#include "gsm-object-manager.h"
+#include "gsm-watchdog.h"
+#include "gsm-metrics.h"
+#include "gsm-dbus-stats.h"
 
 #ifdef HAVE_LIBCANBERRA
 #include <canberra-gtk.h>
@@ -73,13 +84,45 @@
 
 #define GSM_MANAGER_DBUS_PATH "/org/gnome/SessionManager"
 #define GSM_MANAGER_DBUS_NAME "org.gnome.SessionManager"
+#define GSM_MANAGER_DBUS_INTERFACE "org.gnome.SessionManager"
+
+/* PrepareForSleep(b start) is sent on this interface when the system is
+ * about to sleep and when it has woken up, for session clients that
+ * would rather not watch the system bus */
+#define GSM_MANAGER_SLEEP_DBUS_INTERFACE "org.mate.SessionManager.Sleep"
 
 #define GSM_MANAGER_PHASE_TIMEOUT 30 /* seconds */
 
-/* In the exit phase, all apps were already given the chance to inhibit the session end
- * At that stage we don't want to wait much for apps to respond, we want to exit, and fast.
+/* Bounds of the registration timeout learned for each app; the phase
+ * timeout above is used until an app has been timed a few times. */
+#define GSM_MANAGER_MIN_APP_TIMEOUT 5 /* seconds */
+#define GSM_MANAGER_MAX_APP_TIMEOUT 60 /* seconds */
+
+/* An app that needs more than GSM_MANAGER_RESTART_BURST restarts without
+ * staying up for GSM_MANAGER_RESTART_WINDOW is considered failed. Each
+ * restart after the first one is delayed twice as long as the previous
+ * one, up to GSM_MANAGER_RESTART_MAX_DELAY.
  */
-#define GSM_MANAGER_EXIT_PHASE_TIMEOUT 1 /* seconds */
+#define GSM_MANAGER_RESTART_BURST     5
+#define GSM_MANAGER_RESTART_WINDOW    60 /* seconds */
+#define GSM_MANAGER_RESTART_MAX_DELAY 30 /* seconds */
+
+/* How often the pressure throttled launcher looks at /proc/pressure,
+ * and how many queued apps it starts when the pressure is low, so that
+ * the next sample sees their effect */
+#define GSM_MANAGER_PRESSURE_INTERVAL 250 /* milliseconds */
+#define GSM_MANAGER_PRESSURE_BATCH    2
+
+/* Give the session time to settle before recording what it uses */
+#define GSM_MANAGER_READAHEAD_DELAY 30 /* seconds */
+
+/* How long calls to the bus name of an on demand app are held while
+ * the app starts, matches the default D-Bus method call timeout */
+#define GSM_MANAGER_ON_DEMAND_NAME_TIMEOUT 25 /* seconds */
+
+/* How long the pressure is watched before on demand apps are started,
+ * and again each time it was too high */
+#define GSM_MANAGER_ON_DEMAND_IDLE_CHECK 10 /* seconds */
 
 #define MDM_FLEXISERVER_COMMAND "mdmflexiserver"
 #define MDM_FLEXISERVER_ARGS    "--startnew Standard"
@@ -95,6 +138,17 @@
 #define SESSION_SCHEMA               "org.mate.session"
 #define KEY_IDLE_DELAY               "idle-delay"
 #define KEY_AUTOSAVE                 "auto-save-session"
+#define KEY_EXIT_GRACE_PERIOD        "exit-grace-period"
+#define KEY_STARTUP_PRIORITIES       "startup-priorities"
+#define KEY_PRESSURE_THROTTLING      "pressure-throttling"
+#define KEY_PRESSURE_CPU             "pressure-cpu-threshold"
+#define KEY_PRESSURE_IO              "pressure-io-threshold"
+#define KEY_PRESSURE_MEMORY          "pressure-memory-threshold"
+#define KEY_PRESSURE_MAX_WAIT        "pressure-max-wait"
+#define KEY_READAHEAD                "readahead"
+#define KEY_ON_DEMAND_DELAY          "on-demand-delay"
+#define KEY_METRICS_EXPORT_INTERVAL  "metrics-export-interval"
+#define KEY_DBUS_CALL_STATS          "dbus-call-stats"
 
 #define SCREENSAVER_SCHEMA           "org.mate.screensaver"
 #define KEY_SLEEP_LOCK               "lock-enabled"
@@ -137,6 +191,8 @@ typedef struct {
         GSList                 *next_query_clients;
         /* This is the action that will be done just before we exit */
         GsmManagerLogoutType    logout_type;
+        gint64                  exit_start_time;
+        gboolean                quitting;
 
         GtkWidget              *inhibit_dialog;
 
@@ -144,6 +200,48 @@ typedef struct {
          * and shouldn't be automatically restarted */
         GSList                 *condition_clients;
 
+        /* GsmApp -> AppRestartState */
+        GHashTable             *app_restart_states;
+
+        /* non critical apps waiting for the system to calm down */
+        GQueue                 *throttled_apps;
+        guint                   throttle_id;
+        GsmPressureSample       last_pressure;
+
+        /* records the files the session used, once it has settled */
+        guint                   readahead_id;
+
+        /* apps only started when needed, or late, and the connection
+         * that owns their bus names until then */
+        GSList                 *on_demand_apps;
+        guint                   on_demand_id;
+        GsmPressureSample       on_demand_pressure;
+        GDBusConnection        *on_demand_connection;
+
+        /* tells when apps that don't register are up, at login */
+        GsmWindowWatcher       *window_watcher;
+
+        /* GsmApp -> PendingStart, for the apps of the current phase */
+        GHashTable             *pending_starts;
+        gint64                  phase_deadline;
+        GsmStartupStats        *startup_stats;
+
+        /* what local clients can read without asking us */
+        GsmStatePage           *state_page;
+
+        /* client id -> GsmClient, for the clients whose property
+         * changes are announced */
+        GHashTable             *notify_clients;
+
+        /* inhibitor id -> FdInhibitor, for the inhibitors that last as
+         * long as the pipe returned by InhibitFd() is open */
+        GHashTable             *fd_inhibitors;
+
+        /* steps left before the system may go to sleep, and which
+         * sleep they belong to */
+        guint                   sleep_steps;
+        guint                   sleep_generation;
+
         GSettings              *settings_session;
         GSettings              *settings_lockdown;
         GSettings              *settings_screensaver;
@@ -170,6 +268,7 @@ enum {
         INHIBITOR_REMOVED,
         SESSION_RUNNING,
         SESSION_OVER,
+        APP_FAILED,
         LAST_SIGNAL
 };
 
@@ -190,6 +289,13 @@ static void     _handle_client_end_session_response (GsmManager *manager,
 static gboolean auto_save_is_enabled (GsmManager *manager);
 static void     maybe_save_session   (GsmManager *manager);
 
+static DBusConnection *get_bus_connection (GsmManager *manager);
+
+static gboolean _client_has_startup_id (const char *id,
+                                        GsmClient  *client,
+                                        const char *startup_id_a);
+static void     kill_exit_phase_holdouts (GsmManager *manager);
+
 static gpointer manager_object = NULL;
 
 G_DEFINE_TYPE_WITH_PRIVATE (GsmManager, gsm_manager, G_TYPE_OBJECT)
@@ -548,6 +654,7 @@ end_phase (GsmManager *manager)
 
         g_slist_free (priv->pending_apps);
         priv->pending_apps = NULL;
+        g_hash_table_remove_all (priv->pending_starts);
 
         g_slist_free (priv->query_clients);
         priv->query_clients = NULL;
@@ -582,7 +689,11 @@ end_phase (GsmManager *manager)
                 break;
         case GSM_MANAGER_PHASE_EXIT:
                 start_next_phase = FALSE;
-                gsm_manager_quit (manager);
+                /* stragglers may still disconnect while we are quitting */
+                if (! priv->quitting) {
+                        priv->quitting = TRUE;
+                        gsm_manager_quit (manager);
+                }
                 break;
         default:
                 g_assert_not_reached ();
@@ -595,6 +706,105 @@ end_phase (GsmManager *manager)
         }
 }
 
+typedef struct {
+        GsmManager *manager;
+        GsmApp     *app;
+        gint64      start_time;
+        guint       timeout_id;
+        gboolean    exited;
+} PendingStart;
+
+static void
+pending_start_free (PendingStart *pending)
+{
+        if (pending->timeout_id > 0) {
+                g_source_remove (pending->timeout_id);
+        }
+        g_free (pending);
+}
+
+/* Apps that are quick to register get a short leash, so that one that
+ * hangs doesn't hold up the login for long, while apps known to be slow
+ * are given the time they usually need.
+ */
+static gint64
+app_registration_timeout (GsmManager *manager,
+                          GsmApp     *app)
+{
+        GsmManagerPrivate *priv;
+        gint64             mean;
+        gint64             deviation;
+        gint64             timeout;
+
+        priv = gsm_manager_get_instance_private (manager);
+
+        if (!gsm_startup_stats_lookup (priv->startup_stats,
+                                       gsm_app_peek_app_id (app),
+                                       &mean,
+                                       &deviation)) {
+                return GSM_MANAGER_PHASE_TIMEOUT * G_USEC_PER_SEC;
+        }
+
+        timeout = mean + 4 * deviation;
+
+        return CLAMP (timeout,
+                      GSM_MANAGER_MIN_APP_TIMEOUT * G_USEC_PER_SEC,
+                      GSM_MANAGER_MAX_APP_TIMEOUT * G_USEC_PER_SEC);
+}
+
+/* Exiting is not being ready: whatever the app does afterwards, the
+ * time it takes says nothing about how long it needs to start, so no
+ * sample is recorded for it. It is still pending, though, and keeps its
+ * deadline until it registers or the deadline passes.
+ */
+static void
+app_exited_while_pending (GsmApp     *app,
+                          GsmManager *manager)
+{
+        GsmManagerPrivate *priv;
+        PendingStart      *pending;
+
+        priv = gsm_manager_get_instance_private (manager);
+
+        g_signal_handlers_disconnect_by_func (app, app_exited_while_pending, manager);
+
+        pending = g_hash_table_lookup (priv->pending_starts, app);
+        if (pending != NULL) {
+                pending->exited = TRUE;
+        }
+}
+
+static void
+record_app_ready (GsmManager *manager,
+                  GsmApp     *app)
+{
+        GsmManagerPrivate *priv;
+        PendingStart      *pending;
+        gint64             elapsed;
+
+        priv = gsm_manager_get_instance_private (manager);
+
+        pending = g_hash_table_lookup (priv->pending_starts, app);
+        if (pending == NULL) {
+                return;
+        }
+
+        elapsed = g_get_monotonic_time () - pending->start_time;
+
+        g_debug ("GsmManager: %s ready after %.3f seconds",
+                 gsm_app_peek_app_id (app),
+                 elapsed / (double) G_USEC_PER_SEC);
+
+        if (!pending->exited) {
+                gsm_startup_stats_add_sample (priv->startup_stats,
+                                              gsm_app_peek_app_id (app),
+                                              elapsed);
+        }
+
+        g_signal_handlers_disconnect_by_func (app, app_exited_while_pending, manager);
+        g_hash_table_remove (priv->pending_starts, app);
+}
+
 static void
 app_registered (GsmApp     *app,
                 GsmManager *manager)
@@ -602,6 +812,7 @@ app_registered (GsmApp     *app,
         GsmManagerPrivate *priv;
 
         priv = gsm_manager_get_instance_private (manager);
+        record_app_ready (manager, app);
         priv->pending_apps = g_slist_remove (priv->pending_apps, app);
         g_signal_handlers_disconnect_by_func (app, app_registered, manager);
 
@@ -615,6 +826,241 @@ app_registered (GsmApp     *app,
         }
 }
 
+static gboolean
+on_app_registration_timeout (PendingStart *pending)
+{
+        GsmManager        *manager = pending->manager;
+        GsmApp            *app = pending->app;
+        GsmManagerPrivate *priv;
+        gint64             elapsed;
+
+        priv = gsm_manager_get_instance_private (manager);
+
+        elapsed = g_get_monotonic_time () - pending->start_time;
+
+        g_warning ("Application '%s' failed to register within %.1f seconds",
+                   gsm_app_peek_app_id (app),
+                   elapsed / (double) G_USEC_PER_SEC);
+
+        /* the app needed at least that long; without this sample, an app
+         * that got slower would be cut off at the same deadline at every
+         * login and the deadline would never be learned again */
+        if (!pending->exited) {
+                gsm_startup_stats_add_sample (priv->startup_stats,
+                                              gsm_app_peek_app_id (app),
+                                              elapsed);
+        }
+
+        pending->timeout_id = 0;
+        g_signal_handlers_disconnect_by_func (app, app_exited_while_pending, manager);
+        g_hash_table_remove (priv->pending_starts, app);
+
+        /* FIXME: what if the app was filling in a required slot? */
+        app_registered (app, manager);
+
+        return FALSE;
+}
+
+static void
+track_pending_start (GsmManager *manager,
+                     GsmApp     *app)
+{
+        GsmManagerPrivate *priv;
+        PendingStart      *pending;
+        gint64             timeout;
+
+        priv = gsm_manager_get_instance_private (manager);
+
+        timeout = app_registration_timeout (manager, app);
+        priv->phase_deadline = MAX (priv->phase_deadline, timeout);
+
+        g_debug ("GsmManager: giving %s %.1f seconds to register",
+                 gsm_app_peek_app_id (app),
+                 timeout / (double) G_USEC_PER_SEC);
+
+        pending = g_new0 (PendingStart, 1);
+        pending->manager = manager;
+        pending->app = app;
+        pending->start_time = g_get_monotonic_time ();
+        pending->timeout_id = g_timeout_add (timeout / 1000,
+                                             (GSourceFunc)on_app_registration_timeout,
+                                             pending);
+
+        g_hash_table_replace (priv->pending_starts, app, pending);
+
+        g_signal_connect (app,
+                          "exited",
+                          G_CALLBACK (app_exited_while_pending),
+                          manager);
+}
+
+static gboolean
+app_matches_startup_id (GsmApp     *app,
+                        const char *startup_id)
+{
+        if (startup_id == NULL) {
+                return FALSE;
+        }
+
+        if (g_strcmp0 (gsm_app_peek_startup_id (app), startup_id) == 0) {
+                return TRUE;
+        }
+
+        return GSM_IS_AUTOSTART_APP (app)
+                && g_strcmp0 (gsm_autostart_app_peek_startup_notify_id (GSM_AUTOSTART_APP (app)),
+                              startup_id) == 0;
+}
+
+static gboolean
+app_matches_pid (GsmApp *app,
+                 int     pid)
+{
+        return pid > 0
+                && GSM_IS_AUTOSTART_APP (app)
+                && gsm_autostart_app_peek_pid (GSM_AUTOSTART_APP (app)) == pid;
+}
+
+/* Only the phases that put something on screen can be cut short by a
+ * window showing up.
+ */
+static gboolean
+phase_waits_for_windows (GsmManager *manager)
+{
+        GsmManagerPrivate *priv;
+
+        priv = gsm_manager_get_instance_private (manager);
+
+        return priv->phase == GSM_MANAGER_PHASE_WINDOW_MANAGER
+                || priv->phase == GSM_MANAGER_PHASE_PANEL
+                || priv->phase == GSM_MANAGER_PHASE_DESKTOP;
+}
+
+static void
+app_window_ready (GsmManager *manager,
+                  GsmApp     *app,
+                  const char *reason)
+{
+        g_debug ("GsmManager: %s is ready (%s)", gsm_app_peek_app_id (app), reason);
+
+        app_registered (app, manager);
+}
+
+static void
+on_window_manager_ready (GsmWindowWatcher *watcher,
+                         int               pid,
+                         GsmManager       *manager)
+{
+        GsmManagerPrivate *priv;
+        GSList            *a;
+
+        priv = gsm_manager_get_instance_private (manager);
+
+        if (priv->phase != GSM_MANAGER_PHASE_WINDOW_MANAGER) {
+                return;
+        }
+
+        for (a = priv->pending_apps; a != NULL; a = a->next) {
+                if (app_matches_pid (a->data, pid)) {
+                        app_window_ready (manager, a->data, "window manager check");
+                        return;
+                }
+        }
+
+        /* window managers started through a wrapper script don't have
+         * the pid we know about */
+        if (priv->pending_apps != NULL && priv->pending_apps->next == NULL) {
+                app_window_ready (manager, priv->pending_apps->data, "window manager check");
+        }
+}
+
+static void
+on_window_mapped (GsmWindowWatcher *watcher,
+                  int               pid,
+                  const char       *startup_id,
+                  const char       *sm_client_id,
+                  GsmManager       *manager)
+{
+        GsmManagerPrivate *priv;
+        GSList            *a;
+
+        priv = gsm_manager_get_instance_private (manager);
+
+        if (!phase_waits_for_windows (manager)) {
+                return;
+        }
+
+        for (a = priv->pending_apps; a != NULL; a = a->next) {
+                if (app_matches_startup_id (a->data, sm_client_id)
+                    || app_matches_startup_id (a->data, startup_id)
+                    || app_matches_pid (a->data, pid)) {
+                        app_window_ready (manager, a->data, "window mapped");
+                        return;
+                }
+        }
+}
+
+static void
+on_startup_complete (GsmWindowWatcher *watcher,
+                     const char       *startup_id,
+                     GsmManager       *manager)
+{
+        GsmManagerPrivate *priv;
+        GSList            *a;
+
+        priv = gsm_manager_get_instance_private (manager);
+
+        if (!phase_waits_for_windows (manager)) {
+                return;
+        }
+
+        for (a = priv->pending_apps; a != NULL; a = a->next) {
+                if (app_matches_startup_id (a->data, startup_id)) {
+                        app_window_ready (manager, a->data, "startup notification");
+                        return;
+                }
+        }
+}
+
+static void
+start_window_watcher (GsmManager *manager)
+{
+        GsmManagerPrivate *priv;
+
+        priv = gsm_manager_get_instance_private (manager);
+
+        priv->window_watcher = gsm_window_watcher_new ();
+        if (priv->window_watcher == NULL) {
+                return;
+        }
+
+        g_signal_connect (priv->window_watcher,
+                          "window-manager-ready",
+                          G_CALLBACK (on_window_manager_ready),
+                          manager);
+        g_signal_connect (priv->window_watcher,
+                          "window-mapped",
+                          G_CALLBACK (on_window_mapped),
+                          manager);
+        g_signal_connect (priv->window_watcher,
+                          "startup-complete",
+                          G_CALLBACK (on_startup_complete),
+                          manager);
+}
+
+static void
+stop_window_watcher (GsmManager *manager)
+{
+        GsmManagerPrivate *priv;
+
+        priv = gsm_manager_get_instance_private (manager);
+
+        if (priv->window_watcher != NULL) {
+                g_signal_handlers_disconnect_by_data (priv->window_watcher, manager);
+                g_object_unref (priv->window_watcher);
+                priv->window_watcher = NULL;
+        }
+}
+
 static gboolean
 on_phase_timeout (GsmManager *manager)
 {
@@ -624,6 +1070,19 @@ on_phase_timeout (GsmManager *manager)
         priv = gsm_manager_get_instance_private (manager);
         priv->phase_timeout_id = 0;
 
+        gsm_metrics_increment (GSM_METRIC_PHASE_TIMEOUTS);
+
+        /* nothing hangs in the RUNNING phase, and clients that don't
+         * leave in time are routine in the EXIT phase */
+        if (priv->phase != GSM_MANAGER_PHASE_RUNNING
+            && priv->phase != GSM_MANAGER_PHASE_EXIT) {
+                char *reason;
+
+                reason = g_strdup_printf ("%s phase timeout", phase_num_to_name (priv->phase));
+                mdm_log_dump_flight_recorder (reason);
+                g_free (reason);
+        }
+
         switch (priv->phase) {
         case GSM_MANAGER_PHASE_STARTUP:
         case GSM_MANAGER_PHASE_INITIALIZATION:
@@ -632,8 +1091,10 @@ on_phase_timeout (GsmManager *manager)
         case GSM_MANAGER_PHASE_DESKTOP:
         case GSM_MANAGER_PHASE_APPLICATION:
                 for (a = priv->pending_apps; a; a = a->next) {
-                        g_warning ("Application '%s' failed to register before timeout",
-                                   gsm_app_peek_app_id (a->data));
+                        mdm_log_field (G_LOG_LEVEL_WARNING,
+                                       "MATE_SESSION_APP_ID", gsm_app_peek_app_id (a->data),
+                                       "Application '%s' failed to register before timeout",
+                                       gsm_app_peek_app_id (a->data));
                         g_signal_handlers_disconnect_by_func (a->data, app_registered, manager);
                         /* FIXME: what if the app was filling in a required slot? */
                 }
@@ -644,6 +1105,7 @@ on_phase_timeout (GsmManager *manager)
         case GSM_MANAGER_PHASE_END_SESSION:
                 break;
         case GSM_MANAGER_PHASE_EXIT:
+                kill_exit_phase_holdouts (manager);
                 break;
         default:
                 g_assert_not_reached ();
@@ -655,8 +1117,8 @@ on_phase_timeout (GsmManager *manager)
         return FALSE;
 }
 
-static gboolean
-_autostart_delay_timeout (GsmApp *app)
+static void
+launch_app (GsmApp *app)
 {
         GError *error = NULL;
         gboolean res;
@@ -665,72 +1127,781 @@ _autostart_delay_timeout (GsmApp *app)
             && !gsm_app_peek_is_conditionally_disabled (app)) {
                 res = gsm_app_start (app, &error);
                 if (!res) {
+                        gsm_metrics_increment (GSM_METRIC_APP_START_FAILURES);
                         if (error != NULL) {
                                 g_warning ("Could not launch application '%s': %s",
                                            gsm_app_peek_app_id (app),
                                            error->message);
                                 g_error_free (error);
                         }
+                } else {
+                        gsm_metrics_increment (GSM_METRIC_APPS_STARTED);
                 }
         }
+}
 
-        g_object_unref (app);
+typedef struct {
+        GsmApp *app;
+        gint64  queued_time;
+} ThrottledApp;
 
-        return FALSE;
+static void
+throttled_app_free (ThrottledApp *throttled)
+{
+        g_object_unref (throttled->app);
+        g_free (throttled);
 }
 
 static gboolean
-_start_app (const char *id,
-            GsmApp     *app,
-            GsmManager *manager)
+pressure_is_low (GsmManager              *manager,
+                 const GsmPressureSample *before,
+                 const GsmPressureSample *sample)
 {
-        GError  *error;
-        gboolean res;
-        int      delay;
         GsmManagerPrivate *priv;
+        const char        *keys[GSM_PRESSURE_N_RESOURCES] = {
+                KEY_PRESSURE_CPU,
+                KEY_PRESSURE_IO,
+                KEY_PRESSURE_MEMORY
+        };
+        int                i;
 
         priv = gsm_manager_get_instance_private (manager);
 
-        if (gsm_app_peek_phase (app) != priv->phase) {
-                goto out;
-        }
+        for (i = 0; i < GSM_PRESSURE_N_RESOURCES; i++) {
+                double percent;
+                int    threshold;
 
-        /* Keep track of app autostart condition in order to react
-         * accordingly in the future. */
-        g_signal_connect (app,
-                          "condition-changed",
-                          G_CALLBACK (app_condition_changed),
-                          manager);
+                percent = gsm_pressure_get_percent (before, sample, i);
+                threshold = g_settings_get_int (priv->settings_session, keys[i]);
 
-        if (gsm_app_peek_is_disabled (app)
-            || gsm_app_peek_is_conditionally_disabled (app)) {
-                g_debug ("GsmManager: Skipping disabled app: %s", id);
-                goto out;
+                if (percent >= threshold) {
+                        g_debug ("GsmManager: %s pressure at %.1f%%, holding back applications",
+                                 gsm_pressure_get_name (i), percent);
+                        return FALSE;
+                }
         }
 
-        delay = gsm_app_peek_autostart_delay (app);
-        if (delay > 0) {
-                g_timeout_add_seconds (delay,
-                                       (GSourceFunc)_autostart_delay_timeout,
-                                       g_object_ref (app));
-                g_debug ("GsmManager: %s is scheduled to start in %d seconds", id, delay);
-                goto out;
+        return TRUE;
+}
+
+static gboolean
+on_throttle_timeout (GsmManager *manager)
+{
+        GsmManagerPrivate *priv;
+        GsmPressureSample  sample;
+        ThrottledApp      *throttled;
+        gboolean           admit;
+        int                max_wait;
+        int                i;
+
+        priv = gsm_manager_get_instance_private (manager);
+
+        throttled = g_queue_peek_head (priv->throttled_apps);
+        if (throttled == NULL || priv->phase >= GSM_MANAGER_PHASE_QUERY_END_SESSION) {
+                g_queue_free_full (priv->throttled_apps, (GDestroyNotify)throttled_app_free);
+                priv->throttled_apps = g_queue_new ();
+                priv->throttle_id = 0;
+                return FALSE;
         }
 
-        error = NULL;
-        res = gsm_app_start (app, &error);
-        if (!res) {
-                if (error != NULL) {
-                        g_warning ("Could not launch application '%s': %s",
-                                   gsm_app_peek_app_id (app),
-                                   error->message);
-                        g_error_free (error);
-                        error = NULL;
+        /* without pressure information there is nothing to pace on:
+         * start all that is queued */
+        if (!gsm_pressure_sample (&sample)) {
+                while ((throttled = g_queue_pop_head (priv->throttled_apps)) != NULL) {
+                        launch_app (throttled->app);
+                        throttled_app_free (throttled);
                 }
-                goto out;
+                priv->throttle_id = 0;
+                return FALSE;
+        }
+
+        admit = pressure_is_low (manager, &priv->last_pressure, &sample);
+        priv->last_pressure = sample;
+
+        /* a low sample only says the system coped with what was started
+         * so far: admit a small batch and look again */
+        if (admit) {
+                for (i = 0; i < GSM_MANAGER_PRESSURE_BATCH; i++) {
+                        throttled = g_queue_pop_head (priv->throttled_apps);
+                        if (throttled == NULL) {
+                                break;
+                        }
+                        launch_app (throttled->app);
+                        throttled_app_free (throttled);
+                }
+                return TRUE;
+        }
+
+        /* under pressure, apps that waited too long go one at a time, so
+         * that the next sample sees their effect */
+        max_wait = g_settings_get_int (priv->settings_session, KEY_PRESSURE_MAX_WAIT);
+        if (g_get_monotonic_time () - throttled->queued_time >= (gint64) max_wait * G_USEC_PER_SEC) {
+                g_debug ("GsmManager: %s waited %d seconds, starting it anyway",
+                         gsm_app_peek_app_id (throttled->app), max_wait);
+                g_queue_pop_head (priv->throttled_apps);
+                launch_app (throttled->app);
+                throttled_app_free (throttled);
+        }
+
+        return TRUE;
+}
+
+static gboolean
+pressure_throttling_is_enabled (GsmManager *manager)
+{
+        GsmManagerPrivate *priv;
+
+        priv = gsm_manager_get_instance_private (manager);
+
+        return g_settings_get_boolean (priv->settings_session, KEY_PRESSURE_THROTTLING);
+}
+
+/* Queues a non critical app to be started once the system is not under
+ * CPU, I/O or memory pressure anymore.
+ */
+static void
+throttle_app_start (GsmManager *manager,
+                    GsmApp     *app)
+{
+        GsmManagerPrivate *priv;
+        ThrottledApp      *throttled;
+
+        priv = gsm_manager_get_instance_private (manager);
+
+        if (priv->throttle_id == 0) {
+                if (! gsm_pressure_sample (&priv->last_pressure)) {
+                        g_debug ("GsmManager: no pressure information available, not throttling");
+                        launch_app (app);
+                        return;
+                }
+
+                priv->throttle_id = g_timeout_add (GSM_MANAGER_PRESSURE_INTERVAL,
+                                                   (GSourceFunc)on_throttle_timeout,
+                                                   manager);
+        }
+
+        g_debug ("GsmManager: queueing %s until pressure is low", gsm_app_peek_app_id (app));
+
+        throttled = g_new0 (ThrottledApp, 1);
+        throttled->app = g_object_ref (app);
+        throttled->queued_time = g_get_monotonic_time ();
+        g_queue_push_tail (priv->throttled_apps, throttled);
+}
+
+static gboolean
+_autostart_delay_timeout (GsmApp *app)
+{
+        if (manager_object != NULL
+            && pressure_throttling_is_enabled (GSM_MANAGER (manager_object))) {
+                throttle_app_start (GSM_MANAGER (manager_object), app);
+        } else {
+                launch_app (app);
+        }
+
+        g_object_unref (app);
+
+        return FALSE;
+}
+
+typedef struct {
+        GsmManager *manager;
+        GsmApp     *app;
+        char       *bus_name;
+        guint       owner_id;
+        guint       watch_id;
+        guint       timeout_id;
+        GQueue     *held_calls;
+        gboolean    started;
+} OnDemandApp;
+
+static void
+reply_with_error (GDBusConnection *connection,
+                  GDBusMessage    *call,
+                  const char      *error_name,
+                  const char      *message)
+{
+        GDBusMessage *reply;
+
+        if (g_dbus_message_get_flags (call) & G_DBUS_MESSAGE_FLAGS_NO_REPLY_EXPECTED) {
+                return;
+        }
+
+        reply = g_dbus_message_new_method_error_literal (call, error_name, message);
+        g_dbus_connection_send_message (connection, reply, G_DBUS_SEND_MESSAGE_FLAGS_NONE, NULL, NULL);
+        g_object_unref (reply);
+}
+
+static void
+on_demand_app_free (OnDemandApp *on_demand)
+{
+        GsmManagerPrivate *priv;
+        GDBusMessage      *call;
+
+        priv = gsm_manager_get_instance_private (on_demand->manager);
+
+        while ((call = g_queue_pop_head (on_demand->held_calls)) != NULL) {
+                reply_with_error (priv->on_demand_connection,
+                                  call,
+                                  "org.freedesktop.DBus.Error.ServiceUnknown",
+                                  "The application providing this name is not available");
+                g_object_unref (call);
+        }
+
+        if (on_demand->owner_id > 0) {
+                g_bus_unown_name (on_demand->owner_id);
+        }
+        if (on_demand->watch_id > 0) {
+                g_bus_unwatch_name (on_demand->watch_id);
+        }
+        if (on_demand->timeout_id > 0) {
+                g_source_remove (on_demand->timeout_id);
+        }
+
+        g_queue_free (on_demand->held_calls);
+        g_object_unref (on_demand->app);
+        g_free (on_demand->bus_name);
+        g_free (on_demand);
+}
+
+static void
+on_demand_app_forget (OnDemandApp *on_demand)
+{
+        GsmManagerPrivate *priv;
+
+        priv = gsm_manager_get_instance_private (on_demand->manager);
+
+        priv->on_demand_apps = g_slist_remove (priv->on_demand_apps, on_demand);
+        on_demand_app_free (on_demand);
+}
+
+static OnDemandApp *
+find_on_demand_app (GsmManager *manager,
+                    const char *bus_name)
+{
+        GsmManagerPrivate *priv;
+        GSList            *l;
+
+        priv = gsm_manager_get_instance_private (manager);
+
+        for (l = priv->on_demand_apps; l != NULL; l = l->next) {
+                OnDemandApp *on_demand = l->data;
+
+                if (g_strcmp0 (on_demand->bus_name, bus_name) == 0) {
+                        return on_demand;
+                }
+        }
+
+        return NULL;
+}
+
+static void
+on_demand_name_appeared (GDBusConnection *connection,
+                         const char      *name,
+                         const char      *name_owner,
+                         OnDemandApp     *on_demand)
+{
+        GDBusMessage *call;
+
+        /* our own release of the name may not have gone through yet */
+        if (g_strcmp0 (name_owner, g_dbus_connection_get_unique_name (connection)) == 0) {
+                return;
+        }
+
+        g_debug ("GsmManager: %s now owns %s, answering %u held calls",
+                 gsm_app_peek_app_id (on_demand->app),
+                 name,
+                 g_queue_get_length (on_demand->held_calls));
+
+        /* passing the calls on from this connection would make them
+         * come from us rather than from the caller, which breaks any
+         * check the app does on the sender; have the callers send them
+         * again, this time to the app */
+        while ((call = g_queue_pop_head (on_demand->held_calls)) != NULL) {
+                reply_with_error (connection,
+                                  call,
+                                  "org.freedesktop.DBus.Error.ServiceUnknown",
+                                  "The application providing this name has just been started, try again");
+                g_object_unref (call);
+        }
+
+        on_demand_app_forget (on_demand);
+}
+
+static gboolean
+on_demand_name_timeout (OnDemandApp *on_demand)
+{
+        g_warning ("Application '%s' did not take the bus name %s",
+                   gsm_app_peek_app_id (on_demand->app),
+                   on_demand->bus_name);
+
+        on_demand->timeout_id = 0;
+        on_demand_app_forget (on_demand);
+
+        return FALSE;
+}
+
+static void
+start_on_demand_app (OnDemandApp *on_demand,
+                     gboolean     requested)
+{
+        GsmManagerPrivate *priv;
+
+        priv = gsm_manager_get_instance_private (on_demand->manager);
+
+        if (on_demand->started) {
+                return;
+        }
+        on_demand->started = TRUE;
+
+        g_debug ("GsmManager: starting on demand app %s (%s)",
+                 gsm_app_peek_app_id (on_demand->app),
+                 requested ? "requested" : "session idle");
+
+        if (on_demand->owner_id == 0) {
+                if (pressure_throttling_is_enabled (on_demand->manager)) {
+                        throttle_app_start (on_demand->manager, on_demand->app);
+                } else {
+                        launch_app (on_demand->app);
+                }
+                on_demand_app_forget (on_demand);
+                return;
+        }
+
+        /* hand the name over, and keep whatever was sent to it until
+         * the app has picked it up */
+        g_bus_unown_name (on_demand->owner_id);
+        on_demand->owner_id = 0;
+
+        on_demand->watch_id = g_bus_watch_name_on_connection (priv->on_demand_connection,
+                                                              on_demand->bus_name,
+                                                              G_BUS_NAME_WATCHER_FLAGS_NONE,
+                                                              (GBusNameAppearedCallback)on_demand_name_appeared,
+                                                              NULL,
+                                                              on_demand,
+                                                              NULL);
+        on_demand->timeout_id = g_timeout_add_seconds (GSM_MANAGER_ON_DEMAND_NAME_TIMEOUT,
+                                                       (GSourceFunc)on_demand_name_timeout,
+                                                       on_demand);
+
+        if (requested || !pressure_throttling_is_enabled (on_demand->manager)) {
+                launch_app (on_demand->app);
+        } else {
+                throttle_app_start (on_demand->manager, on_demand->app);
+        }
+}
+
+static gboolean
+on_demand_call_received (GDBusMessage *call)
+{
+        GsmManager        *manager;
+        GsmManagerPrivate *priv;
+        OnDemandApp       *on_demand;
+
+        if (manager_object == NULL) {
+                return FALSE;
+        }
+
+        manager = GSM_MANAGER (manager_object);
+        priv = gsm_manager_get_instance_private (manager);
+
+        on_demand = find_on_demand_app (manager, g_dbus_message_get_destination (call));
+        if (on_demand == NULL || priv->phase >= GSM_MANAGER_PHASE_QUERY_END_SESSION) {
+                reply_with_error (priv->on_demand_connection,
+                                  call,
+                                  "org.freedesktop.DBus.Error.ServiceUnknown",
+                                  "The application providing this name is not available");
+                return FALSE;
+        }
+
+        g_queue_push_tail (on_demand->held_calls, g_object_ref (call));
+        start_on_demand_app (on_demand, TRUE);
+
+        return FALSE;
+}
+
+/* Runs in the GDBus worker thread: calls to one of the names we keep
+ * for on demand apps are taken off the connection and dealt with from
+ * the main loop.
+ */
+static GDBusMessage *
+on_demand_filter (GDBusConnection *connection,
+                  GDBusMessage    *message,
+                  gboolean         incoming,
+                  gpointer         user_data)
+{
+        const char *destination;
+
+        if (!incoming
+            || g_dbus_message_get_message_type (message) != G_DBUS_MESSAGE_TYPE_METHOD_CALL) {
+                return message;
+        }
+
+        destination = g_dbus_message_get_destination (message);
+        if (destination == NULL || destination[0] == ':') {
+                return message;
+        }
+
+        g_idle_add_full (G_PRIORITY_DEFAULT,
+                         (GSourceFunc)on_demand_call_received,
+                         message,
+                         g_object_unref);
+
+        return NULL;
+}
+
+static GDBusConnection *
+get_on_demand_connection (GsmManager *manager)
+{
+        GsmManagerPrivate *priv;
+        char              *address;
+        GError            *error;
+
+        priv = gsm_manager_get_instance_private (manager);
+
+        if (priv->on_demand_connection != NULL) {
+                return priv->on_demand_connection;
+        }
+
+        /* a connection of its own, so that everything addressed to it
+         * by name is for an on demand app */
+        error = NULL;
+        address = g_dbus_address_get_for_bus_sync (G_BUS_TYPE_SESSION, NULL, &error);
+        if (address != NULL) {
+                priv->on_demand_connection = g_dbus_connection_new_for_address_sync (address,
+                                                                                     G_DBUS_CONNECTION_FLAGS_AUTHENTICATION_CLIENT |
+                                                                                     G_DBUS_CONNECTION_FLAGS_MESSAGE_BUS_CONNECTION,
+                                                                                     NULL,
+                                                                                     NULL,
+                                                                                     &error);
+                g_free (address);
+        }
+
+        if (priv->on_demand_connection == NULL) {
+                g_warning ("Unable to connect to the session bus for on demand applications: %s",
+                           error->message);
+                g_error_free (error);
+                return NULL;
+        }
+
+        g_dbus_connection_add_filter (priv->on_demand_connection,
+                                      on_demand_filter,
+                                      NULL,
+                                      NULL);
+
+        return priv->on_demand_connection;
+}
+
+static void
+on_demand_name_lost (GDBusConnection *connection,
+                     const char      *name,
+                     OnDemandApp     *on_demand)
+{
+        if (on_demand->owner_id == 0) {
+                return;
+        }
+
+        /* somebody else provides it, the app will only be started
+         * once the session is idle */
+        g_debug ("GsmManager: could not keep %s for %s", name,
+                 gsm_app_peek_app_id (on_demand->app));
+
+        g_bus_unown_name (on_demand->owner_id);
+        on_demand->owner_id = 0;
+}
+
+/* Defers an app until the session has been running quietly for a
+ * while, or until something calls the bus name it declared.
+ */
+static void
+defer_app_start (GsmManager *manager,
+                 GsmApp     *app)
+{
+        GsmManagerPrivate *priv;
+        OnDemandApp       *on_demand;
+        GDBusConnection   *connection;
+        const char        *bus_name;
+
+        priv = gsm_manager_get_instance_private (manager);
+
+        on_demand = g_new0 (OnDemandApp, 1);
+        on_demand->manager = manager;
+        on_demand->app = g_object_ref (app);
+        on_demand->held_calls = g_queue_new ();
+
+        bus_name = gsm_app_peek_on_demand_bus_name (app);
+        if (bus_name != NULL) {
+                connection = get_on_demand_connection (manager);
+        } else {
+                connection = NULL;
+        }
+
+        if (connection != NULL) {
+                on_demand->bus_name = g_strdup (bus_name);
+                on_demand->owner_id = g_bus_own_name_on_connection (connection,
+                                                                    bus_name,
+                                                                    G_BUS_NAME_OWNER_FLAGS_ALLOW_REPLACEMENT,
+                                                                    NULL,
+                                                                    (GBusNameLostCallback)on_demand_name_lost,
+                                                                    on_demand,
+                                                                    NULL);
+        }
+
+        g_debug ("GsmManager: %s will be started on demand", gsm_app_peek_app_id (app));
+
+        priv->on_demand_apps = g_slist_prepend (priv->on_demand_apps, on_demand);
+}
+
+/* The session is quiet when nothing is waiting for the pressure to go
+ * down and the pressure stayed low since the previous check.
+ */
+static gboolean
+session_is_quiet (GsmManager *manager)
+{
+        GsmManagerPrivate *priv;
+        GsmPressureSample  sample;
+        gboolean           quiet;
+
+        priv = gsm_manager_get_instance_private (manager);
+
+        if (!g_queue_is_empty (priv->throttled_apps)) {
+                priv->on_demand_pressure.time = 0;
+                return FALSE;
+        }
+
+        /* no way to tell, don't hold the apps back forever */
+        if (!gsm_pressure_sample (&sample)) {
+                return TRUE;
+        }
+
+        quiet = priv->on_demand_pressure.time != 0
+                && pressure_is_low (manager, &priv->on_demand_pressure, &sample);
+        priv->on_demand_pressure = sample;
+
+        return quiet;
+}
+
+static gboolean
+on_on_demand_timeout (GsmManager *manager)
+{
+        GsmManagerPrivate *priv;
+        GSList            *apps;
+        GSList            *l;
+
+        priv = gsm_manager_get_instance_private (manager);
+
+        if (priv->phase != GSM_MANAGER_PHASE_RUNNING) {
+                priv->on_demand_id = 0;
+                return FALSE;
+        }
+
+        if (!session_is_quiet (manager)) {
+                g_debug ("GsmManager: session busy, holding back on demand apps");
+                priv->on_demand_id = g_timeout_add_seconds (GSM_MANAGER_ON_DEMAND_IDLE_CHECK,
+                                                            (GSourceFunc)on_on_demand_timeout,
+                                                            manager);
+                return FALSE;
+        }
+
+        priv->on_demand_id = 0;
+
+        /* starting may drop the app from the list */
+        apps = g_slist_copy (priv->on_demand_apps);
+        for (l = apps; l != NULL; l = l->next) {
+                start_on_demand_app (l->data, FALSE);
+        }
+        g_slist_free (apps);
+
+        return FALSE;
+}
+
+static void
+schedule_on_demand_apps (GsmManager *manager)
+{
+        GsmManagerPrivate *priv;
+
+        priv = gsm_manager_get_instance_private (manager);
+
+        if (priv->on_demand_apps == NULL || priv->on_demand_id > 0) {
+                return;
+        }
+
+        priv->on_demand_id = g_timeout_add_seconds (g_settings_get_int (priv->settings_session,
+                                                                        KEY_ON_DEMAND_DELAY),
+                                                    (GSourceFunc)on_on_demand_timeout,
+                                                    manager);
+}
+
+/* The components the desktop is built from get the machine first; the
+ * rest waits in the background until the session is running.
+ */
+static GsmAppPriority
+startup_priority_for_app (GsmManager *manager,
+                          gboolean    delayed)
+{
+        GsmManagerPrivate *priv;
+
+        priv = gsm_manager_get_instance_private (manager);
+
+        if (delayed) {
+                return GSM_APP_PRIORITY_LOW;
+        }
+
+        switch (priv->phase) {
+        case GSM_MANAGER_PHASE_INITIALIZATION:
+        case GSM_MANAGER_PHASE_WINDOW_MANAGER:
+        case GSM_MANAGER_PHASE_PANEL:
+                return GSM_APP_PRIORITY_HIGH;
+        case GSM_MANAGER_PHASE_APPLICATION:
+                return GSM_APP_PRIORITY_LOW;
+        default:
+                return GSM_APP_PRIORITY_NORMAL;
+        }
+}
+
+static gboolean
+_app_restore_priority (const char *id,
+                       GsmApp     *app,
+                       gpointer    user_data)
+{
+        gsm_app_set_priority (app, GSM_APP_PRIORITY_NORMAL);
+
+        return FALSE;
+}
+
+static gboolean
+_app_collect_pid (const char *id,
+                  GsmApp     *app,
+                  GArray     *pids)
+{
+        GPid pid;
+
+        if (!GSM_IS_AUTOSTART_APP (app)) {
+                return FALSE;
+        }
+
+        pid = gsm_autostart_app_peek_pid (GSM_AUTOSTART_APP (app));
+        if (pid > 0) {
+                g_array_append_val (pids, pid);
+        }
+
+        return FALSE;
+}
+
+static gboolean
+on_readahead_timeout (GsmManager *manager)
+{
+        GsmManagerPrivate *priv;
+        GArray            *pids;
+
+        priv = gsm_manager_get_instance_private (manager);
+
+        priv->readahead_id = 0;
+
+        if (priv->phase != GSM_MANAGER_PHASE_RUNNING) {
+                return FALSE;
+        }
+
+        pids = g_array_new (FALSE, FALSE, sizeof (GPid));
+        gsm_store_foreach (priv->apps,
+                           (GsmStoreFunc)_app_collect_pid,
+                           pids);
+        gsm_readahead_record (pids);
+        g_array_free (pids, TRUE);
+
+        return FALSE;
+}
+
+static void
+schedule_readahead_recording (GsmManager *manager)
+{
+        GsmManagerPrivate *priv;
+
+        priv = gsm_manager_get_instance_private (manager);
+
+        if (!g_settings_get_boolean (priv->settings_session, KEY_READAHEAD)) {
+                gsm_readahead_discard ();
+                return;
+        }
+
+        if (priv->readahead_id == 0) {
+                priv->readahead_id = g_timeout_add_seconds (GSM_MANAGER_READAHEAD_DELAY,
+                                                            (GSourceFunc)on_readahead_timeout,
+                                                            manager);
+        }
+}
+
+static gboolean
+_start_app (const char *id,
+            GsmApp     *app,
+            GsmManager *manager)
+{
+        GError  *error;
+        gboolean res;
+        int      delay;
+        GsmManagerPrivate *priv;
+
+        priv = gsm_manager_get_instance_private (manager);
+
+        if (gsm_app_peek_phase (app) != priv->phase) {
+                goto out;
+        }
+
+        /* Keep track of app autostart condition in order to react
+         * accordingly in the future. */
+        g_signal_connect (app,
+                          "condition-changed",
+                          G_CALLBACK (app_condition_changed),
+                          manager);
+
+        if (gsm_app_peek_is_disabled (app)
+            || gsm_app_peek_is_conditionally_disabled (app)) {
+                g_debug ("GsmManager: Skipping disabled app: %s", id);
+                goto out;
+        }
+
+        if (gsm_app_peek_is_on_demand (app)) {
+                defer_app_start (manager, app);
+                goto out;
         }
 
+        delay = gsm_app_peek_autostart_delay (app);
+
+        if (g_settings_get_boolean (priv->settings_session, KEY_STARTUP_PRIORITIES)) {
+                gsm_app_set_priority (app, startup_priority_for_app (manager, delay > 0));
+        }
+
+        if (delay > 0) {
+                g_timeout_add_seconds (delay,
+                                       (GSourceFunc)_autostart_delay_timeout,
+                                       g_object_ref (app));
+                g_debug ("GsmManager: %s is scheduled to start in %d seconds", id, delay);
+                goto out;
+        }
+
+        if (priv->phase == GSM_MANAGER_PHASE_APPLICATION
+            && pressure_throttling_is_enabled (manager)) {
+                throttle_app_start (manager, app);
+                goto out;
+        }
+
+        error = NULL;
+        res = gsm_app_start (app, &error);
+        if (!res) {
+                gsm_metrics_increment (GSM_METRIC_APP_START_FAILURES);
+                if (error != NULL) {
+                        g_warning ("Could not launch application '%s': %s",
+                                   gsm_app_peek_app_id (app),
+                                   error->message);
+                        g_error_free (error);
+                        error = NULL;
+                }
+                goto out;
+        }
+
+        gsm_metrics_increment (GSM_METRIC_APPS_STARTED);
+
         if (priv->phase < GSM_MANAGER_PHASE_APPLICATION) {
+                track_pending_start (manager, app);
                 g_signal_connect (app,
                                   "exited",
                                   G_CALLBACK (app_registered),
@@ -745,21 +1916,106 @@ _start_app (const char *id,
         return FALSE;
 }
 
+typedef struct {
+        GsmManager *manager;
+        GSList     *apps;
+} PhaseAppsData;
+
+static gboolean
+_collect_phase_app (const char    *id,
+                    GsmApp        *app,
+                    PhaseAppsData *data)
+{
+        GsmManagerPrivate *priv;
+
+        priv = gsm_manager_get_instance_private (data->manager);
+
+        if (gsm_app_peek_phase (app) == priv->phase) {
+                data->apps = g_slist_prepend (data->apps, app);
+        }
+
+        return FALSE;
+}
+
+static gboolean
+app_blocks_phase (GsmApp *app)
+{
+        return gsm_app_peek_autostart_delay (app) <= 0
+                && !gsm_app_peek_is_on_demand (app);
+}
+
+/* The apps the phase waits on go first, slowest first, so that the
+ * ones that take longest to get ready are not also the last to start.
+ * Apps we know nothing about yet might be slow too.
+ */
+static int
+compare_app_start_order (GsmApp     *a,
+                         GsmApp     *b,
+                         GsmManager *manager)
+{
+        GsmManagerPrivate *priv;
+        gboolean           blocks_a;
+        gboolean           blocks_b;
+        gint64             time_a;
+        gint64             time_b;
+
+        priv = gsm_manager_get_instance_private (manager);
+
+        blocks_a = app_blocks_phase (a);
+        blocks_b = app_blocks_phase (b);
+        if (blocks_a != blocks_b) {
+                return blocks_a ? -1 : 1;
+        }
+
+        if (!gsm_startup_stats_lookup (priv->startup_stats, gsm_app_peek_app_id (a), &time_a, NULL)) {
+                time_a = G_MAXINT64;
+        }
+        if (!gsm_startup_stats_lookup (priv->startup_stats, gsm_app_peek_app_id (b), &time_b, NULL)) {
+                time_b = G_MAXINT64;
+        }
+        if (time_a != time_b) {
+                return time_a > time_b ? -1 : 1;
+        }
+
+        return g_strcmp0 (gsm_app_peek_app_id (a), gsm_app_peek_app_id (b));
+}
+
 static void
 do_phase_startup (GsmManager *manager)
 {
         GsmManagerPrivate *priv;
+        PhaseAppsData      data;
+        GSList            *l;
 
         priv = gsm_manager_get_instance_private (manager);
+
+        data.manager = manager;
+        data.apps = NULL;
         gsm_store_foreach (priv->apps,
-                           (GsmStoreFunc)_start_app,
-                           manager);
+                           (GsmStoreFunc)_collect_phase_app,
+                           &data);
+
+        data.apps = g_slist_sort_with_data (data.apps,
+                                            (GCompareDataFunc)compare_app_start_order,
+                                            manager);
+        for (l = data.apps; l != NULL; l = l->next) {
+                _start_app (gsm_app_peek_id (l->data), l->data, manager);
+        }
+        g_slist_free (data.apps);
 
         if (priv->pending_apps != NULL) {
                 if (priv->phase < GSM_MANAGER_PHASE_APPLICATION) {
-                        priv->phase_timeout_id = g_timeout_add_seconds (GSM_MANAGER_PHASE_TIMEOUT,
-                                                                        (GSourceFunc)on_phase_timeout,
-                                                                        manager);
+                        /* every app has its own deadline, this only
+                         * catches what falls through the cracks */
+                        priv->phase_timeout_id = g_timeout_add (priv->phase_deadline / 1000 + 1000,
+                                                                (GSourceFunc)on_phase_timeout,
+                                                                manager);
+
+                        /* something may already be up, e.g. a window
+                         * manager started before the session */
+                        if (priv->window_watcher != NULL && phase_waits_for_windows (manager)) {
+                                gsm_window_watcher_check (priv->window_watcher);
+                        }
                 }
         } else {
                 end_phase (manager);
@@ -938,23 +2194,215 @@ maybe_restart_user_bus (GsmManager *manager)
 }
 #endif
 
+static double
+exit_phase_elapsed (GsmManager *manager)
+{
+        GsmManagerPrivate *priv;
+
+        priv = gsm_manager_get_instance_private (manager);
+
+        return (double) (g_get_monotonic_time () - priv->exit_start_time) / G_USEC_PER_SEC;
+}
+
+static gboolean
+_app_is_running (const char *id,
+                 GsmApp     *app,
+                 gpointer    user_data)
+{
+        return gsm_app_is_running (app);
+}
+
+static gboolean
+exit_phase_is_done (GsmManager *manager)
+{
+        GsmManagerPrivate *priv;
+
+        priv = gsm_manager_get_instance_private (manager);
+
+        if (gsm_store_size (priv->clients) > 0) {
+                return FALSE;
+        }
+
+        return gsm_store_find (priv->apps,
+                               (GsmStoreFunc)_app_is_running,
+                               NULL) == NULL;
+}
+
+static void
+maybe_end_exit_phase (GsmManager *manager)
+{
+        GsmManagerPrivate *priv;
+
+        priv = gsm_manager_get_instance_private (manager);
+
+        if (priv->phase != GSM_MANAGER_PHASE_EXIT
+            || ! exit_phase_is_done (manager)) {
+                return;
+        }
+
+        g_debug ("GsmManager: all clients and applications stopped after %.3f seconds",
+                 exit_phase_elapsed (manager));
+
+        end_phase (manager);
+}
+
+static void
+on_app_stopped (GsmApp     *app,
+                GsmManager *manager)
+{
+        g_signal_handlers_disconnect_by_func (app, on_app_stopped, manager);
+
+        g_debug ("GsmManager: application %s stopped after %.3f seconds",
+                 gsm_app_peek_app_id (app),
+                 exit_phase_elapsed (manager));
+
+        maybe_end_exit_phase (manager);
+}
+
+static gboolean
+_app_stop (const char *id,
+           GsmApp     *app,
+           GsmManager *manager)
+{
+        GsmManagerPrivate *priv;
+        const char        *startup_id;
+        GError            *error;
+
+        priv = gsm_manager_get_instance_private (manager);
+
+        if (! gsm_app_is_running (app)) {
+                return FALSE;
+        }
+
+        g_signal_connect (app,
+                          "exited",
+                          G_CALLBACK (on_app_stopped),
+                          manager);
+        g_signal_connect (app,
+                          "died",
+                          G_CALLBACK (on_app_stopped),
+                          manager);
+
+        /* Apps that registered a client were already asked to go away
+         * through it; give them the grace period to do so cleanly. */
+        startup_id = gsm_app_peek_startup_id (app);
+        if (! IS_STRING_EMPTY (startup_id)
+            && gsm_store_find (priv->clients,
+                               (GsmStoreFunc)_client_has_startup_id,
+                               (gpointer)startup_id) != NULL) {
+                return FALSE;
+        }
+
+        error = NULL;
+        if (! gsm_app_stop (app, &error)) {
+                g_warning ("Unable to stop application '%s': %s",
+                           gsm_app_peek_app_id (app),
+                           error->message);
+                g_error_free (error);
+        } else {
+                g_debug ("GsmManager: stopped application: %s", gsm_app_peek_app_id (app));
+        }
+
+        return FALSE;
+}
+
+static gboolean
+_app_kill (const char *id,
+           GsmApp     *app,
+           GsmManager *manager)
+{
+        GError *error;
+
+        if (! gsm_app_is_running (app)) {
+                return FALSE;
+        }
+
+        g_warning ("Application '%s' did not exit %.3f seconds after the end of the session, killing it",
+                   gsm_app_peek_app_id (app),
+                   exit_phase_elapsed (manager));
+
+        g_signal_handlers_disconnect_by_func (app, on_app_stopped, manager);
+
+        error = NULL;
+        if (! gsm_app_kill (app, &error)) {
+                g_warning ("Unable to kill application '%s': %s",
+                           gsm_app_peek_app_id (app),
+                           error->message);
+                g_error_free (error);
+        }
+
+        return FALSE;
+}
+
+static gboolean
+_client_log_holdout (const char *id,
+                     GsmClient  *client,
+                     GsmManager *manager)
+{
+        g_warning ("Client '%s' did not disconnect %.3f seconds after the end of the session",
+                   gsm_client_peek_id (client),
+                   exit_phase_elapsed (manager));
+
+        return FALSE;
+}
+
+static void
+kill_exit_phase_holdouts (GsmManager *manager)
+{
+        GsmManagerPrivate *priv;
+
+        priv = gsm_manager_get_instance_private (manager);
+
+        /* We only send SIGKILL to processes we spawned ourselves; the pid
+         * a client reports about itself is not trustworthy enough. */
+        gsm_store_foreach (priv->clients,
+                           (GsmStoreFunc)_client_log_holdout,
+                           manager);
+        gsm_store_foreach (priv->apps,
+                           (GsmStoreFunc)_app_kill,
+                           manager);
+}
+
 static void
 do_phase_exit (GsmManager *manager)
 {
         GsmManagerPrivate *priv;
+        int                grace_period;
 
         priv = gsm_manager_get_instance_private (manager);
+        priv->exit_start_time = g_get_monotonic_time ();
+
+        /* Ask everything to go away at once, and only then wait */
         if (gsm_store_size (priv->clients) > 0) {
                 gsm_store_foreach (priv->clients,
                                    (GsmStoreFunc)_client_stop,
                                    NULL);
         }
+        gsm_store_foreach (priv->apps,
+                           (GsmStoreFunc)_app_stop,
+                           manager);
 
 #ifdef HAVE_SYSTEMD
         maybe_restart_user_bus (manager);
 #endif
 
-        end_phase (manager);
+        if (exit_phase_is_done (manager)) {
+                end_phase (manager);
+                return;
+        }
+
+        /* In the exit phase, all apps were already given the chance to
+         * inhibit the session end. At that stage we don't want to wait
+         * much for apps to respond, we want to exit, and fast.
+         */
+        grace_period = g_settings_get_int (priv->settings_session, KEY_EXIT_GRACE_PERIOD);
+
+        g_debug ("GsmManager: waiting up to %d seconds for clients and applications to exit",
+                 grace_period);
+
+        priv->phase_timeout_id = g_timeout_add_seconds (grace_period,
+                                                        (GSourceFunc)on_phase_timeout,
+                                                        manager);
 }
 
 static gboolean
@@ -982,6 +2430,91 @@ _client_query_end_session (const char           *id,
         return FALSE;
 }
 
+static gboolean
+_inhibitor_collect_flags (const char   *id,
+                          GsmInhibitor *inhibitor,
+                          guint        *flags)
+{
+        *flags |= gsm_inhibitor_peek_flags (inhibitor);
+
+        return FALSE;
+}
+
+static void
+update_state_page_inhibitors (GsmManager *manager)
+{
+        GsmManagerPrivate *priv;
+        guint              flags;
+
+        priv = gsm_manager_get_instance_private (manager);
+
+        if (priv->state_page == NULL) {
+                return;
+        }
+
+        flags = 0;
+        gsm_store_foreach (priv->inhibitors,
+                           (GsmStoreFunc)_inhibitor_collect_flags,
+                           &flags);
+        gsm_state_page_set_inhibitors (priv->state_page,
+                                       gsm_store_size (priv->inhibitors),
+                                       flags);
+}
+
+static void
+update_state_page_clients (GsmManager *manager)
+{
+        GsmManagerPrivate *priv;
+
+        priv = gsm_manager_get_instance_private (manager);
+
+        gsm_state_page_set_n_clients (priv->state_page,
+                                      gsm_store_size (priv->clients));
+}
+
+static gboolean
+_inhibitor_count_flags (const char   *id,
+                        GsmInhibitor *inhibitor,
+                        guint        *counts)
+{
+        guint flags;
+
+        flags = gsm_inhibitor_peek_flags (inhibitor);
+
+        if (flags & GSM_INHIBITOR_FLAG_LOGOUT) {
+                counts[GSM_METRIC_INHIBITORS_LOGOUT]++;
+        }
+        if (flags & GSM_INHIBITOR_FLAG_SWITCH_USER) {
+                counts[GSM_METRIC_INHIBITORS_SWITCH_USER]++;
+        }
+        if (flags & GSM_INHIBITOR_FLAG_SUSPEND) {
+                counts[GSM_METRIC_INHIBITORS_SUSPEND]++;
+        }
+        if (flags & GSM_INHIBITOR_FLAG_IDLE) {
+                counts[GSM_METRIC_INHIBITORS_IDLE]++;
+        }
+
+        return FALSE;
+}
+
+static void
+update_inhibitor_metrics (GsmManager *manager)
+{
+        GsmManagerPrivate *priv;
+        guint              counts[GSM_METRIC_N_GAUGES] = { 0 };
+        guint              i;
+
+        priv = gsm_manager_get_instance_private (manager);
+
+        gsm_store_foreach (priv->inhibitors,
+                           (GsmStoreFunc)_inhibitor_count_flags,
+                           counts);
+
+        for (i = GSM_METRIC_INHIBITORS_LOGOUT; i <= GSM_METRIC_INHIBITORS_IDLE; i++) {
+                gsm_metrics_set_gauge (i, counts[i]);
+        }
+}
+
 static gboolean
 inhibitor_has_flag (gpointer      key,
                     GsmInhibitor *inhibitor,
@@ -1224,39 +2757,246 @@ sleep_lock_is_enabled (GsmManager *manager)
                 return FALSE;
 }
 
+/* The command that locks the screen before sleeping, or NULL if it
+ * should not be locked */
+static gchar **
+get_sleep_lock_command (GsmManager *manager)
+{
+        gchar **screen_locker_command;
+
+        if ((screen_locker_command = gsm_get_screen_locker_command ()) == NULL) {
+                g_warning ("Couldn't find any screen locker");
+                return NULL;
+        }
+
+        /* only lock if mate-screensaver is set to lock */
+        if (!g_strcmp0 (screen_locker_command[0], "mate-screensaver-command") &&
+            !sleep_lock_is_enabled (manager)) {
+                g_strfreev (screen_locker_command);
+                return NULL;
+        }
+
+        return screen_locker_command;
+}
+
 static void
 manager_perhaps_lock (GsmManager *manager)
 {
         gchar **screen_locker_command;
+        GError *error = NULL;
 
-        if ((screen_locker_command = gsm_get_screen_locker_command ()) != NULL) {
-                GError *error = NULL;
+        if ((screen_locker_command = get_sleep_lock_command (manager)) == NULL) {
+                return;
+        }
 
-                /* only lock if mate-screensaver is set to lock */
-                if (!g_strcmp0 (screen_locker_command[0], "mate-screensaver-command") &&
-                    !sleep_lock_is_enabled (manager)) {
-                        goto clear_screen_locker_command;
-                }
+        /* do this sync to ensure it's on the screen when we start suspending */
+        g_spawn_sync (NULL, screen_locker_command, NULL,
+                      G_SPAWN_DEFAULT | G_SPAWN_SEARCH_PATH,
+                      NULL, NULL, NULL, NULL, NULL, &error);
 
-                /* do this sync to ensure it's on the screen when we start suspending */
-                g_spawn_sync (NULL, screen_locker_command, NULL,
-                              G_SPAWN_DEFAULT | G_SPAWN_SEARCH_PATH,
-                              NULL, NULL, NULL, NULL, NULL, &error);
+        if (error) {
+                g_warning ("Couldn't lock screen: %s", error->message);
+                g_error_free (error);
+        }
 
-                if (error) {
-                        g_warning ("Couldn't lock screen: %s", error->message);
-                        g_error_free (error);
-                }
+        g_strfreev (screen_locker_command);
+}
 
-        } else {
-                g_warning ("Couldn't find any screen locker");
+#ifdef HAVE_SYSTEMD
+/* While the session runs, logind is asked to delay sleep.  When it
+ * announces one, the screen is locked, the session saved and session
+ * clients told, all at once, and logind is let go as soon as the last
+ * of these is done. */
+static void
+sleep_step_done (GsmManager *manager)
+{
+        GsmManagerPrivate *priv;
+        GsmSystemd        *systemd;
+
+        priv = gsm_manager_get_instance_private (manager);
+
+        g_return_if_fail (priv->sleep_steps > 0);
+
+        priv->sleep_steps--;
+        if (priv->sleep_steps > 0) {
+                return;
+        }
+
+        g_debug ("GsmManager: ready for sleep");
+
+        systemd = gsm_get_systemd ();
+        gsm_systemd_release_sleep_delay (systemd);
+        g_object_unref (systemd);
+}
+
+typedef struct {
+        GsmManager *manager;
+        guint       generation;
+} SleepLock;
+
+static void
+on_sleep_lock_exited (GPid       pid,
+                      gint       status,
+                      SleepLock *lock)
+{
+        GsmManagerPrivate *priv;
+
+        priv = gsm_manager_get_instance_private (lock->manager);
+
+        g_spawn_close_pid (pid);
+
+        /* a locker that outlived logind's delay must not release the
+         * inhibitor taken again after waking up */
+        if (lock->generation == priv->sleep_generation) {
+                sleep_step_done (lock->manager);
+        }
+
+        g_free (lock);
+}
+
+static void
+lock_for_sleep (GsmManager *manager)
+{
+        GsmManagerPrivate *priv;
+        gchar            **screen_locker_command;
+        GError            *error;
+        GPid               pid;
+
+        priv = gsm_manager_get_instance_private (manager);
+
+        if ((screen_locker_command = get_sleep_lock_command (manager)) == NULL) {
+                return;
         }
 
-clear_screen_locker_command:
+        error = NULL;
+        if (g_spawn_async (NULL, screen_locker_command, NULL,
+                           G_SPAWN_SEARCH_PATH | G_SPAWN_DO_NOT_REAP_CHILD,
+                           NULL, NULL, &pid, &error)) {
+                SleepLock *lock;
+
+                lock = g_new0 (SleepLock, 1);
+                lock->manager = manager;
+                lock->generation = priv->sleep_generation;
+
+                priv->sleep_steps++;
+                g_child_watch_add (pid, (GChildWatchFunc)on_sleep_lock_exited, lock);
+        } else {
+                g_warning ("Couldn't lock screen: %s", error->message);
+                g_error_free (error);
+        }
 
         g_strfreev (screen_locker_command);
 }
 
+static void
+emit_prepare_for_sleep (GsmManager *manager,
+                        gboolean    start)
+{
+        DBusConnection *connection;
+        DBusMessage    *signal;
+        dbus_bool_t     value;
+
+        connection = get_bus_connection (manager);
+        if (connection == NULL) {
+                return;
+        }
+
+        signal = dbus_message_new_signal (GSM_MANAGER_DBUS_PATH,
+                                          GSM_MANAGER_SLEEP_DBUS_INTERFACE,
+                                          "PrepareForSleep");
+        if (signal == NULL) {
+                return;
+        }
+
+        value = start;
+        dbus_message_append_args (signal,
+                                  DBUS_TYPE_BOOLEAN, &value,
+                                  DBUS_TYPE_INVALID);
+        dbus_connection_send (connection, signal, NULL);
+        dbus_message_unref (signal);
+}
+
+static void
+on_prepare_for_sleep (GsmSystemd *systemd,
+                      gboolean    start,
+                      GsmManager *manager)
+{
+        GsmManagerPrivate *priv;
+
+        priv = gsm_manager_get_instance_private (manager);
+
+        emit_prepare_for_sleep (manager, start);
+
+        if (!start) {
+                g_debug ("GsmManager: woke up from sleep");
+                priv->sleep_steps = 0;
+                priv->sleep_generation++;
+                if (priv->phase == GSM_MANAGER_PHASE_RUNNING) {
+                        gsm_systemd_take_sleep_delay (systemd);
+                }
+                return;
+        }
+
+        /* without the delay, logind does not wait for us and whoever
+         * asked for the sleep locked the screen synchronously */
+        if (!gsm_systemd_has_sleep_delay (systemd)) {
+                return;
+        }
+
+        g_debug ("GsmManager: preparing for sleep");
+
+        /* held until every step has been started */
+        priv->sleep_steps++;
+
+        lock_for_sleep (manager);
+
+        if (auto_save_is_enabled (manager)) {
+                maybe_save_session (manager);
+        }
+
+        sleep_step_done (manager);
+}
+#endif
+
+static void
+start_sleep_pipeline (GsmManager *manager)
+{
+#ifdef HAVE_SYSTEMD
+        GsmSystemd *systemd;
+
+        if (!LOGIND_RUNNING()) {
+                return;
+        }
+
+        systemd = gsm_get_systemd ();
+        g_signal_connect (systemd,
+                          "prepare-for-sleep",
+                          G_CALLBACK (on_prepare_for_sleep),
+                          manager);
+        gsm_systemd_take_sleep_delay (systemd);
+        g_object_unref (systemd);
+#endif
+}
+
+static void
+stop_sleep_pipeline (GsmManager *manager)
+{
+#ifdef HAVE_SYSTEMD
+        GsmSystemd *systemd;
+
+        if (!LOGIND_RUNNING()) {
+                return;
+        }
+
+        systemd = gsm_get_systemd ();
+        g_signal_handlers_disconnect_by_func (systemd,
+                                              on_prepare_for_sleep,
+                                              manager);
+        gsm_systemd_release_sleep_delay (systemd);
+        g_object_unref (systemd);
+#endif
+}
+
 static void
 manager_attempt_hibernate (GsmManager *manager)
 {
@@ -1267,8 +3007,11 @@ manager_attempt_hibernate (GsmManager *manager)
 
                 systemd = gsm_get_systemd ();
 
-                /* lock the screen before we suspend */
-                manager_perhaps_lock (manager);
+                /* lock the screen before we suspend, unless it is done
+                 * once logind announces the sleep */
+                if (!gsm_systemd_has_sleep_delay (systemd)) {
+                        manager_perhaps_lock (manager);
+                }
 
                 gsm_systemd_attempt_hibernate (systemd);
         }
@@ -1299,8 +3042,11 @@ manager_attempt_suspend (GsmManager *manager)
 
                 systemd = gsm_get_systemd ();
 
-                /* lock the screen before we suspend */
-                manager_perhaps_lock (manager);
+                /* lock the screen before we suspend, unless it is done
+                 * once logind announces the sleep */
+                if (!gsm_systemd_has_sleep_delay (systemd)) {
+                        manager_perhaps_lock (manager);
+                }
 
                 gsm_systemd_attempt_suspend (systemd);
         }
@@ -1447,6 +3193,11 @@ query_end_session_complete (GsmManager *manager)
         priv->inhibit_dialog = gsm_inhibit_dialog_new (priv->inhibitors,
                                                        priv->clients,
                                                        action);
+        if (priv->inhibit_dialog == NULL) {
+                /* nobody can be asked, so the inhibitors win */
+                cancel_end_session (manager);
+                return;
+        }
 
         g_signal_connect (priv->inhibit_dialog,
                           "response",
@@ -1499,8 +3250,10 @@ _on_query_end_session_timeout (GsmManager *manager)
                 const char   *bus_name;
                 char         *app_id;
 
-                g_warning ("Client '%s' failed to reply before timeout",
-                           gsm_client_peek_id (l->data));
+                mdm_log_field (G_LOG_LEVEL_WARNING,
+                               "MATE_SESSION_CLIENT_ID", gsm_client_peek_id (l->data),
+                               "Client '%s' failed to reply before timeout",
+                               gsm_client_peek_id (l->data));
 
                 /* Don't add "not responding" inhibitors if logout is forced
                  */
@@ -1542,6 +3295,74 @@ _on_query_end_session_timeout (GsmManager *manager)
         return FALSE;
 }
 
+#ifdef HAVE_LIBCANBERRA
+#define SOUND_SCHEMA            "org.mate.sound"
+#define KEY_SOUND_EVENT_SOUNDS  "event-sounds"
+#define KEY_SOUND_THEME_NAME    "theme-name"
+
+static ca_context *
+get_sound_context (void)
+{
+        static ca_context       *context = NULL;
+        GSettingsSchemaSource   *source;
+        GSettingsSchema         *schema;
+        GSettings               *settings;
+        char                    *theme_name;
+
+        /* the Gtk context follows the xsettings, use it once it exists */
+        if (gsm_util_has_gtk ()) {
+                return ca_gtk_context_get ();
+        }
+
+        if (context != NULL) {
+                return context;
+        }
+
+        if (ca_context_create (&context) != CA_SUCCESS) {
+                context = NULL;
+                return NULL;
+        }
+
+        /* without Gtk, read what the xsettings would have told it */
+        source = g_settings_schema_source_get_default ();
+        schema = source != NULL ? g_settings_schema_source_lookup (source, SOUND_SCHEMA, TRUE) : NULL;
+        if (schema == NULL) {
+                return context;
+        }
+
+        settings = g_settings_new (SOUND_SCHEMA);
+        theme_name = g_settings_get_string (settings, KEY_SOUND_THEME_NAME);
+        ca_context_change_props (context,
+                                 CA_PROP_APPLICATION_NAME, g_get_application_name (),
+                                 CA_PROP_CANBERRA_XDG_THEME_NAME, theme_name,
+                                 CA_PROP_CANBERRA_ENABLE,
+                                 g_settings_get_boolean (settings, KEY_SOUND_EVENT_SOUNDS) ? "1" : "0",
+                                 NULL);
+        g_free (theme_name);
+        g_object_unref (settings);
+        g_settings_schema_unref (schema);
+
+        return context;
+}
+
+static void
+play_session_sound (const char *event_id,
+                    const char *description)
+{
+        ca_context *context;
+
+        context = get_sound_context ();
+        if (context == NULL) {
+                return;
+        }
+
+        ca_context_play (context, 0,
+                         CA_PROP_EVENT_ID, event_id,
+                         CA_PROP_EVENT_DESCRIPTION, description,
+                         NULL);
+}
+#endif
+
 static void
 do_phase_query_end_session (GsmManager *manager)
 {
@@ -1553,10 +3374,7 @@ do_phase_query_end_session (GsmManager *manager)
         priv = gsm_manager_get_instance_private (manager);
 
 #ifdef HAVE_LIBCANBERRA
-        ca_context_play (ca_gtk_context_get (), 0,
-                         CA_PROP_EVENT_ID, "desktop-logout",
-                         CA_PROP_EVENT_DESCRIPTION, "Session logout",
-                         NULL);
+        play_session_sound ("desktop-logout", "Session logout");
 #endif
 
         if (priv->logout_mode == GSM_MANAGER_LOGOUT_MODE_FORCE) {
@@ -1603,9 +3421,17 @@ start_phase (GsmManager *manager)
         g_debug ("GsmManager: starting phase %s\n",
                  phase_num_to_name (priv->phase));
 
+        gsm_state_page_set_phase (priv->state_page,
+                                  priv->phase,
+                                  priv->phase == GSM_MANAGER_PHASE_RUNNING);
+        gsm_metrics_phase_started (phase_num_to_name (priv->phase));
+        mdm_log_set_field ("MATE_SESSION_PHASE", phase_num_to_name (priv->phase));
+
         /* reset state */
         g_slist_free (priv->pending_apps);
         priv->pending_apps = NULL;
+        g_hash_table_remove_all (priv->pending_starts);
+        priv->phase_deadline = 0;
         g_slist_free (priv->query_clients);
         priv->query_clients = NULL;
         g_slist_free (priv->next_query_clients);
@@ -1630,16 +3456,25 @@ start_phase (GsmManager *manager)
                 do_phase_startup (manager);
                 break;
         case GSM_MANAGER_PHASE_RUNNING:
+                /* login is done, everything gets the same share again */
+                gsm_store_foreach (priv->apps,
+                                   (GsmStoreFunc)_app_restore_priority,
+                                   NULL);
+                stop_window_watcher (manager);
+                gsm_startup_stats_save (priv->startup_stats);
+                schedule_readahead_recording (manager);
+                schedule_on_demand_apps (manager);
+                gsm_logout_dialog_start_prewarm ();
+                start_sleep_pipeline (manager);
                 g_signal_emit (manager, signals[SESSION_RUNNING], 0);
 #ifdef HAVE_LIBCANBERRA
-                ca_context_play (ca_gtk_context_get (), 0,
-                                 CA_PROP_EVENT_ID, "desktop-login",
-                                 CA_PROP_EVENT_DESCRIPTION, "Session login",
-                                 NULL);
+                play_session_sound ("desktop-login", "Session login");
 #endif
                 update_idle (manager);
                 break;
         case GSM_MANAGER_PHASE_QUERY_END_SESSION:
+                gsm_logout_dialog_stop_prewarm ();
+                stop_sleep_pipeline (manager);
                 do_phase_query_end_session (manager);
                 break;
         case GSM_MANAGER_PHASE_END_SESSION:
@@ -1703,6 +3538,7 @@ gsm_manager_start (GsmManager *manager)
 
         gsm_manager_set_phase (manager, GSM_MANAGER_PHASE_INITIALIZATION);
         debug_app_summary (manager);
+        start_window_watcher (manager);
         start_phase (manager);
 }
 
@@ -1761,61 +3597,194 @@ inhibitor_has_client_id (gpointer      key,
                 }
         }
 
-        return matches;
+        return matches;
+}
+
+static gboolean
+_app_has_startup_id (const char *id,
+                     GsmApp     *app,
+                     const char *startup_id_a)
+{
+        const char *startup_id_b;
+
+        startup_id_b = gsm_app_peek_startup_id (app);
+
+        if (IS_STRING_EMPTY (startup_id_b)) {
+                return FALSE;
+        }
+
+        return (strcmp (startup_id_a, startup_id_b) == 0);
+}
+
+static GsmApp *
+find_app_for_startup_id (GsmManager *manager,
+                        const char *startup_id)
+{
+        GsmApp *found_app;
+        GSList *a;
+        GsmManagerPrivate *priv;
+
+        found_app = NULL;
+        priv = gsm_manager_get_instance_private (manager);
+
+        /* If we're starting up the session, try to match the new client
+         * with one pending apps for the current phase. If not, try to match
+         * with any of the autostarted apps. */
+        if (priv->phase < GSM_MANAGER_PHASE_APPLICATION) {
+                for (a = priv->pending_apps; a != NULL; a = a->next) {
+                        GsmApp *app = GSM_APP (a->data);
+
+                        if (strcmp (startup_id, gsm_app_peek_startup_id (app)) == 0) {
+                                found_app = app;
+                                goto out;
+                        }
+                }
+        } else {
+                GsmApp *app;
+
+                app = (GsmApp *)gsm_store_find (priv->apps,
+                                                (GsmStoreFunc)_app_has_startup_id,
+                                                (char *)startup_id);
+                if (app != NULL) {
+                        found_app = app;
+                        goto out;
+                }
+        }
+ out:
+        return found_app;
+}
+
+typedef struct {
+        GsmManager *manager;
+        GsmApp     *app;
+        guint       n_restarts;
+        gint64      last_restart;
+        guint       timeout_id;
+        gboolean    failed;
+} AppRestartState;
+
+static void
+app_restart_state_free (AppRestartState *state)
+{
+        if (state->timeout_id > 0) {
+                g_source_remove (state->timeout_id);
+        }
+
+        g_free (state);
+}
+
+static void
+restart_app (GsmManager *manager,
+             GsmApp     *app)
+{
+        GError  *error;
+        gboolean UNUSED_VARIABLE res;
+
+        g_debug ("GsmManager: restarting app %s", gsm_app_peek_app_id (app));
+
+        gsm_metrics_increment (GSM_METRIC_APP_AUTORESTARTS);
+
+        error = NULL;
+        res = gsm_app_restart (app, &error);
+        if (error != NULL) {
+                g_warning ("Error on restarting session managed app: %s", error->message);
+                g_error_free (error);
+        }
 }
 
 static gboolean
-_app_has_startup_id (const char *id,
-                     GsmApp     *app,
-                     const char *startup_id_a)
+on_app_restart_timeout (AppRestartState *state)
 {
-        const char *startup_id_b;
+        GsmManagerPrivate *priv;
 
-        startup_id_b = gsm_app_peek_startup_id (app);
+        priv = gsm_manager_get_instance_private (state->manager);
+        state->timeout_id = 0;
 
-        if (IS_STRING_EMPTY (startup_id_b)) {
+        if (priv->phase >= GSM_MANAGER_PHASE_QUERY_END_SESSION) {
+                g_debug ("GsmManager: in shutdown, not restarting application");
                 return FALSE;
         }
 
-        return (strcmp (startup_id_a, startup_id_b) == 0);
+        restart_app (state->manager, state->app);
+
+        return FALSE;
 }
 
-static GsmApp *
-find_app_for_startup_id (GsmManager *manager,
-                        const char *startup_id)
+static void
+schedule_app_restart (GsmManager *manager,
+                      GsmApp     *app)
 {
-        GsmApp *found_app;
-        GSList *a;
         GsmManagerPrivate *priv;
+        AppRestartState   *state;
+        gint64             now;
+        guint              delay;
 
-        found_app = NULL;
         priv = gsm_manager_get_instance_private (manager);
 
-        /* If we're starting up the session, try to match the new client
-         * with one pending apps for the current phase. If not, try to match
-         * with any of the autostarted apps. */
-        if (priv->phase < GSM_MANAGER_PHASE_APPLICATION) {
-                for (a = priv->pending_apps; a != NULL; a = a->next) {
-                        GsmApp *app = GSM_APP (a->data);
+        state = g_hash_table_lookup (priv->app_restart_states, app);
+        if (state == NULL) {
+                state = g_new0 (AppRestartState, 1);
+                state->manager = manager;
+                state->app = app;
+                g_hash_table_insert (priv->app_restart_states, app, state);
+        }
 
-                        if (strcmp (startup_id, gsm_app_peek_startup_id (app)) == 0) {
-                                found_app = app;
-                                goto out;
-                        }
-                }
+        if (state->failed) {
+                g_debug ("GsmManager: app %s has failed, not restarting it",
+                         gsm_app_peek_app_id (app));
+                return;
+        }
+
+        if (state->timeout_id > 0) {
+                g_debug ("GsmManager: restart of app %s already scheduled",
+                         gsm_app_peek_app_id (app));
+                return;
+        }
+
+        now = g_get_monotonic_time ();
+
+        /* it stayed up for a while, so forget about earlier crashes */
+        if (state->n_restarts > 0
+            && now - state->last_restart > GSM_MANAGER_RESTART_WINDOW * G_USEC_PER_SEC) {
+                state->n_restarts = 0;
+        }
+
+        if (state->n_restarts >= GSM_MANAGER_RESTART_BURST) {
+                state->failed = TRUE;
+
+                g_warning ("Application '%s' was restarted %d times without staying up "
+                           "for %d seconds, not restarting it anymore",
+                           gsm_app_peek_app_id (app),
+                           GSM_MANAGER_RESTART_BURST,
+                           GSM_MANAGER_RESTART_WINDOW);
+
+                g_signal_emit (manager, signals [APP_FAILED], 0, gsm_app_peek_app_id (app));
+                return;
+        }
+
+        /* restart right away the first time, then back off: 1, 2, 4... */
+        if (state->n_restarts == 0) {
+                delay = 0;
         } else {
-                GsmApp *app;
+                delay = MIN (1u << (state->n_restarts - 1), GSM_MANAGER_RESTART_MAX_DELAY);
+        }
 
-                app = (GsmApp *)gsm_store_find (priv->apps,
-                                                (GsmStoreFunc)_app_has_startup_id,
-                                                (char *)startup_id);
-                if (app != NULL) {
-                        found_app = app;
-                        goto out;
-                }
+        state->n_restarts++;
+        state->last_restart = now + delay * G_USEC_PER_SEC;
+
+        if (delay == 0) {
+                restart_app (manager, app);
+        } else {
+                g_debug ("GsmManager: restarting app %s in %u seconds (restart %u of %d)",
+                         gsm_app_peek_app_id (app),
+                         delay,
+                         state->n_restarts,
+                         GSM_MANAGER_RESTART_BURST);
+
+                state->timeout_id = g_timeout_add_seconds (delay,
+                                                           (GSourceFunc)on_app_restart_timeout,
+                                                           state);
         }
- out:
-        return found_app;
 }
 
 static void
@@ -1824,8 +3793,6 @@ _disconnect_client (GsmManager *manager,
 {
         gboolean              is_condition_client;
         GsmApp               *app;
-        GError               *error;
-        gboolean UNUSED_VARIABLE res;
         const char           *app_id;
         const char           *startup_id;
         gboolean              app_restart;
@@ -1918,14 +3885,7 @@ _disconnect_client (GsmManager *manager,
                 goto out;
         }
 
-        g_debug ("GsmManager: restarting app");
-
-        error = NULL;
-        res = gsm_app_restart (app, &error);
-        if (error != NULL) {
-                g_warning ("Error on restarting session managed app: %s", error->message);
-                g_error_free (error);
-        }
+        schedule_app_restart (manager, app);
 
  out:
         g_object_unref (client);
@@ -1947,119 +3907,406 @@ _disconnect_dbus_client (const char       *id,
                 return FALSE;
         }
 
-        /* If no service name, then we simply disconnect all clients */
-        if (!data->service_name) {
-                _disconnect_client (data->manager, client);
-                return TRUE;
-        }
-
-        name = gsm_dbus_client_get_bus_name (GSM_DBUS_CLIENT (client));
-        if (IS_STRING_EMPTY (name)) {
+        /* If no service name, then we simply disconnect all clients */
+        if (!data->service_name) {
+                _disconnect_client (data->manager, client);
+                return TRUE;
+        }
+
+        name = gsm_dbus_client_get_bus_name (GSM_DBUS_CLIENT (client));
+        if (IS_STRING_EMPTY (name)) {
+                return FALSE;
+        }
+
+        if (strcmp (data->service_name, name) == 0) {
+                _disconnect_client (data->manager, client);
+                return TRUE;
+        }
+
+        return FALSE;
+}
+
+/**
+ * remove_clients_for_connection:
+ * @manager: a #GsmManager
+ * @service_name: a service name
+ *
+ * Disconnects clients that own @service_name.
+ *
+ * If @service_name is NULL, then disconnects all clients for the connection.
+ */
+static void
+remove_clients_for_connection (GsmManager *manager,
+                               const char *service_name)
+{
+        RemoveClientData data;
+        GsmManagerPrivate *priv;
+
+        data.service_name = service_name;
+        data.manager = manager;
+        priv = gsm_manager_get_instance_private (manager);
+
+        /* disconnect dbus clients for name */
+        gsm_store_foreach_remove (priv->clients,
+                                  (GsmStoreFunc)_disconnect_dbus_client,
+                                  &data);
+
+        if (priv->phase >= GSM_MANAGER_PHASE_QUERY_END_SESSION
+            && gsm_store_size (priv->clients) == 0) {
+                g_debug ("GsmManager: last client disconnected - exiting");
+                end_phase (manager);
+        }
+}
+
+static gboolean
+inhibitor_has_bus_name (gpointer          key,
+                        GsmInhibitor     *inhibitor,
+                        RemoveClientData *data)
+{
+        gboolean    matches;
+        const char *bus_name_b;
+
+        bus_name_b = gsm_inhibitor_peek_bus_name (inhibitor);
+
+        matches = FALSE;
+        if (! IS_STRING_EMPTY (data->service_name) && ! IS_STRING_EMPTY (bus_name_b)) {
+                matches = (strcmp (data->service_name, bus_name_b) == 0);
+                if (matches) {
+                        g_debug ("GsmManager: removing inhibitor from %s for reason '%s' on connection %s",
+                                 gsm_inhibitor_peek_app_id (inhibitor),
+                                 gsm_inhibitor_peek_reason (inhibitor),
+                                 gsm_inhibitor_peek_bus_name (inhibitor));
+                }
+        }
+
+        return matches;
+}
+
+static void
+remove_inhibitors_for_connection (GsmManager *manager,
+                                  const char *service_name)
+{
+        guint UNUSED_VARIABLE n_removed;
+        RemoveClientData data;
+        GsmManagerPrivate *priv;
+
+        data.service_name = service_name;
+        data.manager = manager;
+        priv = gsm_manager_get_instance_private (manager);
+
+        debug_inhibitors (manager);
+
+        n_removed = gsm_store_foreach_remove (priv->inhibitors,
+                                              (GsmStoreFunc)inhibitor_has_bus_name,
+                                              &data);
+}
+
+static void
+bus_name_owner_changed (DBusGProxy  *bus_proxy,
+                        const char  *service_name,
+                        const char  *old_service_name,
+                        const char  *new_service_name,
+                        GsmManager  *manager)
+{
+        if (strlen (new_service_name) == 0
+            && strlen (old_service_name) > 0) {
+                /* service removed */
+                remove_inhibitors_for_connection (manager, old_service_name);
+                remove_clients_for_connection (manager, old_service_name);
+        } else if (strlen (old_service_name) == 0
+                   && strlen (new_service_name) > 0) {
+                /* service added */
+
+                /* use this if we support automatically registering
+                 * well known bus names */
+        }
+}
+
+static DBusHandlerResult
+handle_get_state_page (GsmManager     *manager,
+                       DBusConnection *connection,
+                       DBusMessage    *message)
+{
+        GsmManagerPrivate *priv;
+        DBusMessage       *reply;
+        int                fd;
+
+        priv = gsm_manager_get_instance_private (manager);
+
+        /* dbus-glib can't pass file descriptors, so this one method is
+         * answered by hand */
+        fd = -1;
+#ifdef DBUS_TYPE_UNIX_FD
+        if (priv->state_page != NULL
+            && dbus_connection_can_send_type (connection, DBUS_TYPE_UNIX_FD)) {
+                fd = gsm_state_page_open_readonly (priv->state_page);
+        }
+#endif
+
+        if (fd < 0) {
+                reply = dbus_message_new_error (message,
+                                                DBUS_ERROR_NOT_SUPPORTED,
+                                                "The session state page is not available");
+        } else {
+                reply = dbus_message_new_method_return (message);
+#ifdef DBUS_TYPE_UNIX_FD
+                dbus_message_append_args (reply,
+                                          DBUS_TYPE_UNIX_FD, &fd,
+                                          DBUS_TYPE_INVALID);
+#endif
+                close (fd);
+        }
+
+        dbus_connection_send (connection, reply, NULL);
+        dbus_message_unref (reply);
+
+        return DBUS_HANDLER_RESULT_HANDLED;
+}
+
+static DBusConnection *
+get_bus_connection (GsmManager *manager)
+{
+        GsmManagerPrivate *priv;
+
+        priv = gsm_manager_get_instance_private (manager);
+
+        if (priv->connection == NULL || priv->dbus_disconnected) {
+                return NULL;
+        }
+
+        return dbus_g_connection_get_connection (priv->connection);
+}
+
+static DBusHandlerResult
+send_reply (DBusConnection *connection,
+            DBusMessage    *reply)
+{
+        if (reply == NULL) {
+                return DBUS_HANDLER_RESULT_NEED_MEMORY;
+        }
+
+        dbus_connection_send (connection, reply, NULL);
+        dbus_message_unref (reply);
+
+        return DBUS_HANDLER_RESULT_HANDLED;
+}
+
+typedef struct {
+        GsmManager *manager;
+        char       *id;
+        int         fd;
+        guint       watch_id;
+} FdInhibitor;
+
+static void
+fd_inhibitor_free (FdInhibitor *fd_inhibitor)
+{
+        if (fd_inhibitor->watch_id > 0) {
+                g_source_remove (fd_inhibitor->watch_id);
+        }
+        close (fd_inhibitor->fd);
+        g_free (fd_inhibitor->id);
+        g_free (fd_inhibitor);
+}
+
+static gboolean
+on_inhibit_fd_closed (int           fd,
+                      GIOCondition  condition,
+                      FdInhibitor  *fd_inhibitor)
+{
+        GsmManagerPrivate *priv;
+
+        priv = gsm_manager_get_instance_private (fd_inhibitor->manager);
+
+        g_debug ("GsmManager: inhibitor %s closed its end of the pipe", fd_inhibitor->id);
+
+        /* frees fd_inhibitor, through on_store_inhibitor_removed() */
+        fd_inhibitor->watch_id = 0;
+        gsm_store_remove (priv->inhibitors, fd_inhibitor->id);
+
+        return G_SOURCE_REMOVE;
+}
+
+static gboolean
+check_inhibit_args (GsmManager  *manager,
+                    const char  *app_id,
+                    const char  *reason,
+                    guint        flags,
+                    GError     **error)
+{
+        GsmManagerPrivate *priv;
+
+        priv = gsm_manager_get_instance_private (manager);
+
+        if (priv->logout_mode == GSM_MANAGER_LOGOUT_MODE_FORCE) {
+                g_set_error (error,
+                             GSM_MANAGER_ERROR,
+                             GSM_MANAGER_ERROR_GENERAL,
+                             "Forced logout cannot be inhibited");
+                return FALSE;
+        }
+
+        if (IS_STRING_EMPTY (app_id)) {
+                g_set_error (error,
+                             GSM_MANAGER_ERROR,
+                             GSM_MANAGER_ERROR_GENERAL,
+                             "Application ID not specified");
+                return FALSE;
+        }
+
+        if (IS_STRING_EMPTY (reason)) {
+                g_set_error (error,
+                             GSM_MANAGER_ERROR,
+                             GSM_MANAGER_ERROR_GENERAL,
+                             "Reason not specified");
                 return FALSE;
         }
 
-        if (strcmp (data->service_name, name) == 0) {
-                _disconnect_client (data->manager, client);
-                return TRUE;
+        if (flags == 0) {
+                g_set_error (error,
+                             GSM_MANAGER_ERROR,
+                             GSM_MANAGER_ERROR_GENERAL,
+                             "Invalid inhibit flags");
+                return FALSE;
         }
 
-        return FALSE;
+        return TRUE;
 }
 
-/**
- * remove_clients_for_connection:
- * @manager: a #GsmManager
- * @service_name: a service name
- *
- * Disconnects clients that own @service_name.
+/* InhibitFd(s app_id, u toplevel_xid, s reason, u flags) -> (h fd, u cookie)
  *
- * If @service_name is NULL, then disconnects all clients for the connection.
- */
-static void
-remove_clients_for_connection (GsmManager *manager,
-                               const char *service_name)
+ * Like Inhibit(), but the inhibitor is not tied to the caller's bus
+ * connection: it lasts until every copy of the returned pipe end is
+ * closed, or until Uninhibit() is called with the cookie.  A script can
+ * hand the fd to a child and leave the bus. */
+static DBusHandlerResult
+handle_inhibit_fd (GsmManager     *manager,
+                   DBusConnection *connection,
+                   DBusMessage    *message)
 {
-        RemoveClientData data;
         GsmManagerPrivate *priv;
+        GsmInhibitor      *inhibitor;
+        FdInhibitor       *fd_inhibitor;
+        DBusMessage       *reply;
+        DBusError          derror;
+        GError            *error;
+        const char        *app_id;
+        const char        *reason;
+        dbus_uint32_t      toplevel_xid;
+        dbus_uint32_t      flags;
+        dbus_uint32_t      cookie;
+        int                fds[2];
 
-        data.service_name = service_name;
-        data.manager = manager;
         priv = gsm_manager_get_instance_private (manager);
 
-        /* disconnect dbus clients for name */
-        gsm_store_foreach_remove (priv->clients,
-                                  (GsmStoreFunc)_disconnect_dbus_client,
-                                  &data);
-
-        if (priv->phase >= GSM_MANAGER_PHASE_QUERY_END_SESSION
-            && gsm_store_size (priv->clients) == 0) {
-                g_debug ("GsmManager: last client disconnected - exiting");
-                end_phase (manager);
+        dbus_error_init (&derror);
+        if (! dbus_message_get_args (message, &derror,
+                                     DBUS_TYPE_STRING, &app_id,
+                                     DBUS_TYPE_UINT32, &toplevel_xid,
+                                     DBUS_TYPE_STRING, &reason,
+                                     DBUS_TYPE_UINT32, &flags,
+                                     DBUS_TYPE_INVALID)) {
+                reply = dbus_message_new_error (message, derror.name, derror.message);
+                dbus_error_free (&derror);
+                return send_reply (connection, reply);
         }
-}
 
-static gboolean
-inhibitor_has_bus_name (gpointer          key,
-                        GsmInhibitor     *inhibitor,
-                        RemoveClientData *data)
-{
-        gboolean    matches;
-        const char *bus_name_b;
+        g_debug ("GsmManager: InhibitFd xid=%u app_id=%s reason=%s flags=%u",
+                 toplevel_xid,
+                 app_id,
+                 reason,
+                 flags);
 
-        bus_name_b = gsm_inhibitor_peek_bus_name (inhibitor);
+#ifdef DBUS_TYPE_UNIX_FD
+        if (! dbus_connection_can_send_type (connection, DBUS_TYPE_UNIX_FD))
+#endif
+        {
+                return send_reply (connection,
+                                   dbus_message_new_error (message,
+                                                           DBUS_ERROR_NOT_SUPPORTED,
+                                                           "File descriptor passing is not supported"));
+        }
 
-        matches = FALSE;
-        if (! IS_STRING_EMPTY (data->service_name) && ! IS_STRING_EMPTY (bus_name_b)) {
-                matches = (strcmp (data->service_name, bus_name_b) == 0);
-                if (matches) {
-                        g_debug ("GsmManager: removing inhibitor from %s for reason '%s' on connection %s",
-                                 gsm_inhibitor_peek_app_id (inhibitor),
-                                 gsm_inhibitor_peek_reason (inhibitor),
-                                 gsm_inhibitor_peek_bus_name (inhibitor));
-                }
+        error = NULL;
+        if (! check_inhibit_args (manager, app_id, reason, flags, &error)
+            || ! g_unix_open_pipe (fds, FD_CLOEXEC, &error)) {
+                g_debug ("GsmManager: Unable to inhibit: %s", error->message);
+                reply = dbus_message_new_error (message,
+                                                GSM_MANAGER_DBUS_INTERFACE ".GeneralError",
+                                                error->message);
+                g_error_free (error);
+                return send_reply (connection, reply);
         }
 
-        return matches;
-}
+        reply = dbus_message_new_method_return (message);
+        if (reply == NULL) {
+                close (fds[0]);
+                close (fds[1]);
+                return DBUS_HANDLER_RESULT_NEED_MEMORY;
+        }
 
-static void
-remove_inhibitors_for_connection (GsmManager *manager,
-                                  const char *service_name)
-{
-        guint UNUSED_VARIABLE n_removed;
-        RemoveClientData data;
-        GsmManagerPrivate *priv;
+        /* no bus name: the inhibitor must outlive the caller's
+         * connection */
+        cookie = _generate_unique_cookie (manager);
+        inhibitor = gsm_inhibitor_new (app_id,
+                                       toplevel_xid,
+                                       flags,
+                                       reason,
+                                       NULL,
+                                       cookie);
 
-        data.service_name = service_name;
-        data.manager = manager;
-        priv = gsm_manager_get_instance_private (manager);
+        /* the write end reports an error once no reader is left */
+        fd_inhibitor = g_new0 (FdInhibitor, 1);
+        fd_inhibitor->manager = manager;
+        fd_inhibitor->id = g_strdup (gsm_inhibitor_peek_id (inhibitor));
+        fd_inhibitor->fd = fds[1];
+        fd_inhibitor->watch_id = g_unix_fd_add (fds[1],
+                                                G_IO_ERR | G_IO_HUP,
+                                                (GUnixFDSourceFunc)on_inhibit_fd_closed,
+                                                fd_inhibitor);
+        g_hash_table_insert (priv->fd_inhibitors, fd_inhibitor->id, fd_inhibitor);
 
-        debug_inhibitors (manager);
+        gsm_store_add (priv->inhibitors, gsm_inhibitor_peek_id (inhibitor), G_OBJECT (inhibitor));
+        g_object_unref (inhibitor);
 
-        n_removed = gsm_store_foreach_remove (priv->inhibitors,
-                                              (GsmStoreFunc)inhibitor_has_bus_name,
-                                              &data);
+#ifdef DBUS_TYPE_UNIX_FD
+        dbus_message_append_args (reply,
+                                  DBUS_TYPE_UNIX_FD, &fds[0],
+                                  DBUS_TYPE_UINT32, &cookie,
+                                  DBUS_TYPE_INVALID);
+#endif
+        close (fds[0]);
+
+        return send_reply (connection, reply);
 }
 
-static void
-bus_name_owner_changed (DBusGProxy  *bus_proxy,
-                        const char  *service_name,
-                        const char  *old_service_name,
-                        const char  *new_service_name,
-                        GsmManager  *manager)
+static DBusHandlerResult
+handle_properties (GsmManager     *manager,
+                   DBusConnection *connection,
+                   DBusMessage    *message)
 {
-        if (strlen (new_service_name) == 0
-            && strlen (old_service_name) > 0) {
-                /* service removed */
-                remove_inhibitors_for_connection (manager, old_service_name);
-                remove_clients_for_connection (manager, old_service_name);
-        } else if (strlen (old_service_name) == 0
-                   && strlen (new_service_name) > 0) {
-                /* service added */
+        GsmManagerPrivate *priv;
+        const char        *path;
+        GObject           *object;
 
-                /* use this if we support automatically registering
-                 * well known bus names */
+        priv = gsm_manager_get_instance_private (manager);
+
+        /* only clients and inhibitors are answered here; everything
+         * else is left to dbus-glib */
+        path = dbus_message_get_path (message);
+        object = NULL;
+        if (path != NULL && priv->clients != NULL) {
+                object = gsm_store_lookup (priv->clients, path);
+        }
+        if (object == NULL && path != NULL && priv->inhibitors != NULL) {
+                object = gsm_store_lookup (priv->inhibitors, path);
         }
+        if (object == NULL) {
+                return DBUS_HANDLER_RESULT_NOT_YET_HANDLED;
+        }
+
+        return send_reply (connection,
+                           gsm_object_manager_get_properties (message, object));
 }
 
 static DBusHandlerResult
@@ -2073,6 +4320,8 @@ gsm_manager_bus_filter (DBusConnection *connection,
         manager = GSM_MANAGER (user_data);
         priv = gsm_manager_get_instance_private (manager);
 
+        gsm_dbus_stats_message_received (message);
+
         if (dbus_message_is_signal (message,
                                     DBUS_INTERFACE_LOCAL, "Disconnected") &&
             strcmp (dbus_message_get_path (message), DBUS_PATH_LOCAL) == 0) {
@@ -2081,6 +4330,45 @@ gsm_manager_bus_filter (DBusConnection *connection,
                 remove_clients_for_connection (manager, NULL);
                 /* let other filters get this disconnected signal, so that they
                  * can handle it too */
+        } else if (dbus_message_is_method_call (message,
+                                                GSM_STATE_PAGE_DBUS_INTERFACE,
+                                                "GetStatePage")
+                   && g_strcmp0 (dbus_message_get_path (message), GSM_MANAGER_DBUS_PATH) == 0) {
+                return handle_get_state_page (manager, connection, message);
+        } else if (dbus_message_is_method_call (message,
+                                                GSM_MANAGER_DBUS_INTERFACE,
+                                                "InhibitFd")
+                   && g_strcmp0 (dbus_message_get_path (message), GSM_MANAGER_DBUS_PATH) == 0) {
+                return handle_inhibit_fd (manager, connection, message);
+        } else if (dbus_message_is_method_call (message,
+                                                GSM_OBJECT_MANAGER_DBUS_INTERFACE,
+                                                "GetManagedObjects")
+                   && g_strcmp0 (dbus_message_get_path (message), GSM_MANAGER_DBUS_PATH) == 0) {
+                return send_reply (connection,
+                                   gsm_object_manager_get_managed_objects (message,
+                                                                           priv->clients,
+                                                                           priv->inhibitors));
+        } else if (dbus_message_is_method_call (message,
+                                                GSM_METRICS_DBUS_INTERFACE,
+                                                "GetMetrics")
+                   && g_strcmp0 (dbus_message_get_path (message), GSM_MANAGER_DBUS_PATH) == 0) {
+                return send_reply (connection,
+                                   gsm_metrics_get_metrics_reply (message));
+        } else if (dbus_message_is_method_call (message,
+                                                GSM_WATCHDOG_DBUS_INTERFACE,
+                                                "GetLatencyHistogram")
+                   && g_strcmp0 (dbus_message_get_path (message), GSM_MANAGER_DBUS_PATH) == 0) {
+                return send_reply (connection,
+                                   gsm_watchdog_get_latency_reply (message));
+        } else if (dbus_message_is_method_call (message,
+                                                GSM_DBUS_STATS_DBUS_INTERFACE,
+                                                "GetCallStats")
+                   && g_strcmp0 (dbus_message_get_path (message), GSM_MANAGER_DBUS_PATH) == 0) {
+                return send_reply (connection,
+                                   gsm_dbus_stats_get_stats_reply (message));
+        } else if (dbus_message_get_type (message) == DBUS_MESSAGE_TYPE_METHOD_CALL
+                   && g_strcmp0 (dbus_message_get_interface (message), GSM_PROPERTIES_DBUS_INTERFACE) == 0) {
+                return handle_properties (manager, connection, message);
         }
 
         return DBUS_HANDLER_RESULT_NOT_YET_HANDLED;
@@ -2171,10 +4459,18 @@ on_client_disconnected (GsmClient  *client,
 
         priv = gsm_manager_get_instance_private (manager);
 
+        if (priv->phase == GSM_MANAGER_PHASE_EXIT) {
+                g_debug ("GsmManager: client %s stopped after %.3f seconds",
+                         gsm_client_peek_id (client),
+                         exit_phase_elapsed (manager));
+        }
+
         _disconnect_client (manager, client);
         gsm_store_remove (priv->clients, gsm_client_peek_id (client));
-        if (priv->phase >= GSM_MANAGER_PHASE_QUERY_END_SESSION
-            && gsm_store_size (priv->clients) == 0) {
+        if (priv->phase == GSM_MANAGER_PHASE_EXIT) {
+                maybe_end_exit_phase (manager);
+        } else if (priv->phase >= GSM_MANAGER_PHASE_QUERY_END_SESSION
+                   && gsm_store_size (priv->clients) == 0) {
                 g_debug ("GsmManager: last client disconnected - exiting");
                 end_phase (manager);
         }
@@ -2413,6 +4709,14 @@ on_client_end_session_response (GsmClient  *client,
                                 const char *reason,
                                 GsmManager *manager)
 {
+        GsmManagerPrivate *priv;
+
+        priv = gsm_manager_get_instance_private (manager);
+        if (priv->phase == GSM_MANAGER_PHASE_QUERY_END_SESSION) {
+                gsm_metrics_observe (GSM_METRIC_QUERY_END_SESSION_RESPONSE,
+                                     gsm_metrics_phase_elapsed ());
+        }
+
         _handle_client_end_session_response (manager,
                                              client,
                                              is_ok,
@@ -2443,17 +4747,68 @@ on_xsmp_client_logout_request (GsmXSMPClient *client,
         }
 }
 
+static void
+on_client_notify (GsmClient  *client,
+                  GParamSpec *pspec,
+                  GsmManager *manager)
+{
+        const char *property;
+
+        if (g_strcmp0 (pspec->name, "status") == 0) {
+                property = "Status";
+        } else if (g_strcmp0 (pspec->name, "app-id") == 0) {
+                property = "AppId";
+        } else if (g_strcmp0 (pspec->name, "startup-id") == 0) {
+                property = "StartupId";
+        } else {
+                return;
+        }
+
+        gsm_object_manager_emit_changed (get_bus_connection (manager),
+                                         gsm_client_peek_id (client),
+                                         G_OBJECT (client),
+                                         property);
+}
+
+/* the store only passes the id of a removed client, so the client is
+ * kept here until its handler can be disconnected */
+static void
+notify_client_free (GsmClient *client)
+{
+        g_signal_handlers_disconnect_matched (client,
+                                              G_SIGNAL_MATCH_FUNC,
+                                              0, 0, NULL,
+                                              on_client_notify,
+                                              NULL);
+        g_object_unref (client);
+}
+
 static void
 on_store_client_added (GsmStore   *store,
                        const char *id,
                        GsmManager *manager)
 {
+        GsmManagerPrivate *priv;
         GsmClient *client;
 
+        priv = gsm_manager_get_instance_private (manager);
+
         g_debug ("GsmManager: Client added: %s", id);
 
         client = (GsmClient *)gsm_store_lookup (store, id);
 
+        gsm_object_manager_emit_added (get_bus_connection (manager),
+                                       GSM_MANAGER_DBUS_PATH,
+                                       id,
+                                       G_OBJECT (client));
+        g_signal_connect (client,
+                          "notify",
+                          G_CALLBACK (on_client_notify),
+                          manager);
+        g_hash_table_replace (priv->notify_clients,
+                              g_strdup (id),
+                              g_object_ref (client));
+
         /* a bit hacky */
         if (GSM_IS_XSMP_CLIENT (client)) {
                 g_signal_connect (client,
@@ -2480,11 +4835,37 @@ on_store_client_removed (GsmStore   *store,
                          const char *id,
                          GsmManager *manager)
 {
+        GsmManagerPrivate *priv;
+
+        priv = gsm_manager_get_instance_private (manager);
+
         g_debug ("GsmManager: Client removed: %s", id);
 
+        g_hash_table_remove (priv->notify_clients, id);
+
+        gsm_object_manager_emit_removed (get_bus_connection (manager),
+                                         GSM_MANAGER_DBUS_PATH,
+                                         id,
+                                         GSM_CLIENT_DBUS_INTERFACE);
+
         g_signal_emit (manager, signals [CLIENT_REMOVED], 0, id);
 }
 
+static void
+on_store_clients_changed (GsmStore    *store,
+                          const char **added,
+                          const char **removed,
+                          GsmManager  *manager)
+{
+        update_state_page_clients (manager);
+        gsm_metrics_set_gauge (GSM_METRIC_CLIENTS, gsm_store_size (store));
+        gsm_object_manager_emit_batch (get_bus_connection (manager),
+                                       GSM_MANAGER_DBUS_PATH,
+                                       "ClientsChanged",
+                                       added,
+                                       removed);
+}
+
 static void
 gsm_manager_set_client_store (GsmManager *manager,
                               GsmStore   *store)
@@ -2505,6 +4886,9 @@ gsm_manager_set_client_store (GsmManager *manager,
                 g_signal_handlers_disconnect_by_func (priv->clients,
                                                       on_store_client_removed,
                                                       manager);
+                g_signal_handlers_disconnect_by_func (priv->clients,
+                                                      on_store_clients_changed,
+                                                      manager);
 
                 g_object_unref (priv->clients);
         }
@@ -2522,6 +4906,10 @@ gsm_manager_set_client_store (GsmManager *manager,
                                   "removed",
                                   G_CALLBACK (on_store_client_removed),
                                   manager);
+                g_signal_connect (priv->clients,
+                                  "changed",
+                                  G_CALLBACK (on_store_clients_changed),
+                                  manager);
         }
 }
 
@@ -2603,8 +4991,11 @@ on_store_inhibitor_added (GsmStore   *store,
                           GsmManager *manager)
 {
         g_debug ("GsmManager: Inhibitor added: %s", id);
+        gsm_object_manager_emit_added (get_bus_connection (manager),
+                                       GSM_MANAGER_DBUS_PATH,
+                                       id,
+                                       gsm_store_lookup (store, id));
         g_signal_emit (manager, signals [INHIBITOR_ADDED], 0, id);
-        update_idle (manager);
 }
 
 static void
@@ -2612,8 +5003,36 @@ on_store_inhibitor_removed (GsmStore   *store,
                             const char *id,
                             GsmManager *manager)
 {
+        GsmManagerPrivate *priv;
+
+        priv = gsm_manager_get_instance_private (manager);
+
         g_debug ("GsmManager: Inhibitor removed: %s", id);
+        if (priv->fd_inhibitors != NULL) {
+                g_hash_table_remove (priv->fd_inhibitors, id);
+        }
+        gsm_object_manager_emit_removed (get_bus_connection (manager),
+                                         GSM_MANAGER_DBUS_PATH,
+                                         id,
+                                         GSM_INHIBITOR_DBUS_INTERFACE);
         g_signal_emit (manager, signals [INHIBITOR_REMOVED], 0, id);
+}
+
+/* What depends on the whole set of inhibitors is updated once per batch
+ * of changes rather than for each of them */
+static void
+on_store_inhibitors_changed (GsmStore    *store,
+                             const char **added,
+                             const char **removed,
+                             GsmManager  *manager)
+{
+        update_state_page_inhibitors (manager);
+        update_inhibitor_metrics (manager);
+        gsm_object_manager_emit_batch (get_bus_connection (manager),
+                                       GSM_MANAGER_DBUS_PATH,
+                                       "InhibitorsChanged",
+                                       added,
+                                       removed);
         update_idle (manager);
 }
 
@@ -2634,10 +5053,51 @@ gsm_manager_dispose (GObject *object)
                 g_signal_handlers_disconnect_by_func (priv->clients,
                                                       on_store_client_removed,
                                                       manager);
+                g_signal_handlers_disconnect_by_func (priv->clients,
+                                                      on_store_clients_changed,
+                                                      manager);
                 g_object_unref (priv->clients);
                 priv->clients = NULL;
         }
 
+        g_clear_pointer (&priv->app_restart_states, g_hash_table_destroy);
+        g_clear_pointer (&priv->pending_starts, g_hash_table_destroy);
+        g_clear_pointer (&priv->startup_stats, gsm_startup_stats_free);
+        g_clear_pointer (&priv->state_page, gsm_state_page_free);
+
+        if (priv->throttle_id > 0) {
+                g_source_remove (priv->throttle_id);
+                priv->throttle_id = 0;
+        }
+
+        stop_window_watcher (manager);
+        gsm_logout_dialog_stop_prewarm ();
+        stop_sleep_pipeline (manager);
+        gsm_metrics_set_export_interval (0);
+
+        if (priv->on_demand_id > 0) {
+                g_source_remove (priv->on_demand_id);
+                priv->on_demand_id = 0;
+        }
+
+        g_slist_free_full (priv->on_demand_apps, (GDestroyNotify)on_demand_app_free);
+        priv->on_demand_apps = NULL;
+
+        if (priv->on_demand_connection != NULL) {
+                g_object_unref (priv->on_demand_connection);
+                priv->on_demand_connection = NULL;
+        }
+
+        if (priv->readahead_id > 0) {
+                g_source_remove (priv->readahead_id);
+                priv->readahead_id = 0;
+        }
+
+        if (priv->throttled_apps != NULL) {
+                g_queue_free_full (priv->throttled_apps, (GDestroyNotify)throttled_app_free);
+                priv->throttled_apps = NULL;
+        }
+
         if (priv->apps != NULL) {
                 g_object_unref (priv->apps);
                 priv->apps = NULL;
@@ -2650,11 +5110,17 @@ gsm_manager_dispose (GObject *object)
                 g_signal_handlers_disconnect_by_func (priv->inhibitors,
                                                       on_store_inhibitor_removed,
                                                       manager);
+                g_signal_handlers_disconnect_by_func (priv->inhibitors,
+                                                      on_store_inhibitors_changed,
+                                                      manager);
 
                 g_object_unref (priv->inhibitors);
                 priv->inhibitors = NULL;
         }
 
+        g_clear_pointer (&priv->fd_inhibitors, g_hash_table_destroy);
+        g_clear_pointer (&priv->notify_clients, g_hash_table_destroy);
+
         if (priv->presence != NULL) {
                 g_object_unref (priv->presence);
                 priv->presence = NULL;
@@ -2762,6 +5228,16 @@ gsm_manager_class_init (GsmManagerClass *klass)
                               g_cclosure_marshal_VOID__BOXED,
                               G_TYPE_NONE,
                               1, DBUS_TYPE_G_OBJECT_PATH);
+        signals [APP_FAILED] =
+                g_signal_new ("app-failed",
+                              G_TYPE_FROM_CLASS (object_class),
+                              G_SIGNAL_RUN_LAST,
+                              G_STRUCT_OFFSET (GsmManagerClass, app_failed),
+                              NULL,
+                              NULL,
+                              g_cclosure_marshal_VOID__STRING,
+                              G_TYPE_NONE,
+                              1, G_TYPE_STRING);
 
         g_object_class_install_property (object_class,
                                          PROP_FAILSAFE,
@@ -2786,7 +5262,7 @@ gsm_manager_class_init (GsmManagerClass *klass)
                                                               NULL,
                                                               G_PARAM_READABLE));
 
-        dbus_g_object_type_install_info (GSM_TYPE_MANAGER, &dbus_glib_gsm_manager_object_info);
+        gsm_dbus_stats_install_info (GSM_TYPE_MANAGER, &dbus_glib_gsm_manager_object_info);
         dbus_g_error_domain_register (GSM_MANAGER_ERROR, NULL, GSM_MANAGER_TYPE_ERROR);
 }
 
@@ -2814,6 +5290,10 @@ on_gsettings_key_changed (GSettings   *settings,
                 int delay;
                 delay = g_settings_get_int (settings, key);
                 gsm_presence_set_idle_timeout (priv->presence, delay * 60000);
+        } else if (g_strcmp0 (key, KEY_METRICS_EXPORT_INTERVAL) == 0) {
+                gsm_metrics_set_export_interval (g_settings_get_int (settings, key));
+        } else if (g_strcmp0 (key, KEY_DBUS_CALL_STATS) == 0) {
+                gsm_dbus_stats_set_enabled (g_settings_get_boolean (settings, key));
         } else if (g_strcmp0 (key, KEY_LOCK_DISABLE) == 0) {
                 /* ??? */
                 gboolean UNUSED_VARIABLE disabled;
@@ -2832,6 +5312,11 @@ on_presence_status_changed (GsmPresence  *presence,
                             guint         status,
                             GsmManager   *manager)
 {
+        GsmManagerPrivate *priv;
+
+        priv = gsm_manager_get_instance_private (manager);
+        gsm_state_page_set_presence (priv->state_page, status);
+
 #ifdef HAVE_SYSTEMD
         if (LOGIND_RUNNING()) {
                 GsmSystemd *systemd;
@@ -2891,8 +5376,31 @@ gsm_manager_init (GsmManager *manager)
                           "removed",
                           G_CALLBACK (on_store_inhibitor_removed),
                           manager);
+        g_signal_connect (priv->inhibitors,
+                          "changed",
+                          G_CALLBACK (on_store_inhibitors_changed),
+                          manager);
 
         priv->apps = gsm_store_new ();
+        priv->throttled_apps = g_queue_new ();
+        priv->pending_starts = g_hash_table_new_full (NULL,
+                                                      NULL,
+                                                      NULL,
+                                                      (GDestroyNotify)pending_start_free);
+        priv->startup_stats = gsm_startup_stats_load ();
+        priv->state_page = gsm_state_page_new ();
+        priv->notify_clients = g_hash_table_new_full (g_str_hash,
+                                                      g_str_equal,
+                                                      g_free,
+                                                      (GDestroyNotify)notify_client_free);
+        priv->fd_inhibitors = g_hash_table_new_full (g_str_hash,
+                                                     g_str_equal,
+                                                     NULL,
+                                                     (GDestroyNotify)fd_inhibitor_free);
+        priv->app_restart_states = g_hash_table_new_full (NULL,
+                                                          NULL,
+                                                          NULL,
+                                                          (GDestroyNotify)app_restart_state_free);
 
         priv->presence = gsm_presence_new ();
         g_signal_connect (priv->presence,
@@ -2909,6 +5417,10 @@ gsm_manager_init (GsmManager *manager)
                           manager);
 
         load_idle_delay_from_gsettings (manager);
+        gsm_metrics_set_export_interval (g_settings_get_int (priv->settings_session,
+                                                             KEY_METRICS_EXPORT_INTERVAL));
+        gsm_dbus_stats_set_enabled (g_settings_get_boolean (priv->settings_session,
+                                                            KEY_DBUS_CALL_STATS));
 }
 
 static void
@@ -3327,6 +5839,9 @@ request_suspend (GsmManager *manager)
         priv->inhibit_dialog = gsm_inhibit_dialog_new (priv->inhibitors,
                                                        priv->clients,
                                                        GSM_LOGOUT_ACTION_SLEEP);
+        if (priv->inhibit_dialog == NULL) {
+                return;
+        }
 
         g_signal_connect (priv->inhibit_dialog,
                           "response",
@@ -3358,6 +5873,9 @@ request_hibernate (GsmManager *manager)
         priv->inhibit_dialog = gsm_inhibit_dialog_new (priv->inhibitors,
                                                        priv->clients,
                                                        GSM_LOGOUT_ACTION_HIBERNATE);
+        if (priv->inhibit_dialog == NULL) {
+                return;
+        }
 
         g_signal_connect (priv->inhibit_dialog,
                           "response",
@@ -3411,6 +5929,9 @@ request_switch_user (GsmManager *manager)
         priv->inhibit_dialog = gsm_inhibit_dialog_new (priv->inhibitors,
                                                        priv->clients,
                                                        GSM_LOGOUT_ACTION_SWITCH_USER);
+        if (priv->inhibit_dialog == NULL) {
+                return;
+        }
 
         g_signal_connect (priv->inhibit_dialog,
                           "response",
@@ -3491,6 +6012,9 @@ show_shutdown_dialog (GsmManager *manager)
 
         dialog = gsm_get_shutdown_dialog (gdk_screen_get_default (),
                                           gtk_get_current_event_time ());
+        if (dialog == NULL) {
+                return;
+        }
 
         g_signal_connect (dialog,
                           "response",
@@ -3517,6 +6041,9 @@ show_logout_dialog (GsmManager *manager)
 
         dialog = gsm_get_logout_dialog (gdk_screen_get_default (),
                                         gtk_get_current_event_time ());
+        if (dialog == NULL) {
+                return;
+        }
 
         g_signal_connect (dialog,
                           "response",
@@ -3573,6 +6100,10 @@ gsm_manager_set_phase (GsmManager      *manager,
 
         priv = gsm_manager_get_instance_private (manager);
         priv->phase = phase;
+        gsm_state_page_set_phase (priv->state_page,
+                                  phase,
+                                  phase == GSM_MANAGER_PHASE_RUNNING);
+        mdm_log_set_field ("MATE_SESSION_PHASE", phase_num_to_name (phase));
         return (TRUE);
 }
 
@@ -3912,6 +6443,7 @@ gsm_manager_inhibit (GsmManager            *manager,
 {
         GsmInhibitor *inhibitor;
         guint         cookie;
+        GError       *new_error;
         GsmManagerPrivate *priv;
 
         g_return_val_if_fail (GSM_IS_MANAGER (manager), FALSE);
@@ -3923,48 +6455,9 @@ gsm_manager_inhibit (GsmManager            *manager,
                  flags);
 
         priv = gsm_manager_get_instance_private (manager);
-        if (priv->logout_mode == GSM_MANAGER_LOGOUT_MODE_FORCE) {
-                GError *new_error;
-
-                new_error = g_error_new (GSM_MANAGER_ERROR,
-                                         GSM_MANAGER_ERROR_GENERAL,
-                                         "Forced logout cannot be inhibited");
-                g_debug ("GsmManager: Unable to inhibit: %s", new_error->message);
-                dbus_g_method_return_error (context, new_error);
-                g_error_free (new_error);
-                return FALSE;
-        }
-
-        if (IS_STRING_EMPTY (app_id)) {
-                GError *new_error;
-
-                new_error = g_error_new (GSM_MANAGER_ERROR,
-                                         GSM_MANAGER_ERROR_GENERAL,
-                                         "Application ID not specified");
-                g_debug ("GsmManager: Unable to inhibit: %s", new_error->message);
-                dbus_g_method_return_error (context, new_error);
-                g_error_free (new_error);
-                return FALSE;
-        }
 
-        if (IS_STRING_EMPTY (reason)) {
-                GError *new_error;
-
-                new_error = g_error_new (GSM_MANAGER_ERROR,
-                                         GSM_MANAGER_ERROR_GENERAL,
-                                         "Reason not specified");
-                g_debug ("GsmManager: Unable to inhibit: %s", new_error->message);
-                dbus_g_method_return_error (context, new_error);
-                g_error_free (new_error);
-                return FALSE;
-        }
-
-        if (flags == 0) {
-                GError *new_error;
-
-                new_error = g_error_new (GSM_MANAGER_ERROR,
-                                         GSM_MANAGER_ERROR_GENERAL,
-                                         "Invalid inhibit flags");
+        new_error = NULL;
+        if (! check_inhibit_args (manager, app_id, reason, flags, &new_error)) {
                 g_debug ("GsmManager: Unable to inhibit: %s", new_error->message);
                 dbus_g_method_return_error (context, new_error);
                 g_error_free (new_error);
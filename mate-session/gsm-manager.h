@@ -51,6 +51,8 @@ struct _GsmManagerClass
                                                const char      *id);
         void          (* inhibitor_removed)   (GsmManager      *manager,
                                                const char      *id);
+        void          (* app_failed)          (GsmManager      *manager,
+                                               const char      *app_id);
 }; //GsmManagerClass;
 
 typedef enum {
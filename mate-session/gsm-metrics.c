@@ -0,0 +1,347 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 8 -*-
+ *
+ * Copyright (C) 2012-2021 MATE Developers
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA.
+ *
+ */
+
+#include "config.h"
+
+#include <errno.h>
+#include <string.h>
+
+#include <glib.h>
+#include <glib/gstdio.h>
+#include <dbus/dbus.h>
+
+#include "gsm-metrics.h"
+
+/* Enough for all the GsmManagerPhase values */
+#define GSM_METRICS_MAX_PHASES 16
+
+typedef struct {
+        const char *family;
+        const char *labels;
+        const char *help;
+} MetricInfo;
+
+static const MetricInfo counter_info[GSM_METRIC_N_COUNTERS] = {
+        { "mate_session_apps_started_total", NULL, "Applications started by the session manager" },
+        { "mate_session_app_start_failures_total", NULL, "Applications that could not be started" },
+        { "mate_session_app_autorestarts_total", NULL, "Applications restarted after they exited" },
+        { "mate_session_phase_timeouts_total", NULL, "Session phases that ended on their timeout" },
+        { "mate_session_xsmp_clients_total", "result=\"accepted\"", "XSMP connections" },
+        { "mate_session_xsmp_clients_total", "result=\"rejected\"", "XSMP connections" },
+        { "mate_session_save_failures_total", NULL, "Session saves that failed" },
+};
+
+static const MetricInfo gauge_info[GSM_METRIC_N_GAUGES] = {
+        { "mate_session_clients", NULL, "Registered clients" },
+        { "mate_session_inhibitors", "flag=\"logout\"", "Current inhibitors by flag" },
+        { "mate_session_inhibitors", "flag=\"switch-user\"", "Current inhibitors by flag" },
+        { "mate_session_inhibitors", "flag=\"suspend\"", "Current inhibitors by flag" },
+        { "mate_session_inhibitors", "flag=\"idle\"", "Current inhibitors by flag" },
+};
+
+static const MetricInfo timer_info[GSM_METRIC_N_TIMERS] = {
+        { "mate_session_save_seconds", NULL, "Time spent saving the session" },
+        { "mate_session_query_end_session_response_seconds", NULL, "Time clients took to answer QueryEndSession" },
+};
+
+typedef struct {
+        guint64 count;
+        gint64  sum;
+} TimerValue;
+
+typedef struct {
+        const char *name;
+        gint64      duration;
+} PhaseValue;
+
+static guint64     counters[GSM_METRIC_N_COUNTERS];
+static guint       gauges[GSM_METRIC_N_GAUGES];
+static TimerValue  timers[GSM_METRIC_N_TIMERS];
+
+static PhaseValue  phases[GSM_METRICS_MAX_PHASES];
+static guint       n_phases = 0;
+static const char *current_phase = NULL;
+static gint64      current_phase_start = 0;
+
+static guint       export_id = 0;
+
+void
+gsm_metrics_increment (GsmMetricCounter counter)
+{
+        g_return_if_fail (counter < GSM_METRIC_N_COUNTERS);
+
+        counters[counter]++;
+}
+
+void
+gsm_metrics_set_gauge (GsmMetricGauge gauge,
+                       guint          value)
+{
+        g_return_if_fail (gauge < GSM_METRIC_N_GAUGES);
+
+        gauges[gauge] = value;
+}
+
+void
+gsm_metrics_observe (GsmMetricTimer timer,
+                     gint64         usec)
+{
+        g_return_if_fail (timer < GSM_METRIC_N_TIMERS);
+
+        timers[timer].count++;
+        timers[timer].sum += MAX (usec, 0);
+}
+
+static void
+record_phase_duration (const char *phase,
+                       gint64      duration)
+{
+        guint i;
+
+        for (i = 0; i < n_phases; i++) {
+                if (strcmp (phases[i].name, phase) == 0) {
+                        phases[i].duration = duration;
+                        return;
+                }
+        }
+
+        if (n_phases < GSM_METRICS_MAX_PHASES) {
+                phases[n_phases].name = phase;
+                phases[n_phases].duration = duration;
+                n_phases++;
+        }
+}
+
+/* @phase must be a static string */
+void
+gsm_metrics_phase_started (const char *phase)
+{
+        gint64 now;
+
+        now = g_get_monotonic_time ();
+
+        if (current_phase != NULL) {
+                record_phase_duration (current_phase, now - current_phase_start);
+        }
+
+        current_phase = phase;
+        current_phase_start = now;
+}
+
+gint64
+gsm_metrics_phase_elapsed (void)
+{
+        if (current_phase == NULL) {
+                return 0;
+        }
+
+        return g_get_monotonic_time () - current_phase_start;
+}
+
+typedef void (* MetricFunc) (const MetricInfo *info,
+                             const char       *type,
+                             const char       *suffix,
+                             const char       *labels,
+                             double            value,
+                             gpointer          data);
+
+static void
+foreach_metric (MetricFunc func,
+                gpointer   data)
+{
+        guint i;
+
+        for (i = 0; i < GSM_METRIC_N_COUNTERS; i++) {
+                func (&counter_info[i], "counter", "", counter_info[i].labels,
+                      (double) counters[i], data);
+        }
+
+        for (i = 0; i < GSM_METRIC_N_GAUGES; i++) {
+                func (&gauge_info[i], "gauge", "", gauge_info[i].labels,
+                      (double) gauges[i], data);
+        }
+
+        for (i = 0; i < GSM_METRIC_N_TIMERS; i++) {
+                func (&timer_info[i], "summary", "_sum", NULL,
+                      timers[i].sum / (double) G_USEC_PER_SEC, data);
+                func (&timer_info[i], "summary", "_count", NULL,
+                      (double) timers[i].count, data);
+        }
+
+        for (i = 0; i < n_phases; i++) {
+                static const MetricInfo phase_info = {
+                        "mate_session_phase_duration_seconds", NULL, "Duration of the last run of each session phase"
+                };
+                char *labels;
+
+                labels = g_strdup_printf ("phase=\"%s\"", phases[i].name);
+                func (&phase_info, "gauge", "", labels,
+                      phases[i].duration / (double) G_USEC_PER_SEC, data);
+                g_free (labels);
+        }
+}
+
+static char *
+get_series_name (const MetricInfo *info,
+                 const char       *suffix,
+                 const char       *labels)
+{
+        if (labels == NULL) {
+                return g_strconcat (info->family, suffix, NULL);
+        }
+
+        return g_strconcat (info->family, suffix, "{", labels, "}", NULL);
+}
+
+typedef struct {
+        GString    *text;
+        const char *last_family;
+} TextfileData;
+
+static void
+append_textfile_metric (const MetricInfo *info,
+                        const char       *type,
+                        const char       *suffix,
+                        const char       *labels,
+                        double            value,
+                        TextfileData     *data)
+{
+        char  buf[G_ASCII_DTOSTR_BUF_SIZE];
+        char *series;
+
+        if (g_strcmp0 (data->last_family, info->family) != 0) {
+                g_string_append_printf (data->text, "# HELP %s %s\n", info->family, info->help);
+                g_string_append_printf (data->text, "# TYPE %s %s\n", info->family, type);
+                data->last_family = info->family;
+        }
+
+        series = get_series_name (info, suffix, labels);
+        g_string_append_printf (data->text, "%s %s\n",
+                                series,
+                                g_ascii_dtostr (buf, sizeof (buf), value));
+        g_free (series);
+}
+
+static char *
+get_textfile_path (void)
+{
+        return g_build_filename (g_get_user_runtime_dir (),
+                                 "mate-session",
+                                 "metrics.prom",
+                                 NULL);
+}
+
+static gboolean
+write_textfile (gpointer user_data)
+{
+        TextfileData  data;
+        char         *path;
+        char         *dir;
+        GError       *error;
+
+        data.text = g_string_new (NULL);
+        data.last_family = NULL;
+        foreach_metric ((MetricFunc) append_textfile_metric, &data);
+
+        path = get_textfile_path ();
+        dir = g_path_get_dirname (path);
+
+        error = NULL;
+        if (g_mkdir_with_parents (dir, 0700) < 0) {
+                g_warning ("GsmMetrics: unable to create %s: %s", dir, g_strerror (errno));
+        } else if (!g_file_set_contents (path, data.text->str, data.text->len, &error)) {
+                /* written to a temporary file and renamed, so scrapers
+                 * never see half a file */
+                g_warning ("GsmMetrics: unable to write %s: %s", path, error->message);
+                g_error_free (error);
+        }
+
+        g_free (dir);
+        g_free (path);
+        g_string_free (data.text, TRUE);
+
+        return G_SOURCE_CONTINUE;
+}
+
+/* 0 stops the export and removes the file */
+void
+gsm_metrics_set_export_interval (int seconds)
+{
+        char *path;
+
+        if (export_id != 0) {
+                g_source_remove (export_id);
+                export_id = 0;
+
+                if (seconds <= 0) {
+                        path = get_textfile_path ();
+                        g_unlink (path);
+                        g_free (path);
+                }
+        }
+
+        if (seconds > 0) {
+                g_debug ("GsmMetrics: writing metrics every %d seconds", seconds);
+
+                export_id = g_timeout_add_seconds (seconds, write_textfile, NULL);
+                g_source_set_name_by_id (export_id, "[mate-session] metrics export");
+        }
+}
+
+static void
+append_dbus_metric (const MetricInfo *info,
+                    const char       *type,
+                    const char       *suffix,
+                    const char       *labels,
+                    double            value,
+                    DBusMessageIter  *array)
+{
+        DBusMessageIter entry;
+        char           *series;
+
+        series = get_series_name (info, suffix, labels);
+
+        dbus_message_iter_open_container (array, DBUS_TYPE_DICT_ENTRY, NULL, &entry);
+        dbus_message_iter_append_basic (&entry, DBUS_TYPE_STRING, &series);
+        dbus_message_iter_append_basic (&entry, DBUS_TYPE_DOUBLE, &value);
+        dbus_message_iter_close_container (array, &entry);
+
+        g_free (series);
+}
+
+DBusMessage *
+gsm_metrics_get_metrics_reply (DBusMessage *message)
+{
+        DBusMessage     *reply;
+        DBusMessageIter  iter;
+        DBusMessageIter  array;
+
+        reply = dbus_message_new_method_return (message);
+        if (reply == NULL) {
+                return NULL;
+        }
+
+        dbus_message_iter_init_append (reply, &iter);
+        dbus_message_iter_open_container (&iter, DBUS_TYPE_ARRAY, "{sd}", &array);
+        foreach_metric ((MetricFunc) append_dbus_metric, &array);
+        dbus_message_iter_close_container (&iter, &array);
+
+        return reply;
+}
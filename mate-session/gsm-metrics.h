@@ -0,0 +1,81 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 8 -*-
+ *
+ * Copyright (C) 2012-2021 MATE Developers
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA.
+ *
+ */
+
+#ifndef __GSM_METRICS_H
+#define __GSM_METRICS_H
+
+#include <glib.h>
+#include <dbus/dbus.h>
+
+G_BEGIN_DECLS
+
+/* Cheap session counters.  They are returned by GetMetrics() of the
+ * org.mate.SessionManager.Metrics interface on /org/gnome/SessionManager
+ * as a name to value dictionary, using the Prometheus names, and can
+ * be dumped periodically in the Prometheus text format to
+ * $XDG_RUNTIME_DIR/mate-session/metrics.prom for the node exporter
+ * textfile collector.
+ *
+ * All functions must be called from the main thread.
+ */
+#define GSM_METRICS_DBUS_INTERFACE "org.mate.SessionManager.Metrics"
+
+typedef enum {
+        GSM_METRIC_APPS_STARTED = 0,
+        GSM_METRIC_APP_START_FAILURES,
+        GSM_METRIC_APP_AUTORESTARTS,
+        GSM_METRIC_PHASE_TIMEOUTS,
+        GSM_METRIC_XSMP_CLIENTS_ACCEPTED,
+        GSM_METRIC_XSMP_CLIENTS_REJECTED,
+        GSM_METRIC_SESSION_SAVE_FAILURES,
+        GSM_METRIC_N_COUNTERS
+} GsmMetricCounter;
+
+typedef enum {
+        GSM_METRIC_CLIENTS = 0,
+        GSM_METRIC_INHIBITORS_LOGOUT,
+        GSM_METRIC_INHIBITORS_SWITCH_USER,
+        GSM_METRIC_INHIBITORS_SUSPEND,
+        GSM_METRIC_INHIBITORS_IDLE,
+        GSM_METRIC_N_GAUGES
+} GsmMetricGauge;
+
+typedef enum {
+        GSM_METRIC_SESSION_SAVE = 0,
+        GSM_METRIC_QUERY_END_SESSION_RESPONSE,
+        GSM_METRIC_N_TIMERS
+} GsmMetricTimer;
+
+void         gsm_metrics_increment           (GsmMetricCounter  counter);
+void         gsm_metrics_set_gauge           (GsmMetricGauge    gauge,
+                                              guint             value);
+void         gsm_metrics_observe             (GsmMetricTimer    timer,
+                                              gint64            usec);
+
+void         gsm_metrics_phase_started       (const char       *phase);
+gint64       gsm_metrics_phase_elapsed       (void);
+
+void         gsm_metrics_set_export_interval (int               seconds);
+
+DBusMessage *gsm_metrics_get_metrics_reply   (DBusMessage      *message);
+
+G_END_DECLS
+
+#endif /* __GSM_METRICS_H */
@@ -0,0 +1,444 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 8 -*-
+ *
+ * Copyright (C) 2012-2021 MATE Developers
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA.
+ *
+ */
+
+#include "config.h"
+
+#include <string.h>
+
+#include <glib.h>
+#include <glib-object.h>
+#include <dbus/dbus.h>
+
+#include "gsm-object-manager.h"
+#include "gsm-client.h"
+#include "gsm-inhibitor.h"
+
+#define MAX_PROPERTIES 5
+
+typedef struct {
+        const char    *name;
+        int            type;
+        const char    *string;
+        dbus_uint32_t  uint;
+} GsmObjectProperty;
+
+static void
+set_string (GsmObjectProperty *property,
+            const char        *name,
+            const char        *value)
+{
+        property->name = name;
+        property->type = DBUS_TYPE_STRING;
+        /* libdbus refuses NULL strings */
+        property->string = value != NULL ? value : "";
+}
+
+static void
+set_uint (GsmObjectProperty *property,
+          const char        *name,
+          guint              value)
+{
+        property->name = name;
+        property->type = DBUS_TYPE_UINT32;
+        property->uint = value;
+}
+
+static guint
+collect_properties (GObject           *object,
+                    GsmObjectProperty *properties)
+{
+        guint n;
+
+        n = 0;
+
+        if (GSM_IS_CLIENT (object)) {
+                GsmClient *client = GSM_CLIENT (object);
+                guint      pid;
+
+                pid = 0;
+                gsm_client_get_unix_process_id (client, &pid, NULL);
+
+                set_string (&properties[n++], "AppId", gsm_client_peek_app_id (client));
+                set_string (&properties[n++], "StartupId", gsm_client_peek_startup_id (client));
+                set_uint (&properties[n++], "Status", gsm_client_peek_status (client));
+                set_uint (&properties[n++], "RestartStyleHint", gsm_client_peek_restart_style_hint (client));
+                set_uint (&properties[n++], "UnixProcessId", pid);
+        } else if (GSM_IS_INHIBITOR (object)) {
+                GsmInhibitor *inhibitor = GSM_INHIBITOR (object);
+
+                set_string (&properties[n++], "AppId", gsm_inhibitor_peek_app_id (inhibitor));
+                set_string (&properties[n++], "ClientId", gsm_inhibitor_peek_client_id (inhibitor));
+                set_string (&properties[n++], "Reason", gsm_inhibitor_peek_reason (inhibitor));
+                set_uint (&properties[n++], "Flags", gsm_inhibitor_peek_flags (inhibitor));
+                set_uint (&properties[n++], "ToplevelXid", gsm_inhibitor_peek_toplevel_xid (inhibitor));
+        }
+
+        g_assert (n <= MAX_PROPERTIES);
+
+        return n;
+}
+
+static void
+append_variant (DBusMessageIter   *iter,
+                GsmObjectProperty *property)
+{
+        DBusMessageIter variant;
+        char            signature[2];
+
+        signature[0] = (char) property->type;
+        signature[1] = '\0';
+
+        dbus_message_iter_open_container (iter, DBUS_TYPE_VARIANT, signature, &variant);
+        if (property->type == DBUS_TYPE_STRING) {
+                dbus_message_iter_append_basic (&variant, DBUS_TYPE_STRING, &property->string);
+        } else {
+                dbus_message_iter_append_basic (&variant, DBUS_TYPE_UINT32, &property->uint);
+        }
+        dbus_message_iter_close_container (iter, &variant);
+}
+
+static void
+append_property (DBusMessageIter   *array,
+                 GsmObjectProperty *property)
+{
+        DBusMessageIter entry;
+
+        dbus_message_iter_open_container (array, DBUS_TYPE_DICT_ENTRY, NULL, &entry);
+        dbus_message_iter_append_basic (&entry, DBUS_TYPE_STRING, &property->name);
+        append_variant (&entry, property);
+        dbus_message_iter_close_container (array, &entry);
+}
+
+/* a{sv} */
+static void
+append_properties (DBusMessageIter *iter,
+                   GObject         *object,
+                   const char      *only)
+{
+        GsmObjectProperty properties[MAX_PROPERTIES];
+        DBusMessageIter   array;
+        guint             n;
+        guint             i;
+
+        n = collect_properties (object, properties);
+
+        dbus_message_iter_open_container (iter, DBUS_TYPE_ARRAY, "{sv}", &array);
+        for (i = 0; i < n; i++) {
+                if (only == NULL || strcmp (only, properties[i].name) == 0) {
+                        append_property (&array, &properties[i]);
+                }
+        }
+        dbus_message_iter_close_container (iter, &array);
+}
+
+/* a{sa{sv}} */
+static void
+append_interfaces (DBusMessageIter *iter,
+                   GObject         *object)
+{
+        DBusMessageIter array;
+        DBusMessageIter entry;
+        const char     *interface;
+
+        interface = gsm_object_manager_interface_for (object);
+
+        dbus_message_iter_open_container (iter, DBUS_TYPE_ARRAY, "{sa{sv}}", &array);
+        dbus_message_iter_open_container (&array, DBUS_TYPE_DICT_ENTRY, NULL, &entry);
+        dbus_message_iter_append_basic (&entry, DBUS_TYPE_STRING, &interface);
+        append_properties (&entry, object, NULL);
+        dbus_message_iter_close_container (&array, &entry);
+        dbus_message_iter_close_container (iter, &array);
+}
+
+const char *
+gsm_object_manager_interface_for (GObject *object)
+{
+        if (GSM_IS_CLIENT (object)) {
+                return GSM_CLIENT_DBUS_INTERFACE;
+        } else if (GSM_IS_INHIBITOR (object)) {
+                return GSM_INHIBITOR_DBUS_INTERFACE;
+        }
+
+        return NULL;
+}
+
+static gboolean
+append_managed_object (const char      *id,
+                       GObject         *object,
+                       DBusMessageIter *array)
+{
+        DBusMessageIter entry;
+
+        /* the store ids are the object paths */
+        if (! dbus_validate_path (id, NULL)) {
+                return FALSE;
+        }
+
+        dbus_message_iter_open_container (array, DBUS_TYPE_DICT_ENTRY, NULL, &entry);
+        dbus_message_iter_append_basic (&entry, DBUS_TYPE_OBJECT_PATH, &id);
+        append_interfaces (&entry, object);
+        dbus_message_iter_close_container (array, &entry);
+
+        return FALSE;
+}
+
+DBusMessage *
+gsm_object_manager_get_managed_objects (DBusMessage *message,
+                                        GsmStore    *clients,
+                                        GsmStore    *inhibitors)
+{
+        DBusMessage     *reply;
+        DBusMessageIter  iter;
+        DBusMessageIter  array;
+
+        reply = dbus_message_new_method_return (message);
+        if (reply == NULL) {
+                return NULL;
+        }
+
+        dbus_message_iter_init_append (reply, &iter);
+        dbus_message_iter_open_container (&iter, DBUS_TYPE_ARRAY, "{oa{sa{sv}}}", &array);
+        if (clients != NULL) {
+                gsm_store_foreach (clients, (GsmStoreFunc) append_managed_object, &array);
+        }
+        if (inhibitors != NULL) {
+                gsm_store_foreach (inhibitors, (GsmStoreFunc) append_managed_object, &array);
+        }
+        dbus_message_iter_close_container (&iter, &array);
+
+        return reply;
+}
+
+DBusMessage *
+gsm_object_manager_get_properties (DBusMessage *message,
+                                   GObject     *object)
+{
+        GsmObjectProperty  properties[MAX_PROPERTIES];
+        DBusMessage       *reply;
+        DBusMessageIter    iter;
+        const char        *interface;
+        const char        *name;
+        guint              n;
+        guint              i;
+
+        interface = NULL;
+        name = NULL;
+
+        if (dbus_message_is_method_call (message, GSM_PROPERTIES_DBUS_INTERFACE, "GetAll")) {
+                if (! dbus_message_get_args (message, NULL,
+                                             DBUS_TYPE_STRING, &interface,
+                                             DBUS_TYPE_INVALID)) {
+                        return dbus_message_new_error (message,
+                                                       DBUS_ERROR_INVALID_ARGS,
+                                                       "Expected an interface name");
+                }
+        } else if (dbus_message_is_method_call (message, GSM_PROPERTIES_DBUS_INTERFACE, "Get")) {
+                if (! dbus_message_get_args (message, NULL,
+                                             DBUS_TYPE_STRING, &interface,
+                                             DBUS_TYPE_STRING, &name,
+                                             DBUS_TYPE_INVALID)) {
+                        return dbus_message_new_error (message,
+                                                       DBUS_ERROR_INVALID_ARGS,
+                                                       "Expected an interface and a property name");
+                }
+        } else if (dbus_message_is_method_call (message, GSM_PROPERTIES_DBUS_INTERFACE, "Set")) {
+                return dbus_message_new_error (message,
+#ifdef DBUS_ERROR_PROPERTY_READ_ONLY
+                                               DBUS_ERROR_PROPERTY_READ_ONLY,
+#else
+                                               DBUS_ERROR_ACCESS_DENIED,
+#endif
+                                               "Properties can't be set");
+        } else {
+                return dbus_message_new_error (message,
+                                               DBUS_ERROR_UNKNOWN_METHOD,
+                                               "No such method");
+        }
+
+        if (g_strcmp0 (interface, gsm_object_manager_interface_for (object)) != 0) {
+                return dbus_message_new_error_printf (message,
+                                                      DBUS_ERROR_UNKNOWN_INTERFACE,
+                                                      "No such interface '%s'",
+                                                      interface);
+        }
+
+        if (name == NULL) {
+                reply = dbus_message_new_method_return (message);
+                dbus_message_iter_init_append (reply, &iter);
+                append_properties (&iter, object, NULL);
+                return reply;
+        }
+
+        n = collect_properties (object, properties);
+        for (i = 0; i < n; i++) {
+                if (strcmp (properties[i].name, name) == 0) {
+                        reply = dbus_message_new_method_return (message);
+                        dbus_message_iter_init_append (reply, &iter);
+                        append_variant (&iter, &properties[i]);
+                        return reply;
+                }
+        }
+
+        return dbus_message_new_error_printf (message,
+                                              DBUS_ERROR_UNKNOWN_PROPERTY,
+                                              "No such property '%s'",
+                                              name);
+}
+
+void
+gsm_object_manager_emit_added (DBusConnection *connection,
+                               const char     *manager_path,
+                               const char     *path,
+                               GObject        *object)
+{
+        DBusMessage     *signal;
+        DBusMessageIter  iter;
+
+        if (connection == NULL || ! dbus_validate_path (path, NULL)) {
+                return;
+        }
+
+        signal = dbus_message_new_signal (manager_path,
+                                          GSM_OBJECT_MANAGER_DBUS_INTERFACE,
+                                          "InterfacesAdded");
+        if (signal == NULL) {
+                return;
+        }
+
+        dbus_message_iter_init_append (signal, &iter);
+        dbus_message_iter_append_basic (&iter, DBUS_TYPE_OBJECT_PATH, &path);
+        append_interfaces (&iter, object);
+
+        dbus_connection_send (connection, signal, NULL);
+        dbus_message_unref (signal);
+}
+
+void
+gsm_object_manager_emit_removed (DBusConnection *connection,
+                                 const char     *manager_path,
+                                 const char     *path,
+                                 const char     *interface)
+{
+        DBusMessage     *signal;
+        DBusMessageIter  iter;
+        DBusMessageIter  array;
+
+        if (connection == NULL || ! dbus_validate_path (path, NULL)) {
+                return;
+        }
+
+        signal = dbus_message_new_signal (manager_path,
+                                          GSM_OBJECT_MANAGER_DBUS_INTERFACE,
+                                          "InterfacesRemoved");
+        if (signal == NULL) {
+                return;
+        }
+
+        dbus_message_iter_init_append (signal, &iter);
+        dbus_message_iter_append_basic (&iter, DBUS_TYPE_OBJECT_PATH, &path);
+        dbus_message_iter_open_container (&iter, DBUS_TYPE_ARRAY, "s", &array);
+        dbus_message_iter_append_basic (&array, DBUS_TYPE_STRING, &interface);
+        dbus_message_iter_close_container (&iter, &array);
+
+        dbus_connection_send (connection, signal, NULL);
+        dbus_message_unref (signal);
+}
+
+static void
+append_paths (DBusMessageIter  *iter,
+              const char      **paths)
+{
+        DBusMessageIter array;
+        int             i;
+
+        dbus_message_iter_open_container (iter, DBUS_TYPE_ARRAY, DBUS_TYPE_OBJECT_PATH_AS_STRING, &array);
+        for (i = 0; paths[i] != NULL; i++) {
+                if (dbus_validate_path (paths[i], NULL)) {
+                        dbus_message_iter_append_basic (&array, DBUS_TYPE_OBJECT_PATH, &paths[i]);
+                }
+        }
+        dbus_message_iter_close_container (iter, &array);
+}
+
+void
+gsm_object_manager_emit_batch (DBusConnection  *connection,
+                               const char      *manager_path,
+                               const char      *signal_name,
+                               const char     **added,
+                               const char     **removed)
+{
+        DBusMessage     *signal;
+        DBusMessageIter  iter;
+
+        if (connection == NULL) {
+                return;
+        }
+
+        signal = dbus_message_new_signal (manager_path,
+                                          GSM_CHANGES_DBUS_INTERFACE,
+                                          signal_name);
+        if (signal == NULL) {
+                return;
+        }
+
+        dbus_message_iter_init_append (signal, &iter);
+        append_paths (&iter, added);
+        append_paths (&iter, removed);
+
+        dbus_connection_send (connection, signal, NULL);
+        dbus_message_unref (signal);
+}
+
+void
+gsm_object_manager_emit_changed (DBusConnection *connection,
+                                 const char     *path,
+                                 GObject        *object,
+                                 const char     *property)
+{
+        DBusMessage     *signal;
+        DBusMessageIter  iter;
+        DBusMessageIter  array;
+        const char      *interface;
+
+        if (connection == NULL || ! dbus_validate_path (path, NULL)) {
+                return;
+        }
+
+        interface = gsm_object_manager_interface_for (object);
+        if (interface == NULL) {
+                return;
+        }
+
+        signal = dbus_message_new_signal (path,
+                                          GSM_PROPERTIES_DBUS_INTERFACE,
+                                          "PropertiesChanged");
+        if (signal == NULL) {
+                return;
+        }
+
+        dbus_message_iter_init_append (signal, &iter);
+        dbus_message_iter_append_basic (&iter, DBUS_TYPE_STRING, &interface);
+        append_properties (&iter, object, property);
+        dbus_message_iter_open_container (&iter, DBUS_TYPE_ARRAY, "s", &array);
+        dbus_message_iter_close_container (&iter, &array);
+
+        dbus_connection_send (connection, signal, NULL);
+        dbus_message_unref (signal);
+}
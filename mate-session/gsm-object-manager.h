@@ -0,0 +1,83 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 8 -*-
+ *
+ * Copyright (C) 2012-2021 MATE Developers
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA.
+ *
+ */
+
+#ifndef __GSM_OBJECT_MANAGER_H
+#define __GSM_OBJECT_MANAGER_H
+
+#include <glib-object.h>
+#include <dbus/dbus.h>
+
+#include "gsm-store.h"
+
+G_BEGIN_DECLS
+
+/* Clients and inhibitors are exported as children of
+ * /org/gnome/SessionManager, which implements
+ * org.freedesktop.DBus.ObjectManager so that their data can be fetched
+ * with a single GetManagedObjects() call instead of one call per
+ * object and getter.  The objects themselves also answer
+ * org.freedesktop.DBus.Properties Get() and GetAll().  Apps are served
+ * by GDBus on a connection of their own, where a
+ * GDBusObjectManagerServer at the same path lists them (see gsm-app.c).
+ *
+ * dbus-glib knows about neither interface, so the messages are built
+ * here by hand.
+ */
+#define GSM_OBJECT_MANAGER_DBUS_INTERFACE "org.freedesktop.DBus.ObjectManager"
+#define GSM_PROPERTIES_DBUS_INTERFACE     "org.freedesktop.DBus.Properties"
+
+#define GSM_CLIENT_DBUS_INTERFACE         "org.gnome.SessionManager.Client"
+#define GSM_INHIBITOR_DBUS_INTERFACE      "org.gnome.SessionManager.Inhibitor"
+
+/* The clients and inhibitors added and removed within one main loop
+ * iteration are also announced together, by ClientsChanged(ao added,
+ * ao removed) and InhibitorsChanged(ao added, ao removed) on this
+ * interface, for listeners that would rather not wake up per object */
+#define GSM_CHANGES_DBUS_INTERFACE        "org.mate.SessionManager.Changes"
+
+const char  *gsm_object_manager_interface_for       (GObject         *object);
+
+DBusMessage *gsm_object_manager_get_managed_objects (DBusMessage     *message,
+                                                     GsmStore        *clients,
+                                                     GsmStore        *inhibitors);
+DBusMessage *gsm_object_manager_get_properties      (DBusMessage     *message,
+                                                     GObject         *object);
+
+void         gsm_object_manager_emit_added          (DBusConnection  *connection,
+                                                     const char      *manager_path,
+                                                     const char      *path,
+                                                     GObject         *object);
+void         gsm_object_manager_emit_removed        (DBusConnection  *connection,
+                                                     const char      *manager_path,
+                                                     const char      *path,
+                                                     const char      *interface);
+void         gsm_object_manager_emit_batch          (DBusConnection  *connection,
+                                                     const char      *manager_path,
+                                                     const char      *signal_name,
+                                                     const char     **added,
+                                                     const char     **removed);
+void         gsm_object_manager_emit_changed        (DBusConnection  *connection,
+                                                     const char      *path,
+                                                     GObject         *object,
+                                                     const char      *property);
+
+G_END_DECLS
+
+#endif /* __GSM_OBJECT_MANAGER_H */
@@ -33,6 +33,7 @@
 
 #include "gsm-presence.h"
 #include "gsm-presence-glue.h"
+#include "gsm-dbus-stats.h"
 
 #define GSM_PRESENCE_DBUS_PATH "/org/gnome/SessionManager/Presence"
 
@@ -569,7 +570,7 @@ gsm_presence_class_init (GsmPresenceClass *klass)
                                                             300000,
                                                             G_PARAM_READWRITE | G_PARAM_CONSTRUCT));
 
-        dbus_g_object_type_install_info (GSM_TYPE_PRESENCE, &dbus_glib_gsm_presence_object_info);
+        gsm_dbus_stats_install_info (GSM_TYPE_PRESENCE, &dbus_glib_gsm_presence_object_info);
         dbus_g_error_domain_register (GSM_PRESENCE_ERROR, NULL, GSM_PRESENCE_TYPE_ERROR);
 }
 
@@ -0,0 +1,133 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 8 -*-
+ *
+ * Copyright (C) 2012-2021 MATE Developers
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA.
+ *
+ */
+
+#include "config.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include <glib.h>
+
+#include "gsm-pressure.h"
+
+static const char *resource_names[GSM_PRESSURE_N_RESOURCES] = {
+        "cpu",
+        "io",
+        "memory"
+};
+
+/* The files look like:
+ *
+ *   some avg10=0.00 avg60=0.00 avg300=0.00 total=12345
+ *   full avg10=0.00 avg60=0.00 avg300=0.00 total=6789
+ *
+ * We only look at the total of the "some" line, which is the time in
+ * microseconds during which at least one task was stalled.
+ */
+static gboolean
+read_some_total (GsmPressureResource resource,
+                 guint64            *total)
+{
+        char     *path;
+        FILE     *fp;
+        char      line[256];
+        gboolean  ret;
+
+        path = g_strdup_printf ("/proc/pressure/%s", resource_names[resource]);
+        fp = fopen (path, "re");
+        g_free (path);
+
+        if (fp == NULL) {
+                return FALSE;
+        }
+
+        ret = FALSE;
+        while (fgets (line, sizeof (line), fp) != NULL) {
+                char *p;
+
+                if (strncmp (line, "some ", strlen ("some ")) != 0) {
+                        continue;
+                }
+
+                p = strstr (line, "total=");
+                if (p != NULL) {
+                        *total = g_ascii_strtoull (p + strlen ("total="), NULL, 10);
+                        ret = TRUE;
+                }
+                break;
+        }
+
+        fclose (fp);
+
+        return ret;
+}
+
+/**
+ * gsm_pressure_sample:
+ * @sample: the sample to fill in
+ *
+ * Reads the current stall totals of all resources.
+ *
+ * Returns: %FALSE if the kernel does not provide pressure information
+ */
+gboolean
+gsm_pressure_sample (GsmPressureSample *sample)
+{
+        int i;
+
+        sample->time = g_get_monotonic_time ();
+
+        for (i = 0; i < GSM_PRESSURE_N_RESOURCES; i++) {
+                if (! read_some_total (i, &sample->total[i])) {
+                        return FALSE;
+                }
+        }
+
+        return TRUE;
+}
+
+/**
+ * gsm_pressure_get_percent:
+ *
+ * Returns: the percentage of time some tasks were stalled on @resource
+ * between the two samples
+ */
+double
+gsm_pressure_get_percent (const GsmPressureSample *before,
+                          const GsmPressureSample *after,
+                          GsmPressureResource      resource)
+{
+        gint64 elapsed;
+
+        elapsed = after->time - before->time;
+        if (elapsed <= 0 || after->total[resource] < before->total[resource]) {
+                return 0.0;
+        }
+
+        return 100.0 * (after->total[resource] - before->total[resource]) / elapsed;
+}
+
+const char *
+gsm_pressure_get_name (GsmPressureResource resource)
+{
+        g_return_val_if_fail (resource < GSM_PRESSURE_N_RESOURCES, NULL);
+
+        return resource_names[resource];
+}
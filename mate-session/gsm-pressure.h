@@ -0,0 +1,51 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 8 -*-
+ *
+ * Copyright (C) 2012-2021 MATE Developers
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA.
+ *
+ */
+
+#ifndef __GSM_PRESSURE_H
+#define __GSM_PRESSURE_H
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+typedef enum {
+        GSM_PRESSURE_CPU = 0,
+        GSM_PRESSURE_IO,
+        GSM_PRESSURE_MEMORY,
+        GSM_PRESSURE_N_RESOURCES
+} GsmPressureResource;
+
+/* Cumulative stall times from /proc/pressure, see
+ * Documentation/accounting/psi.rst in the kernel tree.
+ */
+typedef struct {
+        gint64  time;
+        guint64 total[GSM_PRESSURE_N_RESOURCES];
+} GsmPressureSample;
+
+gboolean    gsm_pressure_sample      (GsmPressureSample       *sample);
+double      gsm_pressure_get_percent (const GsmPressureSample *before,
+                                      const GsmPressureSample *after,
+                                      GsmPressureResource      resource);
+const char *gsm_pressure_get_name    (GsmPressureResource      resource);
+
+G_END_DECLS
+
+#endif /* __GSM_PRESSURE_H */
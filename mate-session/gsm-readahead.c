@@ -0,0 +1,242 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 8 -*-
+ *
+ * Copyright (C) 2012-2021 MATE Developers
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA.
+ *
+ */
+
+#include "config.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include <glib.h>
+#include <glib/gstdio.h>
+
+#include "gsm-readahead.h"
+
+/* Don't let a runaway session turn the profile into a full disk scan */
+#define GSM_READAHEAD_MAX_FILES 4096
+
+static char *
+get_profile_path (void)
+{
+        return g_build_filename (g_get_user_cache_dir (),
+                                 "mate-session",
+                                 "readahead",
+                                 NULL);
+}
+
+static void
+prefetch_file (const char *path)
+{
+        struct stat st;
+        int         fd;
+
+        fd = open (path, O_RDONLY | O_CLOEXEC);
+        if (fd < 0) {
+                return;
+        }
+
+        if (fstat (fd, &st) == 0 && S_ISREG (st.st_mode) && st.st_size > 0) {
+#ifdef HAVE_READAHEAD
+                readahead (fd, 0, st.st_size);
+#else
+                posix_fadvise (fd, 0, st.st_size, POSIX_FADV_WILLNEED);
+#endif
+        }
+
+        close (fd);
+}
+
+static gpointer
+readahead_thread (gpointer data)
+{
+        char    *contents = data;
+        char   **paths;
+        int      i;
+        int      n_files;
+        gint64   start;
+
+        start = g_get_monotonic_time ();
+
+        n_files = 0;
+        paths = g_strsplit (contents, "\n", -1);
+        for (i = 0; paths[i] != NULL; i++) {
+                if (paths[i][0] == '/') {
+                        prefetch_file (paths[i]);
+                        n_files++;
+                }
+        }
+
+        g_debug ("GsmReadahead: prefetched %d files in %.3f seconds",
+                 n_files,
+                 (g_get_monotonic_time () - start) / (double) G_USEC_PER_SEC);
+
+        g_strfreev (paths);
+        g_free (contents);
+
+        return NULL;
+}
+
+/* Starts pulling the files recorded during the previous login into
+ * the page cache, so that the applications we are about to start find
+ * their libraries there instead of seeking all over the disk one by
+ * one. The thread only hints the kernel and never blocks the caller.
+ */
+void
+gsm_readahead_start (void)
+{
+        GThread *thread;
+        char    *path;
+        char    *contents;
+
+        path = get_profile_path ();
+        if (!g_file_get_contents (path, &contents, NULL, NULL)) {
+                g_free (path);
+                return;
+        }
+        g_free (path);
+
+        thread = g_thread_try_new ("readahead", readahead_thread, contents, NULL);
+        if (thread == NULL) {
+                g_free (contents);
+                return;
+        }
+
+        g_thread_unref (thread);
+}
+
+/* Lines of /proc/<pid>/maps look like:
+ *
+ *   7f6d1c600000-7f6d1c628000 r--p 00000000 fd:01 1234  /usr/lib/libc.so.6
+ *
+ * Only file backed mappings that still exist on disk are interesting.
+ */
+static void
+add_mapped_files (GPid        pid,
+                  GHashTable *files)
+{
+        char *maps;
+        FILE *fp;
+        char  line[PATH_MAX + 128];
+
+        if (pid > 0) {
+                maps = g_strdup_printf ("/proc/%d/maps", (int) pid);
+        } else {
+                maps = g_strdup ("/proc/self/maps");
+        }
+
+        fp = fopen (maps, "re");
+        g_free (maps);
+
+        if (fp == NULL) {
+                return;
+        }
+
+        while (fgets (line, sizeof (line), fp) != NULL) {
+                char *path;
+
+                path = strchr (line, '/');
+                if (path == NULL) {
+                        continue;
+                }
+
+                g_strchomp (path);
+                if (g_str_has_suffix (path, " (deleted)")
+                    || g_str_has_prefix (path, "/dev/")
+                    || g_str_has_prefix (path, "/memfd:")) {
+                        continue;
+                }
+
+                if (g_hash_table_size (files) >= GSM_READAHEAD_MAX_FILES) {
+                        break;
+                }
+
+                g_hash_table_add (files, g_strdup (path));
+        }
+
+        fclose (fp);
+}
+
+/* Records the files mapped by the given processes, and by ourselves,
+ * as the profile to replay at the next login.
+ */
+gboolean
+gsm_readahead_record (GArray *pids)
+{
+        GHashTable *files;
+        GList      *paths;
+        GList      *l;
+        GString    *contents;
+        char       *path;
+        char       *dir;
+        GError     *error;
+        gboolean    ret;
+        guint       i;
+
+        files = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+
+        add_mapped_files (0, files);
+        for (i = 0; i < pids->len; i++) {
+                add_mapped_files (g_array_index (pids, GPid, i), files);
+        }
+
+        paths = g_list_sort (g_hash_table_get_keys (files), (GCompareFunc) strcmp);
+
+        contents = g_string_new (NULL);
+        for (l = paths; l != NULL; l = l->next) {
+                g_string_append (contents, l->data);
+                g_string_append_c (contents, '\n');
+        }
+
+        g_list_free (paths);
+
+        path = get_profile_path ();
+        dir = g_path_get_dirname (path);
+        g_mkdir_with_parents (dir, 0700);
+        g_free (dir);
+
+        error = NULL;
+        ret = g_file_set_contents (path, contents->str, contents->len, &error);
+        if (!ret) {
+                g_warning ("Unable to save the readahead profile: %s", error->message);
+                g_error_free (error);
+        } else {
+                g_debug ("GsmReadahead: recorded %u files to %s",
+                         g_hash_table_size (files), path);
+        }
+
+        g_free (path);
+        g_string_free (contents, TRUE);
+        g_hash_table_destroy (files);
+
+        return ret;
+}
+
+void
+gsm_readahead_discard (void)
+{
+        char *path;
+
+        path = get_profile_path ();
+        g_unlink (path);
+        g_free (path);
+}
@@ -29,6 +29,7 @@
 #include "gsm-client.h"
 
 #include "gsm-session-save.h"
+#include "gsm-metrics.h"
 
 static gboolean gsm_session_clear_saved_session (const char *directory,
                                                  GHashTable *discard_hash);
@@ -121,9 +122,12 @@ gsm_session_save (GsmStore  *client_store,
         const char      *save_dir;
         char            *tmp_dir;
         SessionSaveData  data;
+        gint64           start;
 
         g_debug ("GsmSessionSave: Saving session");
 
+        start = g_get_monotonic_time ();
+
         save_dir = gsm_util_get_saved_session_dir ();
         if (save_dir == NULL) {
                 g_warning ("GsmSessionSave: cannot create saved session directory");
@@ -156,6 +160,7 @@ gsm_session_save (GsmStore  *client_store,
                         g_rmdir (save_dir);
                 g_rename (tmp_dir, save_dir);
         } else {
+                gsm_metrics_increment (GSM_METRIC_SESSION_SAVE_FAILURES);
                 g_warning ("GsmSessionSave: error saving session: %s", (*error)->message);
                 /* FIXME: we should create a hash table filled with the discard
                  * commands that are in desktop files from save_dir. */
@@ -165,6 +170,9 @@ gsm_session_save (GsmStore  *client_store,
 
         g_hash_table_destroy (data.discard_hash);
         g_free (tmp_dir);
+
+        gsm_metrics_observe (GSM_METRIC_SESSION_SAVE,
+                             g_get_monotonic_time () - start);
 }
 
 static gboolean
@@ -0,0 +1,197 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 8 -*-
+ *
+ * Copyright (C) 2012-2021 MATE Developers
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA.
+ *
+ */
+
+#include "config.h"
+
+#include <glib.h>
+#include <glib/gstdio.h>
+
+#include "gsm-startup-stats.h"
+
+/* How long apps take from being launched to being ready, remembered
+ * across logins. Each app keeps an exponentially weighted mean and
+ * mean deviation, so that a few odd logins don't throw it off and the
+ * file never grows beyond one entry per app.
+ */
+
+/* weight of a new sample, as a fraction 1/N */
+#define GSM_STARTUP_STATS_WEIGHT      4
+
+/* samples needed before the numbers are trusted */
+#define GSM_STARTUP_STATS_MIN_SAMPLES 3
+
+#define KEY_SAMPLES   "Samples"
+#define KEY_MEAN      "Mean"
+#define KEY_DEVIATION "Deviation"
+
+struct _GsmStartupStats {
+        GKeyFile *keyfile;
+        char     *path;
+        gboolean  dirty;
+};
+
+static char *
+get_stats_path (void)
+{
+        const char *state_dir;
+        char       *path;
+
+        /* g_get_user_state_dir() is too recent for us */
+        state_dir = g_getenv ("XDG_STATE_HOME");
+        if (state_dir != NULL && g_path_is_absolute (state_dir)) {
+                path = g_build_filename (state_dir, "mate-session", "startup-times", NULL);
+        } else {
+                path = g_build_filename (g_get_home_dir (), ".local", "state",
+                                         "mate-session", "startup-times", NULL);
+        }
+
+        return path;
+}
+
+GsmStartupStats *
+gsm_startup_stats_load (void)
+{
+        GsmStartupStats *stats;
+        GError          *error;
+
+        stats = g_new0 (GsmStartupStats, 1);
+        stats->keyfile = g_key_file_new ();
+        stats->path = get_stats_path ();
+
+        error = NULL;
+        if (!g_key_file_load_from_file (stats->keyfile, stats->path, G_KEY_FILE_NONE, &error)) {
+                if (!g_error_matches (error, G_FILE_ERROR, G_FILE_ERROR_NOENT)) {
+                        g_warning ("Unable to load startup times from %s: %s",
+                                   stats->path, error->message);
+                }
+                g_error_free (error);
+        }
+
+        return stats;
+}
+
+gboolean
+gsm_startup_stats_save (GsmStartupStats *stats)
+{
+        char     *dir;
+        char     *data;
+        gsize     length;
+        GError   *error;
+        gboolean  ret;
+
+        if (!stats->dirty) {
+                return TRUE;
+        }
+
+        dir = g_path_get_dirname (stats->path);
+        g_mkdir_with_parents (dir, 0700);
+        g_free (dir);
+
+        data = g_key_file_to_data (stats->keyfile, &length, NULL);
+
+        error = NULL;
+        ret = g_file_set_contents (stats->path, data, length, &error);
+        if (!ret) {
+                g_warning ("Unable to save startup times to %s: %s",
+                           stats->path, error->message);
+                g_error_free (error);
+        } else {
+                stats->dirty = FALSE;
+        }
+
+        g_free (data);
+
+        return ret;
+}
+
+void
+gsm_startup_stats_free (GsmStartupStats *stats)
+{
+        if (stats == NULL) {
+                return;
+        }
+
+        g_key_file_free (stats->keyfile);
+        g_free (stats->path);
+        g_free (stats);
+}
+
+void
+gsm_startup_stats_add_sample (GsmStartupStats *stats,
+                              const char      *app_id,
+                              gint64           usec)
+{
+        gint64 n_samples;
+        gint64 mean;
+        gint64 deviation;
+        gint64 msec;
+
+        g_return_if_fail (app_id != NULL);
+
+        msec = usec / 1000;
+
+        n_samples = g_key_file_get_int64 (stats->keyfile, app_id, KEY_SAMPLES, NULL);
+        if (n_samples <= 0) {
+                mean = msec;
+                deviation = msec / 2;
+        } else {
+                mean = g_key_file_get_int64 (stats->keyfile, app_id, KEY_MEAN, NULL);
+                deviation = g_key_file_get_int64 (stats->keyfile, app_id, KEY_DEVIATION, NULL);
+
+                deviation += (ABS (msec - mean) - deviation) / GSM_STARTUP_STATS_WEIGHT;
+                mean += (msec - mean) / GSM_STARTUP_STATS_WEIGHT;
+        }
+
+        g_key_file_set_int64 (stats->keyfile, app_id, KEY_SAMPLES, n_samples + 1);
+        g_key_file_set_int64 (stats->keyfile, app_id, KEY_MEAN, mean);
+        g_key_file_set_int64 (stats->keyfile, app_id, KEY_DEVIATION, deviation);
+
+        stats->dirty = TRUE;
+}
+
+/* Returns FALSE if the app has not been seen often enough yet. The
+ * values are in microseconds.
+ */
+gboolean
+gsm_startup_stats_lookup (GsmStartupStats *stats,
+                          const char      *app_id,
+                          gint64          *mean,
+                          gint64          *deviation)
+{
+        gint64 n_samples;
+
+        if (app_id == NULL) {
+                return FALSE;
+        }
+
+        n_samples = g_key_file_get_int64 (stats->keyfile, app_id, KEY_SAMPLES, NULL);
+        if (n_samples < GSM_STARTUP_STATS_MIN_SAMPLES) {
+                return FALSE;
+        }
+
+        if (mean != NULL) {
+                *mean = g_key_file_get_int64 (stats->keyfile, app_id, KEY_MEAN, NULL) * 1000;
+        }
+        if (deviation != NULL) {
+                *deviation = g_key_file_get_int64 (stats->keyfile, app_id, KEY_DEVIATION, NULL) * 1000;
+        }
+
+        return TRUE;
+}
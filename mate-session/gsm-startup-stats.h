@@ -0,0 +1,44 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 8 -*-
+ *
+ * Copyright (C) 2012-2021 MATE Developers
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA.
+ *
+ */
+
+#ifndef __GSM_STARTUP_STATS_H
+#define __GSM_STARTUP_STATS_H
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+typedef struct _GsmStartupStats GsmStartupStats;
+
+GsmStartupStats *gsm_startup_stats_load       (void);
+gboolean         gsm_startup_stats_save       (GsmStartupStats *stats);
+void             gsm_startup_stats_free       (GsmStartupStats *stats);
+
+void             gsm_startup_stats_add_sample (GsmStartupStats *stats,
+                                               const char      *app_id,
+                                               gint64           usec);
+gboolean         gsm_startup_stats_lookup     (GsmStartupStats *stats,
+                                               const char      *app_id,
+                                               gint64          *mean,
+                                               gint64          *deviation);
+
+G_END_DECLS
+
+#endif /* __GSM_STARTUP_STATS_H */
@@ -0,0 +1,201 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 8 -*-
+ *
+ * Copyright (C) 2012-2021 MATE Developers
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA.
+ *
+ */
+
+#include "config.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+#include <glib.h>
+
+#include "gsm-state-page.h"
+
+struct _GsmStatePage {
+        int               fd;
+        gsize             size;
+        GsmStatePageData *data;
+};
+
+static int
+_memfd_create (const char *name)
+{
+#ifdef __NR_memfd_create
+        unsigned int flags = 0x0001U; /* MFD_CLOEXEC */
+
+#ifdef F_ADD_SEALS
+        flags |= 0x0002U; /* MFD_ALLOW_SEALING */
+#endif
+
+        return syscall (__NR_memfd_create, name, flags);
+#else
+        errno = ENOSYS;
+        return -1;
+#endif
+}
+
+GsmStatePage *
+gsm_state_page_new (void)
+{
+        GsmStatePage *page;
+        int           fd;
+        gsize         size;
+        gpointer      data;
+
+        fd = _memfd_create ("mate-session-state");
+        if (fd < 0) {
+                g_debug ("GsmStatePage: unable to create memfd: %s", g_strerror (errno));
+                return NULL;
+        }
+
+        size = MAX (sysconf (_SC_PAGESIZE), (long) sizeof (GsmStatePageData));
+        if (ftruncate (fd, size) < 0) {
+                g_warning ("Unable to size the session state page: %s", g_strerror (errno));
+                close (fd);
+                return NULL;
+        }
+
+        data = mmap (NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if (data == MAP_FAILED) {
+                g_warning ("Unable to map the session state page: %s", g_strerror (errno));
+                close (fd);
+                return NULL;
+        }
+
+#ifdef F_ADD_SEALS
+        /* nobody gets to resize it under our feet, and where the
+         * kernel allows it, nobody else can map it writable */
+        fcntl (fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW);
+#ifdef F_SEAL_FUTURE_WRITE
+        fcntl (fd, F_ADD_SEALS, F_SEAL_FUTURE_WRITE);
+#endif
+#endif
+
+        page = g_new0 (GsmStatePage, 1);
+        page->fd = fd;
+        page->size = size;
+        page->data = data;
+
+        page->data->magic = GSM_STATE_PAGE_MAGIC;
+        page->data->version = GSM_STATE_PAGE_VERSION;
+
+        return page;
+}
+
+void
+gsm_state_page_free (GsmStatePage *page)
+{
+        if (page == NULL) {
+                return;
+        }
+
+        munmap (page->data, page->size);
+        close (page->fd);
+        g_free (page);
+}
+
+/* Returns a new read-only descriptor for the page, to hand out to a
+ * client, or -1.
+ */
+int
+gsm_state_page_open_readonly (GsmStatePage *page)
+{
+        char *path;
+        int   fd;
+
+        /* a descriptor opened with O_RDONLY can't be mapped writable,
+         * whatever the other end does with it */
+        path = g_strdup_printf ("/proc/self/fd/%d", page->fd);
+        fd = open (path, O_RDONLY | O_CLOEXEC);
+        g_free (path);
+
+        return fd;
+}
+
+static void
+begin_update (GsmStatePage *page)
+{
+        g_atomic_int_inc ((gint *) &page->data->sequence);
+}
+
+static void
+end_update (GsmStatePage *page)
+{
+        g_atomic_int_inc ((gint *) &page->data->sequence);
+}
+
+void
+gsm_state_page_set_phase (GsmStatePage *page,
+                          guint         phase,
+                          gboolean      running)
+{
+        if (page == NULL) {
+                return;
+        }
+
+        begin_update (page);
+        page->data->phase = phase;
+        page->data->session_running = running;
+        end_update (page);
+}
+
+void
+gsm_state_page_set_presence (GsmStatePage *page,
+                             guint         status)
+{
+        if (page == NULL) {
+                return;
+        }
+
+        begin_update (page);
+        page->data->presence_status = status;
+        end_update (page);
+}
+
+void
+gsm_state_page_set_inhibitors (GsmStatePage *page,
+                               guint         n_inhibitors,
+                               guint         inhibited_actions)
+{
+        if (page == NULL) {
+                return;
+        }
+
+        begin_update (page);
+        page->data->n_inhibitors = n_inhibitors;
+        page->data->inhibited_actions = inhibited_actions;
+        end_update (page);
+}
+
+void
+gsm_state_page_set_n_clients (GsmStatePage *page,
+                              guint         n_clients)
+{
+        if (page == NULL) {
+                return;
+        }
+
+        begin_update (page);
+        page->data->n_clients = n_clients;
+        end_update (page);
+}
@@ -0,0 +1,75 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 8 -*-
+ *
+ * Copyright (C) 2012-2021 MATE Developers
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA.
+ *
+ */
+
+#ifndef __GSM_STATE_PAGE_H
+#define __GSM_STATE_PAGE_H
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/* A read-only page of memory with the current session state, that local
+ * clients get through the GetStatePage() method of the
+ * org.mate.SessionManager.StatePage interface on /org/gnome/SessionManager
+ * and mmap() to poll the state without going through the bus.
+ *
+ * The page is written with a sequence lock: the sequence is odd while
+ * an update is in progress. Readers copy the fields they need between
+ * two reads of an even, unchanged sequence, and retry otherwise.
+ *
+ * All fields are native endian 32 bit values.
+ */
+#define GSM_STATE_PAGE_DBUS_INTERFACE "org.mate.SessionManager.StatePage"
+#define GSM_STATE_PAGE_MAGIC          0x5053534d /* "MSSP" */
+#define GSM_STATE_PAGE_VERSION        1
+
+typedef struct {
+        guint32 magic;
+        guint32 version;
+        guint32 sequence;
+
+        guint32 phase;              /* GsmManagerPhase */
+        guint32 session_running;    /* phase is RUNNING */
+        guint32 presence_status;    /* GsmPresenceStatus */
+        guint32 inhibited_actions;  /* flags of all current inhibitors */
+        guint32 n_inhibitors;
+        guint32 n_clients;
+} GsmStatePageData;
+
+typedef struct _GsmStatePage GsmStatePage;
+
+GsmStatePage *gsm_state_page_new                (void);
+void          gsm_state_page_free               (GsmStatePage *page);
+int           gsm_state_page_open_readonly      (GsmStatePage *page);
+
+void          gsm_state_page_set_phase          (GsmStatePage *page,
+                                                 guint         phase,
+                                                 gboolean      running);
+void          gsm_state_page_set_presence       (GsmStatePage *page,
+                                                 guint         status);
+void          gsm_state_page_set_inhibitors     (GsmStatePage *page,
+                                                 guint         n_inhibitors,
+                                                 guint         inhibited_actions);
+void          gsm_state_page_set_n_clients      (GsmStatePage *page,
+                                                 guint         n_clients);
+
+G_END_DECLS
+
+#endif /* __GSM_STATE_PAGE_H */
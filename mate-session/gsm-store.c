@@ -37,11 +37,17 @@ typedef struct
 {
         GHashTable *objects;
         gboolean    locked;
+
+        /* ids added and removed since "changed" was last emitted */
+        GPtrArray  *pending_added;
+        GPtrArray  *pending_removed;
+        guint       changed_id;
 } GsmStorePrivate;
 
 enum {
         ADDED,
         REMOVED,
+        CHANGED,
         LAST_SIGNAL
 };
 
@@ -75,6 +81,89 @@ gsm_store_size (GsmStore    *store)
         return g_hash_table_size (priv->objects);
 }
 
+static void
+emit_changed (GsmStore *store)
+{
+        GsmStorePrivate *priv;
+        GPtrArray       *added;
+        GPtrArray       *removed;
+
+        priv = gsm_store_get_instance_private (store);
+
+        added = priv->pending_added;
+        removed = priv->pending_removed;
+        priv->pending_added = g_ptr_array_new_with_free_func (g_free);
+        priv->pending_removed = g_ptr_array_new_with_free_func (g_free);
+
+        if (added->len > 0 || removed->len > 0) {
+                g_debug ("GsmStore: emitting changed, %u added, %u removed",
+                         added->len, removed->len);
+
+                g_ptr_array_add (added, NULL);
+                g_ptr_array_add (removed, NULL);
+                g_signal_emit (store, signals [CHANGED], 0,
+                               added->pdata, removed->pdata);
+        }
+
+        g_ptr_array_free (added, TRUE);
+        g_ptr_array_free (removed, TRUE);
+}
+
+static gboolean
+on_changed_idle (GsmStore *store)
+{
+        GsmStorePrivate *priv;
+
+        priv = gsm_store_get_instance_private (store);
+        priv->changed_id = 0;
+
+        emit_changed (store);
+
+        return FALSE;
+}
+
+static gboolean
+remove_pending (GPtrArray  *array,
+                const char *id)
+{
+        guint i;
+
+        for (i = 0; i < array->len; i++) {
+                if (strcmp (g_ptr_array_index (array, i), id) == 0) {
+                        g_ptr_array_remove_index (array, i);
+                        return TRUE;
+                }
+        }
+
+        return FALSE;
+}
+
+/* Adds or removes of a whole main loop iteration are reported in one
+ * "changed" emission.  An object added and removed again within it is
+ * not reported at all. */
+static void
+queue_changed (GsmStore   *store,
+               const char *id,
+               gboolean    added)
+{
+        GsmStorePrivate *priv;
+
+        priv = gsm_store_get_instance_private (store);
+
+        if (added) {
+                g_ptr_array_add (priv->pending_added, g_strdup (id));
+        } else if (! remove_pending (priv->pending_added, id)) {
+                g_ptr_array_add (priv->pending_removed, g_strdup (id));
+        }
+
+        if (priv->changed_id == 0) {
+                priv->changed_id = g_idle_add_full (G_PRIORITY_DEFAULT,
+                                                    (GSourceFunc)on_changed_idle,
+                                                    store,
+                                                    NULL);
+        }
+}
+
 gboolean
 gsm_store_remove (GsmStore   *store,
                   const char *id)
@@ -100,6 +189,7 @@ gsm_store_remove (GsmStore   *store,
         g_assert (removed);
 
         g_signal_emit (store, signals [REMOVED], 0, id_copy);
+        queue_changed (store, id_copy, FALSE);
 
         g_object_unref (found);
         g_free (id_copy);
@@ -206,6 +296,7 @@ gsm_store_foreach_remove (GsmStore    *store,
                 id = data.removed->data;
                 g_debug ("GsmStore: emitting removed for %s", id);
                 g_signal_emit (store, signals [REMOVED], 0, id);
+                queue_changed (store, id, FALSE);
                 g_free (data.removed->data);
                 data.removed->data = NULL;
                 data.removed = g_list_delete_link (data.removed, data.removed);
@@ -259,6 +350,7 @@ gsm_store_add (GsmStore   *store,
                              g_object_ref (object));
 
         g_signal_emit (store, signals [ADDED], 0, id);
+        queue_changed (store, id, TRUE);
 
         return TRUE;
 }
@@ -330,14 +422,22 @@ static void
 gsm_store_dispose (GObject *object)
 {
         GsmStore *store;
+        GsmStorePrivate *priv;
 
         g_return_if_fail (object != NULL);
         g_return_if_fail (GSM_IS_STORE (object));
 
         store = GSM_STORE (object);
+        priv = gsm_store_get_instance_private (store);
 
         gsm_store_clear (store);
 
+        /* nobody is left to be told */
+        if (priv->changed_id > 0) {
+                g_source_remove (priv->changed_id);
+                priv->changed_id = 0;
+        }
+
         G_OBJECT_CLASS (gsm_store_parent_class)->dispose (object);
 }
 
@@ -371,6 +471,16 @@ gsm_store_class_init (GsmStoreClass *klass)
                               g_cclosure_marshal_VOID__STRING,
                               G_TYPE_NONE,
                               1, G_TYPE_STRING);
+        signals [CHANGED] =
+                g_signal_new ("changed",
+                              G_TYPE_FROM_CLASS (object_class),
+                              G_SIGNAL_RUN_LAST,
+                              G_STRUCT_OFFSET (GsmStoreClass, changed),
+                              NULL,
+                              NULL,
+                              NULL,
+                              G_TYPE_NONE,
+                              2, G_TYPE_STRV, G_TYPE_STRV);
         g_object_class_install_property (object_class,
                                          PROP_LOCKED,
                                          g_param_spec_boolean ("locked",
@@ -397,6 +507,8 @@ gsm_store_init (GsmStore *store)
                                                g_str_equal,
                                                g_free,
                                                (GDestroyNotify) _destroy_object);
+        priv->pending_added = g_ptr_array_new_with_free_func (g_free);
+        priv->pending_removed = g_ptr_array_new_with_free_func (g_free);
 }
 
 static void
@@ -414,6 +526,8 @@ gsm_store_finalize (GObject *object)
         g_return_if_fail (priv != NULL);
 
         g_hash_table_destroy (priv->objects);
+        g_ptr_array_free (priv->pending_added, TRUE);
+        g_ptr_array_free (priv->pending_removed, TRUE);
 
         G_OBJECT_CLASS (gsm_store_parent_class)->finalize (object);
 }
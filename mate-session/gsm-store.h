@@ -37,6 +37,9 @@ struct _GsmStoreClass
                                     const char *id);
         void          (* removed)  (GsmStore   *store,
                                     const char *id);
+        void          (* changed)  (GsmStore    *store,
+                                    const char **added,
+                                    const char **removed);
 };
 
 typedef enum
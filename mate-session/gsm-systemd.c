@@ -51,6 +51,10 @@ typedef struct
     DBusGProxy      *bus_proxy;
     DBusGProxy      *sd_proxy;
     guint32          is_connected : 1;
+
+    /* logind "delay" inhibitor on sleep */
+    int              sleep_delay_fd;
+    DBusPendingCall *sleep_delay_call;
 } GsmSystemdPrivate;
 
 enum {
@@ -61,6 +65,7 @@ enum {
 enum {
     REQUEST_COMPLETED = 0,
     PRIVILEGES_COMPLETED,
+    PREPARE_FOR_SLEEP,
     LAST_SIGNAL
 };
 
@@ -147,6 +152,17 @@ gsm_systemd_class_init (GsmSystemdClass *manager_class)
                           gsm_marshal_VOID__BOOLEAN_BOOLEAN_POINTER,
                           G_TYPE_NONE,
                           3, G_TYPE_BOOLEAN, G_TYPE_BOOLEAN, G_TYPE_POINTER);
+
+    signals [PREPARE_FOR_SLEEP] =
+            g_signal_new ("prepare-for-sleep",
+                          G_OBJECT_CLASS_TYPE (object_class),
+                          G_SIGNAL_RUN_LAST,
+                          G_STRUCT_OFFSET (GsmSystemdClass, prepare_for_sleep),
+                          NULL,
+                          NULL,
+                          g_cclosure_marshal_VOID__BOOLEAN,
+                          G_TYPE_NONE,
+                          1, G_TYPE_BOOLEAN);
 }
 
 static DBusHandlerResult
@@ -163,6 +179,14 @@ gsm_systemd_dbus_filter (DBusConnection *connection,
         strcmp (dbus_message_get_path (message), DBUS_PATH_LOCAL) == 0) {
             gsm_systemd_free_dbus (manager);
             return DBUS_HANDLER_RESULT_HANDLED;
+    } else if (dbus_message_is_signal (message, SD_INTERFACE, "PrepareForSleep")) {
+            dbus_bool_t start;
+
+            if (dbus_message_get_args (message, NULL,
+                                       DBUS_TYPE_BOOLEAN, &start,
+                                       DBUS_TYPE_INVALID)) {
+                    g_signal_emit (manager, signals [PREPARE_FOR_SLEEP], 0, start != FALSE);
+            }
     }
 
     return DBUS_HANDLER_RESULT_NOT_YET_HANDLED;
@@ -197,6 +221,13 @@ gsm_systemd_ensure_sd_connection (GsmSystemd  *manager,
         dbus_connection_add_filter (connection,
                                     gsm_systemd_dbus_filter,
                                     manager, NULL);
+        dbus_bus_add_match (connection,
+                            "type='signal',"
+                            "sender='" SD_NAME "',"
+                            "path='" SD_PATH "',"
+                            "interface='" SD_INTERFACE "',"
+                            "member='PrepareForSleep'",
+                            NULL);
     }
 
     if (priv->bus_proxy == NULL) {
@@ -297,9 +328,13 @@ static void
 gsm_systemd_init (GsmSystemd *manager)
 {
     GError *error;
+    GsmSystemdPrivate *priv;
 
     error = NULL;
 
+    priv = gsm_systemd_get_instance_private (manager);
+    priv->sleep_delay_fd = -1;
+
     if (!gsm_systemd_ensure_sd_connection (manager, &error)) {
         g_warning ("Could not connect to Systemd: %s",
                    error->message);
@@ -313,6 +348,12 @@ gsm_systemd_free_dbus (GsmSystemd *manager)
     GsmSystemdPrivate *priv;
 
     priv = gsm_systemd_get_instance_private (manager);
+    if (priv->sleep_delay_call != NULL) {
+        dbus_pending_call_cancel (priv->sleep_delay_call);
+        dbus_pending_call_unref (priv->sleep_delay_call);
+        priv->sleep_delay_call = NULL;
+    }
+
     if (priv->bus_proxy != NULL) {
         g_object_unref (priv->bus_proxy);
         priv->bus_proxy = NULL;
@@ -346,6 +387,7 @@ gsm_systemd_finalize (GObject *object)
     parent_class = G_OBJECT_CLASS (gsm_systemd_parent_class);
 
     gsm_systemd_free_dbus (manager);
+    gsm_systemd_release_sleep_delay (manager);
 
     if (parent_class->finalize != NULL) {
         parent_class->finalize (object);
@@ -969,6 +1011,131 @@ gsm_systemd_attempt_suspend (GsmSystemd *manager)
   }
 }
 
+static void
+on_sleep_delay_reply (DBusPendingCall *call,
+                      GsmSystemd      *manager)
+{
+    DBusMessage *reply;
+    DBusError    error;
+    int          fd;
+    GsmSystemdPrivate *priv;
+
+    priv = gsm_systemd_get_instance_private (manager);
+
+    reply = dbus_pending_call_steal_reply (call);
+    dbus_pending_call_unref (priv->sleep_delay_call);
+    priv->sleep_delay_call = NULL;
+
+    if (reply == NULL) {
+        return;
+    }
+
+    dbus_error_init (&error);
+#ifdef DBUS_TYPE_UNIX_FD
+    if (dbus_set_error_from_message (&error, reply)
+        || ! dbus_message_get_args (reply, &error,
+                                    DBUS_TYPE_UNIX_FD, &fd,
+                                    DBUS_TYPE_INVALID)) {
+        g_warning ("Could not take the sleep delay lock: %s", error.message);
+        dbus_error_free (&error);
+    } else {
+        g_debug ("GsmSystemd: took the sleep delay lock");
+        gsm_systemd_release_sleep_delay (manager);
+        priv->sleep_delay_fd = fd;
+    }
+#endif
+
+    dbus_message_unref (reply);
+}
+
+/* Asks logind to delay sleep until gsm_systemd_release_sleep_delay() is
+ * called, so that there is time to get ready for it once it is
+ * announced by "prepare-for-sleep".  Does nothing if the lock is held
+ * already or being asked for. */
+void
+gsm_systemd_take_sleep_delay (GsmSystemd *manager)
+{
+#ifdef DBUS_TYPE_UNIX_FD
+    DBusConnection *connection;
+    DBusMessage    *message;
+    GError         *error;
+    const char     *what = "sleep";
+    const char     *who = "MATE Session Manager";
+    const char     *why = "Locking the screen before sleep";
+    const char     *mode = "delay";
+    GsmSystemdPrivate *priv;
+
+    error = NULL;
+    priv = gsm_systemd_get_instance_private (manager);
+
+    if (priv->sleep_delay_fd >= 0 || priv->sleep_delay_call != NULL) {
+        return;
+    }
+
+    if (!gsm_systemd_ensure_sd_connection (manager, &error)) {
+        g_warning ("Could not connect to Systemd: %s",
+                   error->message);
+        g_error_free (error);
+        return;
+    }
+
+    connection = dbus_g_connection_get_connection (priv->dbus_connection);
+    if (!dbus_connection_can_send_type (connection, DBUS_TYPE_UNIX_FD)) {
+        return;
+    }
+
+    message = dbus_message_new_method_call (SD_NAME,
+                                            SD_PATH,
+                                            SD_INTERFACE,
+                                            "Inhibit");
+    if (message == NULL) {
+        return;
+    }
+
+    dbus_message_append_args (message,
+                              DBUS_TYPE_STRING, &what,
+                              DBUS_TYPE_STRING, &who,
+                              DBUS_TYPE_STRING, &why,
+                              DBUS_TYPE_STRING, &mode,
+                              DBUS_TYPE_INVALID);
+
+    if (dbus_connection_send_with_reply (connection, message,
+                                         &priv->sleep_delay_call, -1)
+        && priv->sleep_delay_call != NULL) {
+        dbus_pending_call_set_notify (priv->sleep_delay_call,
+                                      (DBusPendingCallNotifyFunction) on_sleep_delay_reply,
+                                      manager, NULL);
+    }
+
+    dbus_message_unref (message);
+#endif
+}
+
+/* Lets the announced sleep go on */
+void
+gsm_systemd_release_sleep_delay (GsmSystemd *manager)
+{
+    GsmSystemdPrivate *priv;
+
+    priv = gsm_systemd_get_instance_private (manager);
+
+    if (priv->sleep_delay_fd >= 0) {
+        g_debug ("GsmSystemd: releasing the sleep delay lock");
+        close (priv->sleep_delay_fd);
+        priv->sleep_delay_fd = -1;
+    }
+}
+
+gboolean
+gsm_systemd_has_sleep_delay (GsmSystemd *manager)
+{
+    GsmSystemdPrivate *priv;
+
+    priv = gsm_systemd_get_instance_private (manager);
+
+    return priv->sleep_delay_fd >= 0;
+}
+
 gchar *
 gsm_systemd_get_current_session_type (GsmSystemd *manager)
 {
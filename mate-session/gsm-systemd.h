@@ -48,6 +48,9 @@ struct _GsmSystemdClass
                                        gboolean       success,
                                        gboolean       ask_later,
                                        GError        *error);
+
+        void (* prepare_for_sleep) (GsmSystemd *manager,
+                                    gboolean    start);
 };
 
 enum _GsmSystemdError {
@@ -85,6 +88,12 @@ void             gsm_systemd_attempt_hibernate (GsmSystemd *manager);
 
 void             gsm_systemd_attempt_suspend (GsmSystemd *manager);
 
+void             gsm_systemd_take_sleep_delay    (GsmSystemd *manager);
+
+void             gsm_systemd_release_sleep_delay (GsmSystemd *manager);
+
+gboolean         gsm_systemd_has_sleep_delay     (GsmSystemd *manager);
+
 void             gsm_systemd_set_session_idle (GsmSystemd *manager,
                                                   gboolean       is_idle);
 
@@ -350,6 +350,40 @@ gsm_util_text_is_blank (const char *str)
         return TRUE;
 }
 
+static gboolean gtk_initialized = FALSE;
+
+/**
+ * gsm_util_ensure_gtk:
+ *
+ * Initializes GTK+ the first time it is needed. The session manager
+ * itself only needs GDK to talk to the X server; GTK+, its settings,
+ * theme and modules are only brought up when there is a dialog to
+ * show, which keeps them off the login path.
+ *
+ * Returns: %TRUE if GTK+ can be used
+ **/
+gboolean
+gsm_util_ensure_gtk (void)
+{
+        if (!gtk_initialized) {
+                gtk_initialized = gtk_init_check (NULL, NULL);
+        }
+
+        return gtk_initialized;
+}
+
+/**
+ * gsm_util_has_gtk:
+ *
+ * Returns: %TRUE if GTK+ has already been initialized by
+ * gsm_util_ensure_gtk(); never initializes it
+ **/
+gboolean
+gsm_util_has_gtk (void)
+{
+        return gtk_initialized;
+}
+
 /**
  * gsm_util_init_error:
  * @fatal: whether or not the error is fatal to the login session
@@ -375,14 +409,12 @@ gsm_util_init_error (gboolean    fatal,
         msg = g_strdup_vprintf (format, args);
         va_end (args);
 
-        /* If option parsing failed, Gtk won't have been initialized... */
-        if (!gdk_display_get_default ()) {
-                if (!gtk_init_check (NULL, NULL)) {
-                        /* Oh well, no X for you! */
-                        g_printerr (_("Unable to start login session (and unable to connect to the X server)"));
-                        g_printerr ("%s", msg);
-                        exit (1);
-                }
+        /* Gtk is only initialized on demand, and may not be able to */
+        if (!gsm_util_ensure_gtk ()) {
+                /* Oh well, no X for you! */
+                g_printerr (_("Unable to start login session (and unable to connect to the X server)"));
+                g_printerr ("%s", msg);
+                exit (1);
         }
 
         dialog = gtk_message_dialog_new (NULL, 0, GTK_MESSAGE_ERROR,
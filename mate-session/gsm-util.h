@@ -49,6 +49,8 @@ gboolean    gsm_util_text_is_blank                  (const char *str);
 
 void        gsm_util_init_error                     (gboolean    fatal,
                                                      const char *format, ...);
+gboolean    gsm_util_ensure_gtk                     (void);
+gboolean    gsm_util_has_gtk                        (void);
 
 char *      gsm_util_generate_startup_id            (void);
 
@@ -0,0 +1,373 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 8 -*-
+ *
+ * Copyright (C) 2012-2021 MATE Developers
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA.
+ *
+ */
+
+#include "config.h"
+
+#include <errno.h>
+#include <signal.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#ifdef HAVE_EXECINFO_H
+#include <execinfo.h>
+#endif
+
+#include <glib.h>
+#include <dbus/dbus.h>
+
+#include "gsm-watchdog.h"
+
+/* The main loop reports that it is alive twice per stall threshold or
+ * per systemd ping, whichever is shorter, but not more often than this */
+#define GSM_WATCHDOG_MIN_HEARTBEAT_MS 100
+
+static const guint64 bucket_bounds[] = {
+        1000, 2000, 5000, 10000, 20000, 50000, 100000,
+        200000, 500000, 1000000, 2000000, 5000000, G_MAXUINT64
+};
+
+typedef struct {
+        GMutex     mutex;
+        GCond      cond;
+        GThread   *thread;
+        gboolean   quit;
+
+        guint      heartbeat_id;
+        gint64     heartbeat_interval;  /* usec */
+        pthread_t  main_thread;
+
+        /* protected by mutex */
+        gint64     last_beat;
+        gboolean   stall_reported;
+
+        gint64     stall_threshold;   /* usec, 0 to not report stalls */
+        gint64     alive_limit;       /* usec, longest stall systemd is
+                                       * still told we are alive for */
+
+        /* only touched from the main thread */
+        guint64    counts[G_N_ELEMENTS (bucket_bounds)];
+        guint64    max_latency;
+
+        int                 notify_fd;
+        struct sockaddr_un  notify_addr;
+        socklen_t           notify_addr_len;
+        gint64              notify_interval;  /* usec, 0 if not asked for */
+} GsmWatchdog;
+
+static GsmWatchdog *watchdog = NULL;
+
+#ifdef HAVE_EXECINFO_H
+static void
+on_backtrace_signal (int signo)
+{
+        void *frames[64];
+        int   size;
+
+        /* backtrace_symbols_fd() doesn't allocate, so it is fine here */
+        size = backtrace (frames, G_N_ELEMENTS (frames));
+        backtrace_symbols_fd (frames, size, STDERR_FILENO);
+}
+
+static void
+setup_backtrace_signal (void)
+{
+        struct sigaction sa;
+        void            *frame;
+
+        /* the first call loads libgcc, which must not happen in the
+         * signal handler */
+        backtrace (&frame, 1);
+
+        memset (&sa, 0, sizeof (sa));
+        sa.sa_handler = on_backtrace_signal;
+        sa.sa_flags = SA_RESTART;
+        sigemptyset (&sa.sa_mask);
+        sigaction (SIGRTMIN, &sa, NULL);
+}
+#endif
+
+static void
+setup_systemd_watchdog (void)
+{
+        const char *socket_path;
+        const char *value;
+        guint64     usec;
+
+        watchdog->notify_fd = -1;
+        watchdog->notify_interval = 0;
+
+        value = g_getenv ("WATCHDOG_USEC");
+        if (value == NULL) {
+                return;
+        }
+
+        usec = g_ascii_strtoull (value, NULL, 10);
+        if (usec == 0) {
+                return;
+        }
+
+        value = g_getenv ("WATCHDOG_PID");
+        if (value != NULL && (pid_t) g_ascii_strtoull (value, NULL, 10) != getpid ()) {
+                return;
+        }
+
+        socket_path = g_getenv ("NOTIFY_SOCKET");
+        if (socket_path == NULL
+            || (socket_path[0] != '/' && socket_path[0] != '@')
+            || strlen (socket_path) >= sizeof (watchdog->notify_addr.sun_path)) {
+                return;
+        }
+
+        watchdog->notify_fd = socket (AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+        if (watchdog->notify_fd < 0) {
+                g_warning ("GsmWatchdog: unable to create notification socket: %s",
+                           g_strerror (errno));
+                return;
+        }
+
+        memset (&watchdog->notify_addr, 0, sizeof (watchdog->notify_addr));
+        watchdog->notify_addr.sun_family = AF_UNIX;
+        strncpy (watchdog->notify_addr.sun_path, socket_path,
+                 sizeof (watchdog->notify_addr.sun_path) - 1);
+        if (socket_path[0] == '@') {
+                /* abstract socket */
+                watchdog->notify_addr.sun_path[0] = '\0';
+        }
+        watchdog->notify_addr_len = offsetof (struct sockaddr_un, sun_path) + strlen (socket_path);
+
+        /* ping twice per period, as systemd recommends */
+        watchdog->notify_interval = usec / 2;
+
+        g_debug ("GsmWatchdog: systemd watchdog enabled, pinging every %" G_GINT64_FORMAT " ms",
+                 watchdog->notify_interval / 1000);
+}
+
+static void
+notify_systemd_watchdog (void)
+{
+        static const char message[] = "WATCHDOG=1";
+
+        if (sendto (watchdog->notify_fd, message, sizeof (message) - 1, MSG_NOSIGNAL,
+                    (struct sockaddr *) &watchdog->notify_addr,
+                    watchdog->notify_addr_len) < 0) {
+                g_debug ("GsmWatchdog: unable to notify systemd: %s", g_strerror (errno));
+        }
+}
+
+static gboolean
+on_heartbeat (gpointer data)
+{
+        gint64   now;
+        gint64   latency;
+        gboolean stall_reported;
+        guint    i;
+
+        now = g_get_monotonic_time ();
+
+        g_mutex_lock (&watchdog->mutex);
+        latency = now - watchdog->last_beat - watchdog->heartbeat_interval;
+        watchdog->last_beat = now;
+        stall_reported = watchdog->stall_reported;
+        watchdog->stall_reported = FALSE;
+        g_mutex_unlock (&watchdog->mutex);
+
+        if (latency < 0) {
+                latency = 0;
+        }
+
+        for (i = 0; latency > (gint64) bucket_bounds[i]; i++);
+        watchdog->counts[i]++;
+        watchdog->max_latency = MAX (watchdog->max_latency, (guint64) latency);
+
+        if (stall_reported) {
+                g_warning ("GsmWatchdog: main loop is running again after %" G_GINT64_FORMAT " ms",
+                           latency / 1000);
+        }
+
+        return G_SOURCE_CONTINUE;
+}
+
+static gpointer
+watchdog_thread (gpointer data)
+{
+        gint64 period;
+        gint64 next_ping;
+
+        period = watchdog->heartbeat_interval;
+        next_ping = 0;
+
+        g_mutex_lock (&watchdog->mutex);
+        while (!watchdog->quit) {
+                gint64 now;
+                gint64 stalled;
+
+                g_cond_wait_until (&watchdog->cond, &watchdog->mutex,
+                                   g_get_monotonic_time () + period);
+                if (watchdog->quit) {
+                        break;
+                }
+
+                now = g_get_monotonic_time ();
+                stalled = now - watchdog->last_beat - watchdog->heartbeat_interval;
+
+                if (watchdog->stall_threshold > 0
+                    && stalled > watchdog->stall_threshold
+                    && !watchdog->stall_reported) {
+                        watchdog->stall_reported = TRUE;
+
+                        g_warning ("GsmWatchdog: main loop has been blocked for %" G_GINT64_FORMAT " ms",
+                                   stalled / 1000);
+#ifdef HAVE_EXECINFO_H
+                        /* have the main thread print where it is stuck */
+                        pthread_kill (watchdog->main_thread, SIGRTMIN);
+#endif
+                }
+
+                /* only tell systemd we are alive while we are */
+                if (watchdog->notify_interval > 0
+                    && now >= next_ping
+                    && stalled <= watchdog->alive_limit) {
+                        notify_systemd_watchdog ();
+                        next_ping = now + watchdog->notify_interval;
+                }
+        }
+        g_mutex_unlock (&watchdog->mutex);
+
+        return NULL;
+}
+
+void
+gsm_watchdog_start (int stall_threshold_ms)
+{
+        if (watchdog != NULL) {
+                return;
+        }
+
+        watchdog = g_new0 (GsmWatchdog, 1);
+        g_mutex_init (&watchdog->mutex);
+        g_cond_init (&watchdog->cond);
+
+        watchdog->stall_threshold = (gint64) MAX (stall_threshold_ms, 0) * 1000;
+        watchdog->main_thread = pthread_self ();
+        watchdog->last_beat = g_get_monotonic_time ();
+
+        setup_systemd_watchdog ();
+
+        /* nobody to tell about the main loop, don't wake it up */
+        if (watchdog->stall_threshold == 0 && watchdog->notify_interval == 0) {
+                g_debug ("GsmWatchdog: stall reporting and systemd watchdog are both off");
+                g_mutex_clear (&watchdog->mutex);
+                g_cond_clear (&watchdog->cond);
+                g_clear_pointer (&watchdog, g_free);
+                return;
+        }
+
+        if (watchdog->stall_threshold > 0 && watchdog->notify_interval > 0) {
+                watchdog->heartbeat_interval = MIN (watchdog->stall_threshold, watchdog->notify_interval) / 2;
+                watchdog->alive_limit = MIN (watchdog->stall_threshold, watchdog->notify_interval);
+        } else if (watchdog->stall_threshold > 0) {
+                watchdog->heartbeat_interval = watchdog->stall_threshold / 2;
+        } else {
+                watchdog->heartbeat_interval = watchdog->notify_interval / 2;
+                watchdog->alive_limit = watchdog->notify_interval;
+        }
+        watchdog->heartbeat_interval = MAX (watchdog->heartbeat_interval,
+                                            GSM_WATCHDOG_MIN_HEARTBEAT_MS * 1000);
+
+        g_debug ("GsmWatchdog: main loop heartbeat every %" G_GINT64_FORMAT " ms",
+                 watchdog->heartbeat_interval / 1000);
+
+#ifdef HAVE_EXECINFO_H
+        setup_backtrace_signal ();
+#endif
+
+        watchdog->heartbeat_id = g_timeout_add (watchdog->heartbeat_interval / 1000,
+                                                on_heartbeat,
+                                                NULL);
+        g_source_set_name_by_id (watchdog->heartbeat_id, "[mate-session] watchdog heartbeat");
+
+        watchdog->thread = g_thread_new ("gsm-watchdog", watchdog_thread, NULL);
+}
+
+void
+gsm_watchdog_stop (void)
+{
+        if (watchdog == NULL) {
+                return;
+        }
+
+        g_mutex_lock (&watchdog->mutex);
+        watchdog->quit = TRUE;
+        g_cond_signal (&watchdog->cond);
+        g_mutex_unlock (&watchdog->mutex);
+
+        g_thread_join (watchdog->thread);
+
+        g_source_remove (watchdog->heartbeat_id);
+
+        if (watchdog->notify_fd >= 0) {
+                close (watchdog->notify_fd);
+        }
+
+        g_mutex_clear (&watchdog->mutex);
+        g_cond_clear (&watchdog->cond);
+        g_clear_pointer (&watchdog, g_free);
+}
+
+DBusMessage *
+gsm_watchdog_get_latency_reply (DBusMessage *message)
+{
+        DBusMessage     *reply;
+        DBusMessageIter  iter;
+        DBusMessageIter  array;
+        const guint64   *bounds;
+        const guint64   *counts;
+        dbus_uint64_t    max_latency;
+        guint64          empty[G_N_ELEMENTS (bucket_bounds)] = { 0 };
+
+        reply = dbus_message_new_method_return (message);
+        if (reply == NULL) {
+                return NULL;
+        }
+
+        bounds = bucket_bounds;
+        counts = watchdog != NULL ? watchdog->counts : empty;
+        max_latency = watchdog != NULL ? watchdog->max_latency : 0;
+
+        dbus_message_iter_init_append (reply, &iter);
+
+        dbus_message_iter_open_container (&iter, DBUS_TYPE_ARRAY, DBUS_TYPE_UINT64_AS_STRING, &array);
+        dbus_message_iter_append_fixed_array (&array, DBUS_TYPE_UINT64, &bounds,
+                                              G_N_ELEMENTS (bucket_bounds));
+        dbus_message_iter_close_container (&iter, &array);
+
+        dbus_message_iter_open_container (&iter, DBUS_TYPE_ARRAY, DBUS_TYPE_UINT64_AS_STRING, &array);
+        dbus_message_iter_append_fixed_array (&array, DBUS_TYPE_UINT64, &counts,
+                                              G_N_ELEMENTS (bucket_bounds));
+        dbus_message_iter_close_container (&iter, &array);
+
+        dbus_message_iter_append_basic (&iter, DBUS_TYPE_UINT64, &max_latency);
+
+        return reply;
+}
@@ -0,0 +1,52 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 8 -*-
+ *
+ * Copyright (C) 2012-2021 MATE Developers
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA.
+ *
+ */
+
+#ifndef __GSM_WATCHDOG_H
+#define __GSM_WATCHDOG_H
+
+#include <glib.h>
+#include <dbus/dbus.h>
+
+G_BEGIN_DECLS
+
+/* Watches the main loop from a separate thread.  A dispatch that takes
+ * longer than the stall threshold is logged, with a backtrace of the
+ * main thread when available, and the dispatch latencies are kept in a
+ * histogram that GetLatencyHistogram() of the
+ * org.mate.SessionManager.Watchdog interface on /org/gnome/SessionManager
+ * returns as (bucket upper bounds, counts, maximum), all in microseconds.
+ *
+ * When started by a systemd unit with WatchdogSec= set, the thread also
+ * sends WATCHDOG=1 as long as the main loop keeps running.
+ *
+ * The main loop checks in twice per stall threshold or systemd ping
+ * period, so it is not woken up more than needed; with a threshold of
+ * 0 and no systemd watchdog, nothing is started at all.
+ */
+#define GSM_WATCHDOG_DBUS_INTERFACE "org.mate.SessionManager.Watchdog"
+
+void         gsm_watchdog_start             (int          stall_threshold_ms);
+void         gsm_watchdog_stop              (void);
+
+DBusMessage *gsm_watchdog_get_latency_reply (DBusMessage *message);
+
+G_END_DECLS
+
+#endif /* __GSM_WATCHDOG_H */
@@ -0,0 +1,532 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 8 -*-
+ *
+ * Copyright (C) 2012-2021 MATE Developers
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA.
+ *
+ */
+
+#include "config.h"
+
+#include <string.h>
+
+#include <glib.h>
+#include <gdk/gdk.h>
+#include <gdk/gdkx.h>
+#include <X11/Xlib.h>
+#include <X11/Xatom.h>
+
+#include "gsm-window-watcher.h"
+#include "gsm-marshal.h"
+
+/* Watches the root window while the session starts, to tell when the
+ * window manager is up and when applications have mapped their first
+ * window or completed their startup notification. Apps that never
+ * register with us can then still be considered ready.
+ */
+
+typedef struct {
+        Display    *xdisplay;
+        Window      root;
+
+        Atom        net_supporting_wm_check;
+        Atom        net_client_list;
+        Atom        net_wm_pid;
+        Atom        net_startup_id;
+        Atom        net_startup_info_begin;
+        Atom        net_startup_info;
+        Atom        wm_client_leader;
+        Atom        sm_client_id;
+        Atom        utf8_string;
+
+        gboolean    window_manager_ready;
+
+        /* Window -> nothing, the client windows we already know about */
+        GHashTable *known_windows;
+
+        /* Window -> GString, startup notification messages being received */
+        GHashTable *startup_messages;
+} GsmWindowWatcherPrivate;
+
+enum {
+        WINDOW_MANAGER_READY,
+        WINDOW_MAPPED,
+        STARTUP_COMPLETE,
+        LAST_SIGNAL
+};
+
+static guint signals [LAST_SIGNAL] = { 0 };
+
+G_DEFINE_TYPE_WITH_PRIVATE (GsmWindowWatcher, gsm_window_watcher, G_TYPE_OBJECT)
+
+static gboolean
+get_window_property (GsmWindowWatcher *watcher,
+                     Window            window,
+                     Atom              property,
+                     Atom              type,
+                     int               format,
+                     guchar          **data,
+                     gulong           *n_items)
+{
+        GsmWindowWatcherPrivate *priv;
+        GdkDisplay              *display;
+        Atom                     actual_type;
+        int                      actual_format;
+        gulong                   bytes_after;
+        int                      res;
+
+        priv = gsm_window_watcher_get_instance_private (watcher);
+        display = gdk_display_get_default ();
+
+        *data = NULL;
+        *n_items = 0;
+
+        gdk_x11_display_error_trap_push (display);
+        res = XGetWindowProperty (priv->xdisplay,
+                                  window,
+                                  property,
+                                  0, G_MAXLONG,
+                                  False,
+                                  type,
+                                  &actual_type,
+                                  &actual_format,
+                                  n_items,
+                                  &bytes_after,
+                                  data);
+        if (gdk_x11_display_error_trap_pop (display) != 0 || res != Success) {
+                *data = NULL;
+                return FALSE;
+        }
+
+        if (actual_type != type || actual_format != format || *n_items == 0) {
+                if (*data != NULL) {
+                        XFree (*data);
+                        *data = NULL;
+                }
+                return FALSE;
+        }
+
+        return TRUE;
+}
+
+static gboolean
+get_window (GsmWindowWatcher *watcher,
+            Window            window,
+            Atom              property,
+            Window           *value)
+{
+        guchar *data;
+        gulong  n_items;
+
+        if (!get_window_property (watcher, window, property, XA_WINDOW, 32, &data, &n_items)) {
+                return FALSE;
+        }
+
+        *value = ((Window *) data)[0];
+        XFree (data);
+
+        return TRUE;
+}
+
+static int
+get_window_pid (GsmWindowWatcher *watcher,
+                Window            window)
+{
+        GsmWindowWatcherPrivate *priv;
+        guchar                  *data;
+        gulong                   n_items;
+        int                      pid;
+
+        priv = gsm_window_watcher_get_instance_private (watcher);
+
+        if (!get_window_property (watcher, window, priv->net_wm_pid, XA_CARDINAL, 32, &data, &n_items)) {
+                return 0;
+        }
+
+        pid = (int) ((gulong *) data)[0];
+        XFree (data);
+
+        return pid;
+}
+
+static char *
+get_window_string (GsmWindowWatcher *watcher,
+                   Window            window,
+                   Atom              property,
+                   Atom              type)
+{
+        guchar *data;
+        gulong  n_items;
+        char   *str;
+
+        if (!get_window_property (watcher, window, property, type, 8, &data, &n_items)) {
+                return NULL;
+        }
+
+        str = g_strndup ((char *) data, n_items);
+        XFree (data);
+
+        return str;
+}
+
+static void
+check_window_manager (GsmWindowWatcher *watcher)
+{
+        GsmWindowWatcherPrivate *priv;
+        Window                   check;
+        Window                   check_self;
+
+        priv = gsm_window_watcher_get_instance_private (watcher);
+
+        if (priv->window_manager_ready) {
+                return;
+        }
+
+        /* the check window points to itself while its owner is alive,
+         * see the EWMH specification */
+        if (!get_window (watcher, priv->root, priv->net_supporting_wm_check, &check)
+            || !get_window (watcher, check, priv->net_supporting_wm_check, &check_self)
+            || check != check_self) {
+                return;
+        }
+
+        priv->window_manager_ready = TRUE;
+
+        g_signal_emit (watcher, signals[WINDOW_MANAGER_READY], 0, get_window_pid (watcher, check));
+}
+
+static void
+check_new_window (GsmWindowWatcher *watcher,
+                  Window            window)
+{
+        GsmWindowWatcherPrivate *priv;
+        Window                   leader;
+        char                    *startup_id;
+        char                    *sm_client_id;
+        int                      pid;
+
+        priv = gsm_window_watcher_get_instance_private (watcher);
+
+        pid = get_window_pid (watcher, window);
+        startup_id = get_window_string (watcher, window, priv->net_startup_id, priv->utf8_string);
+
+        /* the client id given through DESKTOP_AUTOSTART_ID lives on the
+         * client leader, see the ICCCM */
+        sm_client_id = NULL;
+        if (get_window (watcher, window, priv->wm_client_leader, &leader)) {
+                sm_client_id = get_window_string (watcher, leader, priv->sm_client_id, XA_STRING);
+        }
+
+        g_signal_emit (watcher, signals[WINDOW_MAPPED], 0, pid, startup_id, sm_client_id);
+
+        g_free (startup_id);
+        g_free (sm_client_id);
+}
+
+static void
+check_client_list (GsmWindowWatcher *watcher)
+{
+        GsmWindowWatcherPrivate *priv;
+        guchar                  *data;
+        gulong                   n_items;
+        gulong                   i;
+
+        priv = gsm_window_watcher_get_instance_private (watcher);
+
+        if (!get_window_property (watcher, priv->root, priv->net_client_list, XA_WINDOW, 32, &data, &n_items)) {
+                return;
+        }
+
+        for (i = 0; i < n_items; i++) {
+                Window window = ((Window *) data)[i];
+
+                if (g_hash_table_contains (priv->known_windows, GUINT_TO_POINTER (window))) {
+                        continue;
+                }
+
+                g_hash_table_add (priv->known_windows, GUINT_TO_POINTER (window));
+                check_new_window (watcher, window);
+        }
+
+        XFree (data);
+}
+
+/* Startup notification messages look like
+ *
+ *   remove: ID="some id"
+ *
+ * with values optionally quoted and backslash escaped.
+ */
+static char *
+parse_startup_remove (const char *message)
+{
+        const char *p;
+        GString    *id;
+        gboolean    quoted;
+
+        if (!g_str_has_prefix (message, "remove:")) {
+                return NULL;
+        }
+
+        p = strstr (message, " ID=");
+        if (p == NULL) {
+                return NULL;
+        }
+        p += strlen (" ID=");
+
+        id = g_string_new (NULL);
+        quoted = FALSE;
+        for (; *p != '\0'; p++) {
+                if (*p == '\\' && p[1] != '\0') {
+                        p++;
+                        g_string_append_c (id, *p);
+                } else if (*p == '"') {
+                        quoted = !quoted;
+                } else if (*p == ' ' && !quoted) {
+                        break;
+                } else {
+                        g_string_append_c (id, *p);
+                }
+        }
+
+        return g_string_free (id, FALSE);
+}
+
+static void
+handle_startup_message (GsmWindowWatcher    *watcher,
+                        XClientMessageEvent *xclient)
+{
+        GsmWindowWatcherPrivate *priv;
+        GString                 *message;
+        gpointer                 key;
+        int                      i;
+
+        priv = gsm_window_watcher_get_instance_private (watcher);
+
+        key = GUINT_TO_POINTER (xclient->window);
+
+        if (xclient->message_type == priv->net_startup_info_begin) {
+                message = g_string_new (NULL);
+                g_hash_table_replace (priv->startup_messages, key, message);
+        } else {
+                message = g_hash_table_lookup (priv->startup_messages, key);
+                if (message == NULL) {
+                        return;
+                }
+        }
+
+        /* messages come in chunks of 20 bytes, the last one is nul
+         * terminated */
+        for (i = 0; i < 20; i++) {
+                char *id;
+
+                if (xclient->data.b[i] != '\0') {
+                        g_string_append_c (message, xclient->data.b[i]);
+                        continue;
+                }
+
+                id = parse_startup_remove (message->str);
+                if (id != NULL) {
+                        g_signal_emit (watcher, signals[STARTUP_COMPLETE], 0, id);
+                        g_free (id);
+                }
+
+                g_hash_table_remove (priv->startup_messages, key);
+                break;
+        }
+}
+
+static GdkFilterReturn
+root_window_filter (GdkXEvent        *gdk_xevent,
+                    GdkEvent         *event,
+                    GsmWindowWatcher *watcher)
+{
+        GsmWindowWatcherPrivate *priv;
+        XEvent                  *xevent = gdk_xevent;
+
+        priv = gsm_window_watcher_get_instance_private (watcher);
+
+        if (xevent->type != PropertyNotify
+            || xevent->xproperty.window != priv->root) {
+                return GDK_FILTER_CONTINUE;
+        }
+
+        if (xevent->xproperty.atom == priv->net_supporting_wm_check) {
+                check_window_manager (watcher);
+        } else if (xevent->xproperty.atom == priv->net_client_list) {
+                check_client_list (watcher);
+        }
+
+        return GDK_FILTER_CONTINUE;
+}
+
+/* GDK does not hand ClientMessage events to the filters of the window
+ * they were sent to, only to the filters of all windows, so the
+ * startup notification messages need a filter of their own. */
+static GdkFilterReturn
+client_message_filter (GdkXEvent        *gdk_xevent,
+                       GdkEvent         *event,
+                       GsmWindowWatcher *watcher)
+{
+        GsmWindowWatcherPrivate *priv;
+        XEvent                  *xevent = gdk_xevent;
+
+        priv = gsm_window_watcher_get_instance_private (watcher);
+
+        if (xevent->type != ClientMessage) {
+                return GDK_FILTER_CONTINUE;
+        }
+
+        if (xevent->xclient.message_type == priv->net_startup_info_begin
+            || xevent->xclient.message_type == priv->net_startup_info) {
+                handle_startup_message (watcher, &xevent->xclient);
+        }
+
+        return GDK_FILTER_CONTINUE;
+}
+
+static void
+free_message (GString *message)
+{
+        g_string_free (message, TRUE);
+}
+
+static void
+gsm_window_watcher_init (GsmWindowWatcher *watcher)
+{
+        GsmWindowWatcherPrivate *priv;
+
+        priv = gsm_window_watcher_get_instance_private (watcher);
+
+        priv->known_windows = g_hash_table_new (NULL, NULL);
+        priv->startup_messages = g_hash_table_new_full (NULL, NULL, NULL,
+                                                        (GDestroyNotify) free_message);
+}
+
+static GObject *
+gsm_window_watcher_constructor (GType                  type,
+                                guint                  n_construct_properties,
+                                GObjectConstructParam *construct_properties)
+{
+        GsmWindowWatcher        *watcher;
+        GsmWindowWatcherPrivate *priv;
+        GdkWindow               *root;
+
+        watcher = GSM_WINDOW_WATCHER (G_OBJECT_CLASS (gsm_window_watcher_parent_class)->constructor (type,
+                                                                                                     n_construct_properties,
+                                                                                                     construct_properties));
+        priv = gsm_window_watcher_get_instance_private (watcher);
+
+        priv->xdisplay = GDK_DISPLAY_XDISPLAY (gdk_display_get_default ());
+        priv->root = DefaultRootWindow (priv->xdisplay);
+
+        priv->net_supporting_wm_check = XInternAtom (priv->xdisplay, "_NET_SUPPORTING_WM_CHECK", False);
+        priv->net_client_list = XInternAtom (priv->xdisplay, "_NET_CLIENT_LIST", False);
+        priv->net_wm_pid = XInternAtom (priv->xdisplay, "_NET_WM_PID", False);
+        priv->net_startup_id = XInternAtom (priv->xdisplay, "_NET_STARTUP_ID", False);
+        priv->net_startup_info_begin = XInternAtom (priv->xdisplay, "_NET_STARTUP_INFO_BEGIN", False);
+        priv->net_startup_info = XInternAtom (priv->xdisplay, "_NET_STARTUP_INFO", False);
+        priv->wm_client_leader = XInternAtom (priv->xdisplay, "WM_CLIENT_LEADER", False);
+        priv->sm_client_id = XInternAtom (priv->xdisplay, "SM_CLIENT_ID", False);
+        priv->utf8_string = XInternAtom (priv->xdisplay, "UTF8_STRING", False);
+
+        /* startup notification messages are sent to the root window
+         * with PropertyChangeMask too */
+        root = gdk_get_default_root_window ();
+        gdk_window_set_events (root, gdk_window_get_events (root) | GDK_PROPERTY_CHANGE_MASK);
+        gdk_window_add_filter (root, (GdkFilterFunc) root_window_filter, watcher);
+        gdk_window_add_filter (NULL, (GdkFilterFunc) client_message_filter, watcher);
+
+        return G_OBJECT (watcher);
+}
+
+static void
+gsm_window_watcher_finalize (GObject *object)
+{
+        GsmWindowWatcherPrivate *priv;
+
+        priv = gsm_window_watcher_get_instance_private (GSM_WINDOW_WATCHER (object));
+
+        gdk_window_remove_filter (gdk_get_default_root_window (),
+                                  (GdkFilterFunc) root_window_filter,
+                                  object);
+        gdk_window_remove_filter (NULL,
+                                  (GdkFilterFunc) client_message_filter,
+                                  object);
+
+        g_hash_table_destroy (priv->known_windows);
+        g_hash_table_destroy (priv->startup_messages);
+
+        G_OBJECT_CLASS (gsm_window_watcher_parent_class)->finalize (object);
+}
+
+static void
+gsm_window_watcher_class_init (GsmWindowWatcherClass *klass)
+{
+        GObjectClass *object_class = G_OBJECT_CLASS (klass);
+
+        object_class->constructor = gsm_window_watcher_constructor;
+        object_class->finalize = gsm_window_watcher_finalize;
+
+        signals [WINDOW_MANAGER_READY] =
+                g_signal_new ("window-manager-ready",
+                              G_TYPE_FROM_CLASS (object_class),
+                              G_SIGNAL_RUN_LAST,
+                              G_STRUCT_OFFSET (GsmWindowWatcherClass, window_manager_ready),
+                              NULL, NULL,
+                              g_cclosure_marshal_VOID__INT,
+                              G_TYPE_NONE,
+                              1, G_TYPE_INT);
+        signals [WINDOW_MAPPED] =
+                g_signal_new ("window-mapped",
+                              G_TYPE_FROM_CLASS (object_class),
+                              G_SIGNAL_RUN_LAST,
+                              G_STRUCT_OFFSET (GsmWindowWatcherClass, window_mapped),
+                              NULL, NULL,
+                              gsm_marshal_VOID__INT_STRING_STRING,
+                              G_TYPE_NONE,
+                              3, G_TYPE_INT, G_TYPE_STRING, G_TYPE_STRING);
+        signals [STARTUP_COMPLETE] =
+                g_signal_new ("startup-complete",
+                              G_TYPE_FROM_CLASS (object_class),
+                              G_SIGNAL_RUN_LAST,
+                              G_STRUCT_OFFSET (GsmWindowWatcherClass, startup_complete),
+                              NULL, NULL,
+                              g_cclosure_marshal_VOID__STRING,
+                              G_TYPE_NONE,
+                              1, G_TYPE_STRING);
+}
+
+/* Looks at what is already there; windows mapped before the watcher
+ * existed are reported too.
+ */
+void
+gsm_window_watcher_check (GsmWindowWatcher *watcher)
+{
+        g_return_if_fail (GSM_IS_WINDOW_WATCHER (watcher));
+
+        check_window_manager (watcher);
+        check_client_list (watcher);
+}
+
+GsmWindowWatcher *
+gsm_window_watcher_new (void)
+{
+        if (!GDK_IS_X11_DISPLAY (gdk_display_get_default ())) {
+                return NULL;
+        }
+
+        return g_object_new (GSM_TYPE_WINDOW_WATCHER, NULL);
+}
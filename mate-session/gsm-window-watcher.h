@@ -0,0 +1,50 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 8 -*-
+ *
+ * Copyright (C) 2012-2021 MATE Developers
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA.
+ *
+ */
+
+#ifndef __GSM_WINDOW_WATCHER_H__
+#define __GSM_WINDOW_WATCHER_H__
+
+#include <glib-object.h>
+
+G_BEGIN_DECLS
+
+#define GSM_TYPE_WINDOW_WATCHER            (gsm_window_watcher_get_type ())
+G_DECLARE_DERIVABLE_TYPE (GsmWindowWatcher, gsm_window_watcher, GSM, WINDOW_WATCHER, GObject)
+
+struct _GsmWindowWatcherClass
+{
+        GObjectClass parent_class;
+
+        void          (* window_manager_ready)  (GsmWindowWatcher *watcher,
+                                                 int               pid);
+        void          (* window_mapped)         (GsmWindowWatcher *watcher,
+                                                 int               pid,
+                                                 const char       *startup_id,
+                                                 const char       *sm_client_id);
+        void          (* startup_complete)      (GsmWindowWatcher *watcher,
+                                                 const char       *startup_id);
+};
+
+GsmWindowWatcher * gsm_window_watcher_new   (void);
+void               gsm_window_watcher_check (GsmWindowWatcher *watcher);
+
+G_END_DECLS
+
+#endif /* __GSM_WINDOW_WATCHER_H__ */
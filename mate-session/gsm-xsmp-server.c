@@ -28,12 +28,16 @@
 #include <unistd.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/socket.h>
 #include <fcntl.h>
 #include <string.h>
+#include <errno.h>
 
 #include <glib.h>
 #include <glib/gi18n.h>
+#include <glib/gstdio.h>
 #include <glib-object.h>
+#include <gio/gio.h>
 
 #include <X11/ICE/ICElib.h>
 #include <X11/ICE/ICEutil.h>
@@ -52,6 +56,7 @@
 #include "gsm-xsmp-server.h"
 #include "gsm-xsmp-client.h"
 #include "gsm-util.h"
+#include "gsm-metrics.h"
 
 /* ICEauthority stuff */
 /* Various magic numbers stolen from iceauth.c */
@@ -62,6 +67,9 @@
 #define GSM_ICE_MAGIC_COOKIE_AUTH_NAME "MIT-MAGIC-COOKIE-1"
 #define GSM_ICE_MAGIC_COOKIE_LEN       16
 
+#define SESSION_SCHEMA      "org.mate.session"
+#define KEY_XSMP_LOCAL_ONLY "xsmp-local-only"
+
 struct _GsmXsmpServer
 {
         GObject         parent;
@@ -71,6 +79,10 @@ struct _GsmXsmpServer
         int             num_xsmp_sockets;
         int             num_local_xsmp_sockets;
 
+        /* local-only mode: listen on a private socket and authenticate
+         * clients by peer credentials instead of ICEauthority cookies */
+        gboolean        local_only;
+        char           *private_socket_path;
 };
 
 enum {
@@ -197,6 +209,32 @@ auth_ice_connection (IceConn ice_conn)
         g_io_channel_unref (channel);
 }
 
+static gboolean
+check_peer_credentials (int fd)
+{
+#ifdef SO_PEERCRED
+        struct ucred cred;
+        socklen_t    len;
+
+        len = sizeof (cred);
+        if (getsockopt (fd, SOL_SOCKET, SO_PEERCRED, &cred, &len) != 0) {
+                g_debug ("GsmXsmpServer: unable to get peer credentials: %s",
+                         g_strerror (errno));
+                return FALSE;
+        }
+
+        if (cred.uid != getuid ()) {
+                g_warning ("Rejecting XSMP connection from pid %d owned by uid %d",
+                           (int) cred.pid, (int) cred.uid);
+                return FALSE;
+        }
+
+        return TRUE;
+#else
+        return FALSE;
+#endif
+}
+
 /* This is called (by glib via xsmp->ice_connection_watch) when a
  * connection is first received on the ICE listening socket.
  */
@@ -216,6 +254,16 @@ accept_ice_connection (GIOChannel           *source,
                 return TRUE;
         }
 
+        /* In local-only mode there are no cookies to check, so the
+         * connection is only let through if it comes from our own user.
+         */
+        if (data->server->local_only &&
+            !check_peer_credentials (IceConnectionNumber (ice_conn))) {
+                gsm_metrics_increment (GSM_METRIC_XSMP_CLIENTS_REJECTED);
+                disconnect_ice_connection (ice_conn);
+                return TRUE;
+        }
+
         auth_ice_connection (ice_conn);
 
         return TRUE;
@@ -319,6 +367,7 @@ accept_xsmp_connection (SmsConn        sms_conn,
         /* FIXME: what about during shutdown but before gsm_xsmp_shutdown? */
         if (server->xsmp_sockets == NULL) {
                 g_debug ("GsmXsmpServer: In shutdown, rejecting new client");
+                gsm_metrics_increment (GSM_METRIC_XSMP_CLIENTS_REJECTED);
 
                 *failure_reason_ret = strdup (_("Refusing new client connection because the session is currently being shut down\n"));
                 return FALSE;
@@ -338,6 +387,8 @@ accept_xsmp_connection (SmsConn        sms_conn,
 
         gsm_xsmp_client_connect (GSM_XSMP_CLIENT (client), sms_conn, mask_ret, callbacks_ret);
 
+        gsm_metrics_increment (GSM_METRIC_XSMP_CLIENTS_ACCEPTED);
+
         return TRUE;
 }
 
@@ -529,6 +580,79 @@ update_iceauthority (GsmXsmpServer *server,
         return ok;
 }
 
+/* Only installed on the private listener, whose connections have
+ * already been checked by check_peer_credentials().
+ */
+static Bool
+local_host_based_auth_proc (char *hostname)
+{
+        return True;
+}
+
+static gboolean
+use_local_only_transport (void)
+{
+#ifdef SO_PEERCRED
+        GSettings *settings;
+        gboolean   local_only;
+
+        settings = g_settings_new (SESSION_SCHEMA);
+        local_only = g_settings_get_boolean (settings, KEY_XSMP_LOCAL_ONLY);
+        g_object_unref (settings);
+
+        return local_only;
+#else
+        return FALSE;
+#endif
+}
+
+static gboolean
+setup_private_listener (GsmXsmpServer *server)
+{
+        char        error[256];
+        const char *runtime_dir;
+        char       *dir;
+        int         res;
+
+        runtime_dir = g_getenv ("XDG_RUNTIME_DIR");
+        if (runtime_dir == NULL || !g_path_is_absolute (runtime_dir)) {
+                g_debug ("GsmXsmpServer: XDG_RUNTIME_DIR is not set, not using a private XSMP socket");
+                return FALSE;
+        }
+
+        dir = g_build_filename (runtime_dir, "mate-session", NULL);
+        if (g_mkdir_with_parents (dir, 0700) != 0) {
+                g_warning ("Unable to create directory %s: %s", dir, g_strerror (errno));
+                g_free (dir);
+                return FALSE;
+        }
+
+        server->private_socket_path = g_strdup_printf ("%s/xsmp-%d", dir, (int) getpid ());
+        g_free (dir);
+
+        /* a stale socket can only be left behind by a crashed process that
+         * happened to have our pid */
+        g_unlink (server->private_socket_path);
+
+        /* Xtrans treats a port starting with '/' as a full socket path */
+        res = IceListenForWellKnownConnections (server->private_socket_path,
+                                                &server->num_xsmp_sockets,
+                                                &server->xsmp_sockets,
+                                                sizeof (error),
+                                                error);
+        if (! res) {
+                g_warning ("Could not create private XSMP socket %s: %s",
+                           server->private_socket_path, error);
+                g_free (server->private_socket_path);
+                server->private_socket_path = NULL;
+                return FALSE;
+        }
+
+        g_debug ("GsmXsmpServer: listening on private socket %s", server->private_socket_path);
+
+        return TRUE;
+}
+
 static void
 setup_listener (GsmXsmpServer *server)
 {
@@ -543,20 +667,6 @@ setup_listener (GsmXsmpServer *server)
         IceSetIOErrorHandler (ice_io_error_handler);
         SmsSetErrorHandler (sms_error_handler);
 
-        /* Initialize libSM; we pass NULL for hostBasedAuthProc to disable
-         * host-based authentication.
-         */
-        res = SmsInitialize (PACKAGE,
-                             VERSION,
-                             (SmsNewClientProc)accept_xsmp_connection,
-                             server,
-                             NULL,
-                             sizeof (error),
-                             error);
-        if (! res) {
-                gsm_util_init_error (TRUE, "Could not initialize libSM: %s", error);
-        }
-
 #if HAVE_XTRANS
         /* By default, IceListenForConnections will open one socket for each
          * transport type known to X. We don't want connections from remote
@@ -569,22 +679,45 @@ setup_listener (GsmXsmpServer *server)
         _IceTransNoListen ("tcp");
 #endif
 
-        /* Create the XSMP socket. Older versions of IceListenForConnections
-         * have a bug which causes the umask to be set to 0 on certain types
-         * of failures. Probably not an issue on any modern systems, but
-         * we'll play it safe.
+        if (use_local_only_transport ()) {
+                server->local_only = setup_private_listener (server);
+                if (! server->local_only) {
+                        g_warning ("Falling back to ICE authority based XSMP authentication");
+                }
+        }
+
+        /* Initialize libSM; unless we are in local-only mode we pass NULL
+         * for hostBasedAuthProc to disable host-based authentication.
          */
-        saved_umask = umask (0);
-        umask (saved_umask);
-        res = IceListenForConnections (&server->num_xsmp_sockets,
-                                       &server->xsmp_sockets,
-                                       sizeof (error),
-                                       error);
+        res = SmsInitialize (PACKAGE,
+                             VERSION,
+                             (SmsNewClientProc)accept_xsmp_connection,
+                             server,
+                             server->local_only ? local_host_based_auth_proc : NULL,
+                             sizeof (error),
+                             error);
         if (! res) {
-                gsm_util_init_error (TRUE, _("Could not create ICE listening socket: %s"), error);
+                gsm_util_init_error (TRUE, "Could not initialize libSM: %s", error);
         }
 
-        umask (saved_umask);
+        if (! server->local_only) {
+                /* Create the XSMP socket. Older versions of IceListenForConnections
+                 * have a bug which causes the umask to be set to 0 on certain types
+                 * of failures. Probably not an issue on any modern systems, but
+                 * we'll play it safe.
+                 */
+                saved_umask = umask (0);
+                umask (saved_umask);
+                res = IceListenForConnections (&server->num_xsmp_sockets,
+                                               &server->xsmp_sockets,
+                                               sizeof (error),
+                                               error);
+                if (! res) {
+                        gsm_util_init_error (TRUE, _("Could not create ICE listening socket: %s"), error);
+                }
+
+                umask (saved_umask);
+        }
 
         /* Find the local sockets in the returned socket list and move them
          * to the start of the list.
@@ -630,8 +763,15 @@ setup_listener (GsmXsmpServer *server)
         }
 #endif
 
-        /* Update .ICEauthority with new auth entries for our socket */
-        if (!update_iceauthority (server, TRUE)) {
+        /* Update .ICEauthority with new auth entries for our socket, unless
+         * clients are authenticated by their peer credentials instead.
+         */
+        if (server->local_only) {
+                for (i = 0; i < server->num_local_xsmp_sockets; i++) {
+                        IceSetHostBasedAuthProc (server->xsmp_sockets[i],
+                                                 local_host_based_auth_proc);
+                }
+        } else if (!update_iceauthority (server, TRUE)) {
                 /* FIXME: is this really fatal? Hm... */
                 gsm_util_init_error (TRUE,
                                      "Could not update ICEauthority file %s",
@@ -698,6 +838,11 @@ gsm_xsmp_server_finalize (GObject *object)
         IceFreeListenObjs (xsmp_server->num_xsmp_sockets,
                            xsmp_server->xsmp_sockets);
 
+        if (xsmp_server->private_socket_path != NULL) {
+                g_unlink (xsmp_server->private_socket_path);
+                g_free (xsmp_server->private_socket_path);
+        }
+
         if (xsmp_server->client_store != NULL) {
                 g_object_unref (xsmp_server->client_store);
         }
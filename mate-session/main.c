@@ -50,6 +50,8 @@
 #include "gsm-manager.h"
 #include "gsm-xsmp-server.h"
 #include "gsm-store.h"
+#include "gsm-readahead.h"
+#include "gsm-watchdog.h"
 
 #include "msm-gnome.h"
 
@@ -78,6 +80,7 @@
 #define GSM_DBUS_NAME "org.gnome.SessionManager"
 
 #define KEY_AUTOSAVE "auto-save-session"
+#define KEY_STALL_THRESHOLD "stall-threshold"
 
 static gboolean failsafe = FALSE;
 static gboolean show_version = FALSE;
@@ -464,6 +467,7 @@ static gboolean signal_cb(int signo, gpointer data)
 		case SIGUSR1:
 			g_debug("Got USR1 signal");
 			ret = TRUE;
+			mdm_log_dump_flight_recorder("SIGUSR1");
 			mdm_log_toggle_debug();
 			break;
 		default:
@@ -573,6 +577,15 @@ static void set_overlay_scroll (void)
 	g_object_unref (settings);
 }
 
+static void start_watchdog (void)
+{
+	GSettings *settings;
+
+	settings = g_settings_new (GSM_SCHEMA);
+	gsm_watchdog_start (g_settings_get_int (settings, KEY_STALL_THRESHOLD));
+	g_object_unref (settings);
+}
+
 static gboolean
 check_gl (gchar **gl_renderer, GError **error)
 {
@@ -606,6 +619,8 @@ int main(int argc, char** argv)
 	static char** override_autostart_dirs = NULL;
 	char* gl_renderer = NULL;
 	gboolean gl_failed = FALSE;
+	gboolean display_ok;
+	GOptionContext* context;
 
 	static GOptionEntry entries[] = {
 		{"autostart", 'a', 0, G_OPTION_ARG_STRING_ARRAY, &override_autostart_dirs, N_("Override standard autostart directories"), NULL},
@@ -616,6 +631,10 @@ int main(int argc, char** argv)
 		{NULL, 0, 0, 0, NULL, NULL, NULL }
 	};
 
+	/* Get the disk busy with what the session will need while we
+	 * are still setting up. */
+	gsm_readahead_start();
+
 	/* Make sure that we have a session bus */
 	if (!require_dbus_session(argc, argv, &error))
 	{
@@ -633,8 +652,15 @@ int main(int argc, char** argv)
 	sigemptyset(&sa.sa_mask);
 	sigaction(SIGPIPE, &sa, 0);
 
+	/* Only GDK is brought up here, to talk to the X server; GTK+ is
+	 * initialized by gsm_util_ensure_gtk() when a dialog is shown. */
+	display_ok = gdk_init_check(&argc, &argv);
+
 	error = NULL;
-	gtk_init_with_args(&argc, &argv, (char*) _(" - the MATE session manager"), entries, GETTEXT_PACKAGE, &error);
+	context = g_option_context_new(_(" - the MATE session manager"));
+	g_option_context_add_main_entries(context, entries, GETTEXT_PACKAGE);
+	g_option_context_parse(context, &argc, &argv, &error);
+	g_option_context_free(context);
 
 	if (error != NULL)
 	{
@@ -648,6 +674,12 @@ int main(int argc, char** argv)
 		exit(1);
 	}
 
+	if (!display_ok)
+	{
+		g_warning("cannot open display: %s", g_getenv("DISPLAY") ? g_getenv("DISPLAY") : "");
+		exit(1);
+	}
+
         gsm_util_export_activation_environment (NULL);
 
 #ifdef HAVE_SYSTEMD
@@ -761,8 +793,12 @@ int main(int argc, char** argv)
 	_gsm_manager_set_renderer (manager, gl_renderer);
 	gsm_manager_start(manager);
 
+	start_watchdog();
+
 	gtk_main();
 
+	gsm_watchdog_stop();
+
 	if (xsmp_server != NULL)
 	{
 		g_object_unref(xsmp_server);
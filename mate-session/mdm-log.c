@@ -24,6 +24,7 @@
 #include "config.h"
 
 #include <stdio.h>
+#include <fcntl.h>
 #include <string.h>
 #include <stdarg.h>
 #include <signal.h>
@@ -31,15 +32,79 @@
 #include <unistd.h>
 
 #include <syslog.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
 
 #include <glib.h>
 #include <glib/gstdio.h>
 
 #include "mdm-log.h"
 
+/* The flight recorder keeps the last FLIGHT_RECORDER_SIZE messages of
+ * every level, debug included, in a preallocated ring, so that there is
+ * some history to look at when something hangs or crashes with
+ * debugging off.  Writers claim a slot with an atomic increment and mark
+ * it complete with its sequence number; the dump skips slots that are
+ * being written or have been reused, and only uses async-signal-safe
+ * calls so it can run from a crash handler. */
+#define FLIGHT_RECORDER_SIZE    512     /* must be a power of two */
+#define FLIGHT_RECORDER_DOMAIN  24
+#define FLIGHT_RECORDER_MESSAGE 216
+
+/* Dumps are appended to one file; once it is larger than this, it is
+ * renamed to <file>.old and a new one is started, so that at least the
+ * previous dumps survive and the files stay small */
+#define FLIGHT_RECORDER_MAX_FILE (1024 * 1024)
+
+typedef struct {
+        volatile guint  sequence;
+        const char     *prefix;
+        gint64          time;
+        char            domain[FLIGHT_RECORDER_DOMAIN];
+        char            message[FLIGHT_RECORDER_MESSAGE];
+} FlightRecord;
+
+/* Where there is a journal, messages are sent to it directly with the
+ * fields they were logged with, instead of through syslog */
+#define JOURNAL_SOCKET          "/run/systemd/journal/socket"
+
+typedef struct {
+        char *key;
+        char *value;
+} ContextField;
+
+/* A client that keeps failing can trigger the same warning over and
+ * over; at most RATE_LIMIT_BURST warnings per call site are logged in
+ * each RATE_LIMIT_INTERVAL.  Less severe messages are never dropped:
+ * someone who turned debugging on wants all of it */
+#define RATE_LIMIT_LEVELS       (G_LOG_LEVEL_ERROR | G_LOG_LEVEL_CRITICAL | G_LOG_LEVEL_WARNING)
+#define RATE_LIMIT_INTERVAL     (30 * G_USEC_PER_SEC)
+#define RATE_LIMIT_BURST        10
+#define RATE_LIMIT_MAX_SITES    1024
+#define RATE_LIMIT_FLUSH        5 /* seconds */
+
+typedef struct {
+        gint64 begin;
+        guint  count;
+        guint  suppressed;
+} RateLimit;
+
 static gboolean initialized = FALSE;
 static int      syslog_levels = (G_LOG_LEVEL_ERROR | G_LOG_LEVEL_CRITICAL | G_LOG_LEVEL_WARNING);
 
+static FlightRecord  flight_records[FLIGHT_RECORDER_SIZE];
+static volatile guint flight_next = 0;
+static char         *flight_recorder_file = NULL;
+static char         *flight_recorder_old_file = NULL;
+
+static GMutex        log_mutex;
+static GHashTable   *rate_limits = NULL;
+static guint         rate_limit_flush_id = 0;
+static ContextField  context_fields[8];
+static gboolean      have_journal = FALSE;
+static gboolean      stderr_is_journal = FALSE;
+static gboolean      writer_set = FALSE;
+
 static void
 log_level_to_priority_and_prefix (GLogLevelFlags log_level,
                                   int           *priorityp,
@@ -99,33 +164,157 @@ log_level_to_priority_and_prefix (GLogLevelFlags log_level,
         }
 }
 
+static void
+flight_recorder_add (const char *log_domain,
+                     const char *prefix,
+                     const char *message)
+{
+        FlightRecord *record;
+        guint         index;
+
+        index = (guint) g_atomic_int_add (&flight_next, 1);
+        record = &flight_records[index % FLIGHT_RECORDER_SIZE];
+
+        g_atomic_int_set (&record->sequence, 0);
+
+        record->prefix = prefix;
+        record->time = g_get_real_time ();
+        g_strlcpy (record->domain, log_domain != NULL ? log_domain : "", sizeof (record->domain));
+        g_strlcpy (record->message, message != NULL ? message : "(NULL) message", sizeof (record->message));
+
+        g_atomic_int_set (&record->sequence, index + 1);
+}
+
+static void
+write_string (int         fd,
+              const char *string)
+{
+        size_t  length;
+        ssize_t written;
+
+        length = strlen (string);
+        while (length > 0) {
+                written = write (fd, string, length);
+                if (written <= 0) {
+                        return;
+                }
+                string += written;
+                length -= written;
+        }
+}
+
+/* snprintf() is not async-signal-safe */
+static void
+write_number (int     fd,
+              guint64 number,
+              int     min_digits)
+{
+        char  buf[24];
+        char *p;
+
+        p = buf + sizeof (buf) - 1;
+        *p = '\0';
+        do {
+                *--p = '0' + number % 10;
+                number /= 10;
+                min_digits--;
+        } while (number > 0 || min_digits > 0);
+
+        write_string (fd, p);
+}
+
+static void
+write_record (int                 fd,
+              const FlightRecord *record)
+{
+        write_string (fd, "[");
+        write_number (fd, record->time / G_USEC_PER_SEC, 1);
+        write_string (fd, ".");
+        write_number (fd, record->time % G_USEC_PER_SEC, 6);
+        write_string (fd, "] ");
+        if (record->domain[0] != '\0') {
+                write_string (fd, record->domain);
+                write_string (fd, "-");
+        }
+        write_string (fd, record->prefix);
+        write_string (fd, ": ");
+        write_string (fd, record->message);
+        write_string (fd, "\n");
+}
+
+static int
+open_flight_recorder_file (void)
+{
+        struct stat st;
+        int         fd;
+
+        fd = open (flight_recorder_file, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0600);
+        if (fd < 0) {
+                return -1;
+        }
+
+        if (fstat (fd, &st) == 0 && st.st_size >= FLIGHT_RECORDER_MAX_FILE) {
+                close (fd);
+                rename (flight_recorder_file, flight_recorder_old_file);
+                fd = open (flight_recorder_file, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0600);
+        }
+
+        return fd;
+}
+
+/* Appends the recorded messages, oldest first, to
+ * $XDG_RUNTIME_DIR/<program>-flight-recorder.log, or writes them to
+ * stderr if that cannot be opened.  Safe to call from a signal
+ * handler. */
 void
-mdm_log_default_handler (const gchar   *log_domain,
-                         GLogLevelFlags log_level,
-                         const gchar   *message,
-                         gpointer       unused_data)
+mdm_log_dump_flight_recorder (const char *reason)
 {
-        GString     *gstring;
-        int          priority;
-        const char  *level_prefix;
-        char        *string;
-        gboolean     do_log;
-        gboolean     is_fatal;
+        guint next;
+        guint index;
+        int   fd;
 
-        is_fatal = (log_level & G_LOG_FLAG_FATAL) != 0;
+        fd = -1;
+        if (flight_recorder_file != NULL) {
+                fd = open_flight_recorder_file ();
+        }
+        if (fd < 0) {
+                fd = STDERR_FILENO;
+        }
 
-        do_log = (log_level & syslog_levels);
-        if (! do_log) {
-                return;
+        write_string (fd, "Flight recorder dump at ");
+        write_number (fd, (guint64) time (NULL), 1);
+        write_string (fd, ": ");
+        write_string (fd, reason);
+        write_string (fd, "\n");
+
+        next = (guint) g_atomic_int_get (&flight_next);
+        index = next > FLIGHT_RECORDER_SIZE ? next - FLIGHT_RECORDER_SIZE : 0;
+
+        for (; index != next; index++) {
+                const FlightRecord *record;
+
+                record = &flight_records[index % FLIGHT_RECORDER_SIZE];
+                if ((guint) g_atomic_int_get (&record->sequence) != index + 1) {
+                        continue;
+                }
+
+                write_record (fd, record);
         }
 
-        if (! initialized) {
-                mdm_log_init ();
+        if (fd != STDERR_FILENO) {
+                close (fd);
         }
+}
 
-        log_level_to_priority_and_prefix (log_level,
-                                          &priority,
-                                          &level_prefix);
+static void
+syslog_message (int             priority,
+                const char     *level_prefix,
+                const char     *log_domain,
+                const char     *message,
+                gboolean        is_fatal)
+{
+        GString     *gstring;
+        char        *string;
 
         gstring = g_string_new (NULL);
 
@@ -136,11 +325,7 @@ mdm_log_default_handler (const gchar   *log_domain,
         g_string_append (gstring, level_prefix);
 
         g_string_append (gstring, ": ");
-        if (message == NULL) {
-                g_string_append (gstring, "(NULL) message");
-        } else {
-                g_string_append (gstring, message);
-        }
+        g_string_append (gstring, message);
         if (is_fatal) {
                 g_string_append (gstring, "\naborting...\n");
         } else {
@@ -154,6 +339,370 @@ mdm_log_default_handler (const gchar   *log_domain,
         g_free (string);
 }
 
+/* GLib takes care of the protocol, including messages too large for a
+ * datagram.  Returns FALSE if the journal did not take the message.
+ * Called with log_mutex held */
+static gboolean
+journal_message (GLogLevelFlags   log_level,
+                 const char      *message,
+                 const GLogField *fields,
+                 gsize            n_fields)
+{
+        GLogField   *entry;
+        const char  *prg_name;
+        char         priority_string[2];
+        int          priority;
+        gsize        n;
+        gsize        i;
+
+        entry = g_newa (GLogField, n_fields + 3 + G_N_ELEMENTS (context_fields));
+        n = 0;
+
+        log_level_to_priority_and_prefix (log_level, &priority, NULL);
+        priority_string[0] = '0' + priority;
+        priority_string[1] = '\0';
+
+        entry[n].key = "PRIORITY";
+        entry[n].value = priority_string;
+        entry[n++].length = -1;
+        entry[n].key = "MESSAGE";
+        entry[n].value = message;
+        entry[n++].length = -1;
+
+        prg_name = g_get_prgname ();
+        if (prg_name != NULL) {
+                entry[n].key = "SYSLOG_IDENTIFIER";
+                entry[n].value = prg_name;
+                entry[n++].length = -1;
+        }
+
+        for (i = 0; i < n_fields; i++) {
+                if (g_strcmp0 (fields[i].key, "PRIORITY") == 0
+                    || g_strcmp0 (fields[i].key, "MESSAGE") == 0
+                    || g_strcmp0 (fields[i].key, "SYSLOG_IDENTIFIER") == 0) {
+                        continue;
+                }
+                entry[n++] = fields[i];
+        }
+
+        for (i = 0; i < G_N_ELEMENTS (context_fields); i++) {
+                if (context_fields[i].key != NULL) {
+                        entry[n].key = context_fields[i].key;
+                        entry[n].value = context_fields[i].value;
+                        entry[n++].length = -1;
+                }
+        }
+
+        return g_log_writer_journald (log_level, entry, n, NULL) == G_LOG_WRITER_HANDLED;
+}
+
+/* What LOG_PERROR did for syslog, when stderr does not already go to
+ * the journal */
+static void
+stderr_message (const char *level_prefix,
+                const char *log_domain,
+                const char *message)
+{
+        struct iovec iov[7];
+        const char  *prg_name;
+        int          n;
+
+        n = 0;
+        prg_name = g_get_prgname ();
+        if (prg_name != NULL) {
+                iov[n].iov_base = (char *) prg_name;
+                iov[n++].iov_len = strlen (prg_name);
+                iov[n].iov_base = (char *) ": ";
+                iov[n++].iov_len = 2;
+        }
+        if (log_domain != NULL) {
+                iov[n].iov_base = (char *) log_domain;
+                iov[n++].iov_len = strlen (log_domain);
+                iov[n].iov_base = (char *) "-";
+                iov[n++].iov_len = 1;
+        }
+        iov[n].iov_base = (char *) level_prefix;
+        iov[n++].iov_len = strlen (level_prefix);
+        iov[n].iov_base = (char *) ": ";
+        iov[n++].iov_len = 2;
+        iov[n].iov_base = (char *) message;
+        iov[n++].iov_len = strlen (message);
+
+        if (writev (STDERR_FILENO, iov, n) >= 0) {
+                write_string (STDERR_FILENO, "\n");
+        }
+}
+
+/* Called with log_mutex held */
+static void
+output_message (GLogLevelFlags   log_level,
+                const char      *log_domain,
+                const char      *message,
+                const GLogField *fields,
+                gsize            n_fields)
+{
+        int         priority;
+        const char *level_prefix;
+
+        log_level_to_priority_and_prefix (log_level,
+                                          &priority,
+                                          &level_prefix);
+
+        if (have_journal && journal_message (log_level, message, fields, n_fields)) {
+                if (! stderr_is_journal) {
+                        stderr_message (level_prefix, log_domain, message);
+                }
+        } else {
+                syslog_message (priority, level_prefix, log_domain, message,
+                                (log_level & G_LOG_FLAG_FATAL) != 0);
+        }
+}
+
+static void
+output_suppressed (const char *site,
+                   guint       suppressed)
+{
+        char notice[320];
+
+        g_snprintf (notice, sizeof (notice),
+                    "Suppressed %u messages from %s", suppressed, site);
+        output_message (G_LOG_LEVEL_WARNING, NULL, notice, NULL, 0);
+}
+
+/* Reports the messages dropped in intervals that have ended, instead
+ * of waiting for the next message from the same call site, which may
+ * never come */
+static gboolean
+rate_limit_flush (gpointer data)
+{
+        GHashTableIter iter;
+        const char    *site;
+        RateLimit     *limit;
+        gboolean       pending;
+        gint64         now;
+
+        g_mutex_lock (&log_mutex);
+
+        now = g_get_monotonic_time ();
+        pending = FALSE;
+
+        g_hash_table_iter_init (&iter, rate_limits);
+        while (g_hash_table_iter_next (&iter, (gpointer *) &site, (gpointer *) &limit)) {
+                if (limit->suppressed == 0) {
+                        continue;
+                }
+
+                if (now - limit->begin < RATE_LIMIT_INTERVAL) {
+                        pending = TRUE;
+                        continue;
+                }
+
+                output_suppressed (site, limit->suppressed);
+                limit->begin = 0;
+                limit->count = 0;
+                limit->suppressed = 0;
+        }
+
+        if (! pending) {
+                rate_limit_flush_id = 0;
+        }
+
+        g_mutex_unlock (&log_mutex);
+
+        return pending;
+}
+
+/* Allows at most RATE_LIMIT_BURST messages from the same call site per
+ * RATE_LIMIT_INTERVAL.  Returns FALSE if the message must be dropped;
+ * @suppressed is set to the number of messages dropped in the interval
+ * that just ended.  Called with log_mutex held. */
+static gboolean
+rate_limit_check (const char *site,
+                  guint      *suppressed)
+{
+        RateLimit *limit;
+        gint64     now;
+
+        *suppressed = 0;
+
+        if (rate_limits == NULL) {
+                rate_limits = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_free);
+        }
+
+        limit = g_hash_table_lookup (rate_limits, site);
+        if (limit == NULL) {
+                if (g_hash_table_size (rate_limits) >= RATE_LIMIT_MAX_SITES) {
+                        return TRUE;
+                }
+                limit = g_new0 (RateLimit, 1);
+                g_hash_table_insert (rate_limits, g_strdup (site), limit);
+        }
+
+        now = g_get_monotonic_time ();
+        if (limit->begin == 0 || now - limit->begin >= RATE_LIMIT_INTERVAL) {
+                *suppressed = limit->suppressed;
+                limit->begin = now;
+                limit->count = 0;
+                limit->suppressed = 0;
+        }
+
+        if (limit->count >= RATE_LIMIT_BURST) {
+                limit->suppressed++;
+                if (rate_limit_flush_id == 0) {
+                        rate_limit_flush_id = g_timeout_add_seconds (RATE_LIMIT_FLUSH,
+                                                                     rate_limit_flush,
+                                                                     NULL);
+                }
+                return FALSE;
+        }
+
+        limit->count++;
+
+        return TRUE;
+}
+
+static void
+log_message (GLogLevelFlags   log_level,
+             const GLogField *fields,
+             gsize            n_fields)
+{
+        const char *log_domain;
+        const char *message;
+        const char *code_file;
+        const char *code_line;
+        const char *level_prefix;
+        char        site[256];
+        guint       suppressed;
+        gboolean    is_fatal;
+        gsize       i;
+
+        log_domain = NULL;
+        message = NULL;
+        code_file = NULL;
+        code_line = NULL;
+        suppressed = 0;
+
+        for (i = 0; i < n_fields; i++) {
+                if (fields[i].length >= 0) {
+                        continue;
+                }
+                if (g_strcmp0 (fields[i].key, "MESSAGE") == 0) {
+                        message = fields[i].value;
+                } else if (g_strcmp0 (fields[i].key, "GLIB_DOMAIN") == 0) {
+                        log_domain = fields[i].value;
+                } else if (g_strcmp0 (fields[i].key, "CODE_FILE") == 0) {
+                        code_file = fields[i].value;
+                } else if (g_strcmp0 (fields[i].key, "CODE_LINE") == 0) {
+                        code_line = fields[i].value;
+                }
+        }
+
+        if (message == NULL) {
+                message = "(NULL) message";
+        }
+
+        is_fatal = (log_level & G_LOG_FLAG_FATAL) != 0;
+
+        log_level_to_priority_and_prefix (log_level, NULL, &level_prefix);
+
+        flight_recorder_add (log_domain, level_prefix, message);
+
+        if (! (log_level & syslog_levels)) {
+                return;
+        }
+
+        if (! initialized) {
+                mdm_log_init ();
+        }
+
+        /* messages logged through g_log() have no call site, tell them
+         * apart by their text */
+        if (code_file != NULL && code_line != NULL) {
+                g_snprintf (site, sizeof (site), "%s:%s", code_file, code_line);
+        } else {
+                g_strlcpy (site, message, sizeof (site));
+        }
+
+        g_mutex_lock (&log_mutex);
+
+        if (is_fatal
+            || ! (log_level & RATE_LIMIT_LEVELS)
+            || rate_limit_check (site, &suppressed)) {
+                if (suppressed > 0) {
+                        output_suppressed (site, suppressed);
+                }
+
+                output_message (log_level, log_domain, message, fields, n_fields);
+        }
+
+        g_mutex_unlock (&log_mutex);
+}
+
+static GLogWriterOutput
+mdm_log_writer (GLogLevelFlags   log_level,
+                const GLogField *fields,
+                gsize            n_fields,
+                gpointer         user_data)
+{
+        log_message (log_level, fields, n_fields);
+
+        return G_LOG_WRITER_HANDLED;
+}
+
+void
+mdm_log_default_handler (const gchar   *log_domain,
+                         GLogLevelFlags log_level,
+                         const gchar   *message,
+                         gpointer       unused_data)
+{
+        GLogField fields[2];
+
+        fields[0].key = "MESSAGE";
+        fields[0].value = message;
+        fields[0].length = -1;
+        fields[1].key = "GLIB_DOMAIN";
+        fields[1].value = log_domain;
+        fields[1].length = -1;
+
+        log_message (log_level, fields, log_domain != NULL ? 2 : 1);
+}
+
+/* Attaches @key=@value to every message sent to the journal from now
+ * on, or stops attaching @key if @value is %NULL */
+void
+mdm_log_set_field (const char *key,
+                   const char *value)
+{
+        ContextField *field;
+        guint         i;
+
+        g_mutex_lock (&log_mutex);
+
+        field = NULL;
+        for (i = 0; i < G_N_ELEMENTS (context_fields); i++) {
+                if (g_strcmp0 (context_fields[i].key, key) == 0) {
+                        field = &context_fields[i];
+                        break;
+                }
+                if (field == NULL && context_fields[i].key == NULL) {
+                        field = &context_fields[i];
+                }
+        }
+
+        if (field != NULL) {
+                g_free (field->key);
+                g_free (field->value);
+                field->key = value != NULL ? g_strdup (key) : NULL;
+                field->value = g_strdup (value);
+        }
+
+        g_mutex_unlock (&log_mutex);
+
+        if (field == NULL) {
+                g_warning ("Too many log fields, not adding %s", key);
+        }
+}
+
 void
 mdm_log_toggle_debug (void)
 {
@@ -186,6 +735,17 @@ mdm_log_init (void)
 
         g_log_set_default_handler (mdm_log_default_handler, NULL);
 
+        /* GLib only allows setting the writer once */
+        if (! writer_set) {
+                g_log_set_writer_func (mdm_log_writer, NULL, NULL);
+                writer_set = TRUE;
+        }
+
+        have_journal = g_file_test (JOURNAL_SOCKET, G_FILE_TEST_EXISTS);
+        if (have_journal) {
+                stderr_is_journal = g_log_writer_is_journald (STDERR_FILENO);
+        }
+
         prg_name = g_get_prgname ();
 
         options = LOG_PID;
@@ -195,6 +755,15 @@ mdm_log_init (void)
 
         openlog (prg_name, options, LOG_DAEMON);
 
+        if (flight_recorder_file == NULL) {
+                char *basename;
+
+                basename = g_strdup_printf ("%s-flight-recorder.log", prg_name != NULL ? prg_name : "mdm");
+                flight_recorder_file = g_build_filename (g_get_user_runtime_dir (), basename, NULL);
+                flight_recorder_old_file = g_strconcat (flight_recorder_file, ".old", NULL);
+                g_free (basename);
+        }
+
         initialized = TRUE;
 }
 
@@ -202,6 +771,15 @@ void
 mdm_log_shutdown (void)
 {
         closelog ();
+
+        g_mutex_lock (&log_mutex);
+        have_journal = FALSE;
+        if (rate_limit_flush_id != 0) {
+                g_source_remove (rate_limit_flush_id);
+                rate_limit_flush_id = 0;
+        }
+        g_mutex_unlock (&log_mutex);
+
         initialized = FALSE;
 }
 
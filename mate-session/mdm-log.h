@@ -39,6 +39,18 @@ void      mdm_log_set_debug       (gboolean       debug);
 void      mdm_log_toggle_debug    (void);
 void      mdm_log_init            (void);
 void      mdm_log_shutdown        (void);
+void      mdm_log_dump_flight_recorder (const char *reason);
+void      mdm_log_set_field       (const char    *key,
+                                   const char    *value);
+
+/* Like g_warning() and friends, with one more field for the journal */
+#define   mdm_log_field(level, key, value, ...)                  \
+        g_log_structured (G_LOG_DOMAIN, level,                   \
+                          "CODE_FILE", __FILE__,                 \
+                          "CODE_LINE", G_STRINGIFY (__LINE__),   \
+                          "CODE_FUNC", G_STRFUNC,                \
+                          key, value,                            \
+                          "MESSAGE", __VA_ARGS__)
 
 /* compatibility */
 #define   mdm_fail               g_critical
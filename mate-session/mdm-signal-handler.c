@@ -41,6 +41,7 @@
 #include <glib-object.h>
 
 #include "mdm-signal-handler.h"
+#include "mdm-log.h"
 
 #ifdef __GNUC__
 #define UNUSED_VARIABLE __attribute__ ((unused))
@@ -274,6 +275,7 @@ static void signal_handler(int signo)
 		case SIGILL:
 		case SIGABRT:
 		case SIGTRAP:
+			mdm_log_dump_flight_recorder("fatal signal");
 			mdm_signal_handler_backtrace();
 			exit(1);
 			break;